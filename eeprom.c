@@ -1,24 +1,24 @@
-#include "eeprom.h"
-#include "tm4c123gh6pm.h"
-
-void initEeprom()
-{
-    SYSCTL_RCGCEEPROM_R = 1;
-    _delay_cycles(3);
-    while (EEPROM_EEDONE_R & EEPROM_EEDONE_WORKING);
-}
-
-void writeEeprom(uint16_t add, uint32_t data)
-{
-    EEPROM_EEBLOCK_R = add >> 4;
-    EEPROM_EEOFFSET_R = add & 0xF;
-    EEPROM_EERDWR_R = data;
-    while (EEPROM_EEDONE_R & EEPROM_EEDONE_WORKING);
-}
-
-uint32_t readEeprom(uint16_t add)
-{
-    EEPROM_EEBLOCK_R = add >> 4;
-    EEPROM_EEOFFSET_R = add & 0xF;
-    return EEPROM_EERDWR_R;
-}
+#include "eeprom.h"
+#include "tm4c123gh6pm.h"
+
+void initEeprom()
+{
+    SYSCTL_RCGCEEPROM_R = 1;
+    _delay_cycles(3);
+    while (EEPROM_EEDONE_R & EEPROM_EEDONE_WORKING);
+}
+
+void writeEeprom(uint16_t add, uint32_t data)
+{
+    EEPROM_EEBLOCK_R = add >> 4;
+    EEPROM_EEOFFSET_R = add & 0xF;
+    EEPROM_EERDWR_R = data;
+    while (EEPROM_EEDONE_R & EEPROM_EEDONE_WORKING);
+}
+
+uint32_t readEeprom(uint16_t add)
+{
+    EEPROM_EEBLOCK_R = add >> 4;
+    EEPROM_EEOFFSET_R = add & 0xF;
+    return EEPROM_EERDWR_R;
+}
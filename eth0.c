@@ -1,921 +1,1098 @@
-// ETH0 Library
-// Jason Losh
-
-//-----------------------------------------------------------------------------
-// Hardware Target
-//-----------------------------------------------------------------------------
-
-// Target Platform: EK-TM4C123GXL w/ ENC28J60
-// Target uC:       TM4C123GH6PM
-// System Clock:    40 MHz
-
-// Hardware configuration:
-// ENC28J60 Ethernet controller on SPI0
-//   MOSI (SSI0Tx) on PA5
-//   MISO (SSI0Rx) on PA4
-//   SCLK (SSI0Clk) on PA2
-//   ~CS (SW controlled) on PA3
-//   WOL on PB3
-//   INT on PC6
-
-//-----------------------------------------------------------------------------
-// Device includes, defines, and assembler directives
-//-----------------------------------------------------------------------------
-
-#include <eth0.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include "tm4c123gh6pm.h"
-#include "wait.h"
-#include "gpio.h"
-#include "spi0.h"
-#include <string.h>
-#include "common.h"
-#include "dhcp.h"
-
-// Pins
-#define CS PORTA,3
-#define WOL PORTB,3
-#define INT PORTC,6
-
-// Ether registers
-#define ERDPTL      0x00
-#define ERDPTH      0x01
-#define EWRPTL      0x02
-#define EWRPTH      0x03
-#define ETXSTL      0x04
-#define ETXSTH      0x05
-#define ETXNDL      0x06
-#define ETXNDH      0x07
-#define ERXSTL      0x08
-#define ERXSTH      0x09
-#define ERXNDL      0x0A
-#define ERXNDH      0x0B
-#define ERXRDPTL    0x0C
-#define ERXRDPTH    0x0D
-#define ERXWRPTL    0x0E
-#define ERXWRPTH    0x0F
-#define EIE         0x1B
-#define EIR         0x1C
-#define RXERIF  0x01
-#define TXERIF  0x02
-#define TXIF    0x08
-#define PKTIF   0x40
-#define ESTAT       0x1D
-#define CLKRDY  0x01
-#define TXABORT 0x02
-#define ECON2       0x1E
-#define PKTDEC  0x40
-#define ECON1       0x1F
-#define RXEN    0x04
-#define TXRTS   0x08
-#define ERXFCON     0x38
-#define EPKTCNT     0x39
-#define MACON1      0x40
-#define MARXEN  0x01
-#define RXPAUS  0x04
-#define TXPAUS  0x08
-#define MACON2      0x41
-#define MARST   0x80
-#define MACON3      0x42
-#define FULDPX  0x01
-#define FRMLNEN 0x02
-#define TXCRCEN 0x10
-#define PAD60   0x20
-#define MACON4      0x43
-#define MABBIPG     0x44
-#define MAIPGL      0x46
-#define MAIPGH      0x47
-#define MACLCON1    0x48
-#define MACLCON2    0x49
-#define MAMXFLL     0x4A
-#define MAMXFLH     0x4B
-#define MICMD       0x52
-#define MIIRD   0x01
-#define MIREGADR    0x54
-#define MIWRL       0x56
-#define MIWRH       0x57
-#define MIRDL       0x58
-#define MIRDH       0x59
-#define MAADR1      0x60
-#define MAADR0      0x61
-#define MAADR3      0x62
-#define MAADR2      0x63
-#define MAADR5      0x64
-#define MAADR4      0x65
-#define MISTAT      0x6A
-#define MIBUSY  0x01
-#define ECOCON      0x75
-
-// Ether phy registers
-#define PHCON1      0x00
-#define PDPXMD 0x0100
-#define PHSTAT1     0x01
-#define LSTAT  0x0400
-#define PHCON2      0x10
-#define HDLDIS 0x0100
-#define PHLCON      0x14
-
-
-
-// ------------------------------------------------------------------------------
-//  Globals
-// ------------------------------------------------------------------------------
-
-uint8_t nextPacketLsb = 0x00;
-uint8_t nextPacketMsb = 0x00;
-uint8_t sequenceId = 1;
-uint32_t sum;
-uint8_t macAddress[HW_ADD_LENGTH] = {2,3,4,5,6,131};
-uint8_t ipAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipSubnetMask[IP_ADD_LENGTH] = {255,255,255,0};
-uint8_t ipGwAddress[IP_ADD_LENGTH] = {0,0,0,0};
-uint8_t ipDNS[IP_ADD_LENGTH] = {0, 0, 0, 0};
-bool    dhcpEnabled = true;
-
-// ------------------------------------------------------------------------------
-//  Structures
-// ------------------------------------------------------------------------------
-
-// This M4F is little endian (TI hardwired it this way)
-// Network byte order is big endian
-// Must interpret uint16_t in reverse order
-
-typedef struct _enc28j60Frame // 4-bytes
-{
-  uint16_t size;
-  uint16_t status;
-  uint8_t data;
-} enc28j60Frame;
-
-
-
-//-----------------------------------------------------------------------------
-// Subroutines
-//-----------------------------------------------------------------------------
-
-// Buffer is configured as follows
-// Receive buffer starts at 0x0000 (bottom 6666 bytes of 8K space)
-// Transmit buffer at 01A0A (top 1526 bytes of 8K space)
-
-void etherCsOn()
-{
-    setPinValue(CS, 0);
-    __asm (" NOP");                    // allow line to settle
-    __asm (" NOP");
-    __asm (" NOP");
-    __asm (" NOP");
-}
-
-void etherCsOff()
-{
-    setPinValue(CS, 1);
-}
-
-void etherWriteReg(uint8_t reg, uint8_t data)
-{
-    etherCsOn();
-    writeSpi0Data(0x40 | (reg & 0x1F));
-    readSpi0Data();
-    writeSpi0Data(data);
-    readSpi0Data();
-    etherCsOff();
-}
-
-uint8_t etherReadReg(uint8_t reg)
-{
-    uint8_t data;
-    etherCsOn();
-    writeSpi0Data(0x00 | (reg & 0x1F));
-    readSpi0Data();
-    writeSpi0Data(0);
-    data = readSpi0Data();
-    etherCsOff();
-    return data;
-}
-
-void etherSetReg(uint8_t reg, uint8_t mask)
-{
-    etherCsOn();
-    writeSpi0Data(0x80 | (reg & 0x1F));
-    readSpi0Data();
-    writeSpi0Data(mask);
-    readSpi0Data();
-    etherCsOff();
-}
-
-void etherClearReg(uint8_t reg, uint8_t mask)
-{
-    etherCsOn();
-    writeSpi0Data(0xA0 | (reg & 0x1F));
-    readSpi0Data();
-    writeSpi0Data(mask);
-    readSpi0Data();
-    etherCsOff();
-}
-
-void etherSetBank(uint8_t reg)
-{
-    etherClearReg(ECON1, 0x03);
-    etherSetReg(ECON1, reg >> 5);
-}
-
-void etherWritePhy(uint8_t reg, uint16_t data)
-{
-    etherSetBank(MIREGADR);
-    etherWriteReg(MIREGADR, reg);
-    etherWriteReg(MIWRL, data & 0xFF);
-    etherWriteReg(MIWRH, (data >> 8) & 0xFF);
-}
-
-uint16_t etherReadPhy(uint8_t reg)
-{
-    uint16_t data, dataH;
-    etherSetBank(MIREGADR);
-    etherWriteReg(MIREGADR, reg);
-    etherWriteReg(MICMD, MIIRD);
-    waitMicrosecond(11);
-    etherSetBank(MISTAT);
-    while ((etherReadReg(MISTAT) & MIBUSY) != 0);
-    etherSetBank(MICMD);
-    etherWriteReg(MICMD, 0);
-    data = etherReadReg(MIRDL);
-    dataH = etherReadReg(MIRDH);
-    data |= (dataH << 8);
-    return data;
-}
-
-void etherWriteMemStart()
-{
-    etherCsOn();
-    writeSpi0Data(0x7A);
-    readSpi0Data();
-}
-
-void etherWriteMem(uint8_t data)
-{
-    writeSpi0Data(data);
-    readSpi0Data();
-}
-
-void etherWriteMemStop()
-{
-    etherCsOff();
-}
-
-void etherReadMemStart()
-{
-    etherCsOn();
-    writeSpi0Data(0x3A);
-    readSpi0Data();
-}
-
-uint8_t etherReadMem()
-{
-    writeSpi0Data(0);
-    return readSpi0Data();
-}
-
-void etherReadMemStop()
-{
-    etherCsOff();
-}
-
-// Initializes ethernet device
-// Uses order suggested in Chapter 6 of datasheet except 6.4 OST which is first here
-void etherInit(uint16_t mode)
-{
-    // Initialize SPI0
-    initSpi0(USE_SSI0_RX);
-    setSpi0BaudRate(4e6, 40e6);
-    setSpi0Mode(0, 0);
-
-    // Enable clocks
-    enablePort(PORTA);
-    enablePort(PORTB);
-    enablePort(PORTC);
-
-    // Configure pins for ethernet module
-    selectPinPushPullOutput(CS);
-    selectPinDigitalInput(WOL);
-    selectPinDigitalInput(INT);
-
-    // make sure that oscillator start-up timer has expired
-    while ((etherReadReg(ESTAT) & CLKRDY) == 0) {}
-
-    // disable transmission and reception of packets
-    etherClearReg(ECON1, RXEN);
-    etherClearReg(ECON1, TXRTS);
-
-    // initialize receive buffer space
-    etherSetBank(ERXSTL);
-    etherWriteReg(ERXSTL, LOBYTE(0x0000));
-    etherWriteReg(ERXSTH, HIBYTE(0x0000));
-    etherWriteReg(ERXNDL, LOBYTE(0x1A09));
-    etherWriteReg(ERXNDH, HIBYTE(0x1A09));
-   
-    // initialize receiver write and read ptrs
-    // at startup, will write from 0 to 1A08 only and will not overwrite rd ptr
-    etherWriteReg(ERXWRPTL, LOBYTE(0x0000));
-    etherWriteReg(ERXWRPTH, HIBYTE(0x0000));
-    etherWriteReg(ERXRDPTL, LOBYTE(0x1A09));
-    etherWriteReg(ERXRDPTH, HIBYTE(0x1A09));
-    etherWriteReg(ERDPTL, LOBYTE(0x0000));
-    etherWriteReg(ERDPTH, HIBYTE(0x0000));
-
-    // setup receive filter
-    // always check CRC, use OR mode
-    etherSetBank(ERXFCON);
-    etherWriteReg(ERXFCON, (mode | ETHER_CHECKCRC) & 0xFF);
-
-    // bring mac out of reset
-    etherSetBank(MACON2);
-    etherWriteReg(MACON2, 0);
-  
-    // enable mac rx, enable pause control for full duplex
-    etherWriteReg(MACON1, TXPAUS | RXPAUS | MARXEN);
-
-    // enable padding to 60 bytes (no runt packets)
-    // add crc to tx packets, set full or half duplex
-    if ((mode & ETHER_FULLDUPLEX) != 0)
-        etherWriteReg(MACON3, FULDPX | FRMLNEN | TXCRCEN | PAD60);
-    else
-        etherWriteReg(MACON3, FRMLNEN | TXCRCEN | PAD60);
-
-    // leave MACON4 as reset
-
-    // set maximum rx packet size
-    etherWriteReg(MAMXFLL, LOBYTE(1518));
-    etherWriteReg(MAMXFLH, HIBYTE(1518));
-
-    // set back-to-back inter-packet gap to 9.6us
-    if ((mode & ETHER_FULLDUPLEX) != 0)
-        etherWriteReg(MABBIPG, 0x15);
-    else
-        etherWriteReg(MABBIPG, 0x12);
-
-    // set non-back-to-back inter-packet gap registers
-    etherWriteReg(MAIPGL, 0x12);
-    etherWriteReg(MAIPGH, 0x0C);
-
-    // leave collision window MACLCON2 as reset
-
-    // setup mac address
-    etherSetBank(MAADR0);
-    etherWriteReg(MAADR5, macAddress[0]);
-    etherWriteReg(MAADR4, macAddress[1]);
-    etherWriteReg(MAADR3, macAddress[2]);
-    etherWriteReg(MAADR2, macAddress[3]);
-    etherWriteReg(MAADR1, macAddress[4]);
-    etherWriteReg(MAADR0, macAddress[5]);
-
-    // initialize phy duplex
-    if ((mode & ETHER_FULLDUPLEX) != 0)
-        etherWritePhy(PHCON1, PDPXMD);
-    else
-        etherWritePhy(PHCON1, 0);
-
-    // disable phy loopback if in half-duplex mode
-    etherWritePhy(PHCON2, HDLDIS);
-
-    // Flash LEDA and LEDB
-    etherWritePhy(PHLCON, 0x0880);
-    waitMicrosecond(100000);
-
-    // set LEDA (link status) and LEDB (tx/rx activity)
-    // stretch LED on to 40ms (default)
-    etherWritePhy(PHLCON, 0x0472);
-    // enable reception
-    etherSetReg(ECON1, RXEN);
-}
-
-// Returns true if link is up
-bool etherIsLinkUp()
-{
-    return (etherReadPhy(PHSTAT1) & LSTAT) != 0;
-}
-
-// Returns TRUE if packet received
-bool etherIsDataAvailable()
-{
-    return ((etherReadReg(EIR) & PKTIF) != 0);
-}
-
-// Returns true if rx buffer overflowed after correcting the problem
-bool etherIsOverflow()
-{
-    bool err;
-    err = (etherReadReg(EIR) & RXERIF) != 0;
-    if (err)
-        etherClearReg(EIR, RXERIF);
-    return err;
-}
-
-// Returns up to max_size characters in data buffer
-// Returns number of bytes copied to buffer
-// Contents written are 16-bit size, 16-bit status, payload excl crc
-uint16_t etherGetPacket(uint8_t packet[], uint16_t maxSize)
-{
-    uint16_t i = 0, size, tmp16, status;
-
-    // enable read from FIFO buffers
-    etherReadMemStart();
-
-    // get next packet information
-    nextPacketLsb = etherReadMem();
-    nextPacketMsb = etherReadMem();
-
-    // calc size
-    // don't return crc, instead return size + status, so size is correct
-    size = etherReadMem();
-    tmp16 = etherReadMem();
-    size |= (tmp16 << 8);
-
-    // get status (currently unused)
-    status = etherReadMem();
-    tmp16 = etherReadMem();
-    status |= (tmp16 << 8);
-
-    // copy data
-    if (size > maxSize)
-        size = maxSize;
-    while (i < size)
-        packet[i++] = etherReadMem();
-
-    // end read from FIFO buffers
-    etherReadMemStop();
-
-    // advance read pointer
-    etherSetBank(ERXRDPTL);
-    etherWriteReg(ERXRDPTL, nextPacketLsb); // hw ptr
-    etherWriteReg(ERXRDPTH, nextPacketMsb);
-    etherWriteReg(ERDPTL, nextPacketLsb);   // dma rd ptr
-    etherWriteReg(ERDPTH, nextPacketMsb);
-
-    // decrement packet counter so that PKTIF is maintained correctly
-    etherSetReg(ECON2, PKTDEC);
-
-    return size;
-}
-
-// Writes a packet
-bool etherPutPacket(uint8_t packet[], uint16_t size)
-{
-    uint16_t i;
-
-    // clear out any tx errors
-    if ((etherReadReg(EIR) & TXERIF) != 0)
-    {
-        etherClearReg(EIR, TXERIF);
-        etherSetReg(ECON1, TXRTS);
-        etherClearReg(ECON1, TXRTS);
-    }
-
-    // set DMA start address
-    etherSetBank(EWRPTL);
-    etherWriteReg(EWRPTL, LOBYTE(0x1A0A));
-    etherWriteReg(EWRPTH, HIBYTE(0x1A0A));
-
-    // start FIFO buffer write
-    etherWriteMemStart();
-
-    // write control byte
-    etherWriteMem(0);
-
-    // write data
-    for (i = 0; i < size; i++)
-        etherWriteMem(packet[i]);
-
-    // stop write
-    etherWriteMemStop();
-  
-    // request transmit
-    etherWriteReg(ETXSTL, LOBYTE(0x1A0A));
-    etherWriteReg(ETXSTH, HIBYTE(0x1A0A));
-    etherWriteReg(ETXNDL, LOBYTE(0x1A0A+size));
-    etherWriteReg(ETXNDH, HIBYTE(0x1A0A+size));
-    etherClearReg(EIR, TXIF);
-    etherSetReg(ECON1, TXRTS);
-
-    // wait for completion
-    while ((etherReadReg(ECON1) & TXRTS) != 0);
-
-    // determine success
-    return ((etherReadReg(ESTAT) & TXABORT) == 0);
-}
-
-// Calculate sum of words
-// Must use getEtherChecksum to complete 1's compliment addition
-void etherSumWords(void* data, uint16_t sizeInBytes)
-{
-	uint8_t* pData = (uint8_t*)data;
-    uint16_t i;
-    uint8_t phase = 0;
-    uint16_t data_temp;
-    for (i = 0; i < sizeInBytes; i++)
-    {
-        if (phase)
-        {
-            data_temp = *pData;
-            sum += data_temp << 8;
-        }
-        else
-          sum += *pData;
-        phase = 1 - phase;
-        pData++;
-    }
-}
-
-// Completes 1's compliment addition by folding carries back into field
-uint16_t getEtherChecksum()
-{
-    uint16_t result;
-    // this is based on rfc1071
-    while ((sum >> 16) > 0)
-      sum = (sum & 0xFFFF) + (sum >> 16);
-    result = sum & 0xFFFF;
-    return ~result;
-}
-
-void etherCalcIpChecksum(ipFrame* ip)
-{
-    // 32-bit sum over ip header
-    sum = 0;
-    etherSumWords(&ip->revSize, 10);
-    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
-    ip->headerChecksum = getEtherChecksum();
-}
-
-// Converts from host to network order and vice versa
-uint16_t htons(uint16_t value)
-{
-    return ((value & 0xFF00) >> 8) + ((value & 0x00FF) << 8);
-}
-#define ntohs htons
-
-uint32_t htonl(uint32_t value)
-{
-    char *s = (char *)&value;
-    return (uint32_t)(s[0] << 24 | s[1] << 16 | s[2] << 8 | s[3]);
-}
-
-// Determines whether packet is IP datagram
-bool etherIsIp(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    bool ok;
-    ok = (ether->frameType == htons(0x0800));
-    if (ok)
-    {
-        sum = 0;
-        etherSumWords(&ip->revSize, (ip->revSize & 0xF) * 4);
-        ok = (getEtherChecksum() == 0);
-    }
-    return ok;
-}
-
-// Determines whether packet is unicast to this ip
-// Must be an IP packet
-bool etherIsIpUnicast(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    uint8_t i = 0;
-    bool ok = true;
-    while (ok & (i < IP_ADD_LENGTH))
-    {
-        ok = (ip->destIp[i] == ipAddress[i]);
-        i++;
-    }
-    return ok;
-}
-
-// Determines whether packet is ping request
-// Must be an IP packet
-bool etherIsPingRequest(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    icmpFrame* icmp = (icmpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
-    return (ip->protocol == 0x01 & icmp->type == 8);
-}
-
-// Sends a ping response given the request data
-void etherSendPingResponse(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    icmpFrame* icmp = (icmpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
-    uint8_t i, tmp;
-    uint16_t icmp_size;
-    // swap source and destination fields
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        tmp = ether->destAddress[i];
-        ether->destAddress[i] = ether->sourceAddress[i];
-        ether->sourceAddress[i] = tmp;
-    }
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        tmp = ip->destIp[i];
-        ip->destIp[i] = ip ->sourceIp[i];
-        ip->sourceIp[i] = tmp;
-    }
-    // this is a response
-    icmp->type = 0;
-    // calc icmp checksum
-    sum = 0;
-    etherSumWords(&icmp->type, 2);
-    icmp_size = ntohs(ip->length);
-    icmp_size -= 24; // sub ip header and icmp code, type, and check
-    etherSumWords(&icmp->id, icmp_size);
-    icmp->check = getEtherChecksum();
-    // send packet
-    etherPutPacket(ether, 14 + ntohs(ip->length));
-}
-
-// Determines whether packet is ARP
-bool etherIsArpRequest(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    arpFrame* arp = (arpFrame*) &ether->data;
-    bool ok;
-    uint8_t i = 0;
-    ok = (ether->frameType == htons(0x0806));
-    while (ok & (i < IP_ADD_LENGTH))
-    {
-        ok = (arp->destIp[i] == ipAddress[i]);
-        i++;
-    }
-    if (ok)
-        ok = (arp->op == htons(1));
-    return ok;
-}
-
-// Sends an ARP response given the request data
-void etherSendArpResponse(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    arpFrame* arp = (arpFrame*) &ether->data;
-    uint8_t i, tmp;
-    // set op to response
-    arp->op = htons(2);
-    // swap source and destination fields
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        arp->destAddress[i] = arp->sourceAddress[i];
-        ether->destAddress[i] = ether->sourceAddress[i];
-        ether->sourceAddress[i] = arp->sourceAddress[i] = macAddress[i];
-    }
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        tmp = arp->destIp[i];
-        arp->destIp[i] = arp->sourceIp[i];
-        arp->sourceIp[i] = tmp;
-    }
-    // send packet
-    etherPutPacket(ether, 42);
-}
-
-// Sends an ARP request
-void etherSendArpRequest(uint8_t packet[], uint8_t ip[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    arpFrame* arp = (arpFrame*) &ether->data;
-    uint8_t i;
-    // fill ethernet frame
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        ether->destAddress[i] = 0xFF;
-        ether->sourceAddress[i] = macAddress[i];
-    }
-    ether->frameType = 0x0608;
-    // fill arp frame
-    arp->hardwareType = htons(1);
-    arp->protocolType = htons(0x0800);
-    arp->hardwareSize = HW_ADD_LENGTH;
-    arp->protocolSize = IP_ADD_LENGTH;
-    arp->op = htons(1);
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        arp->sourceAddress[i] = macAddress[i];
-        arp->destAddress[i] = 0xFF;
-    }
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        arp->sourceIp[i] = ipAddress[i];
-        arp->destIp[i] = ip[i];
-    }
-    // send packet
-    etherPutPacket(ether, 42);
-}
-
-
-// Determines whether packet is UDP datagram
-// Must be an IP packet
-bool etherIsUdp(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
-    bool ok;
-    uint16_t tmp16;
-    ok = (ip->protocol == 0x11);
-    if (ok)
-    {
-        // 32-bit sum over pseudo-header
-        sum = 0;
-        etherSumWords(ip->sourceIp, 8);
-        tmp16 = ip->protocol;
-        sum += (tmp16 & 0xff) << 8;
-        etherSumWords(&udp->length, 2);
-        // add udp header and data
-        etherSumWords(udp, ntohs(udp->length));
-        ok = (getEtherChecksum() == 0);
-    }
-    return ok;
-}
-
-// Gets pointer to UDP payload of frame
-uint8_t* etherGetUdpData(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
-    return &udp->data;
-}
-
-// Send responses to a udp datagram 
-// destination port, ip, and hardware address are extracted from provided data
-// uses destination port of received packet as destination of this packet
-void etherSendUdpResponse(uint8_t packet[], uint8_t* udpData, uint8_t udpSize)
-{
-    etherFrame* ether = (etherFrame*)packet;
-    ipFrame* ip = (ipFrame*)&ether->data;
-    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
-    uint8_t *copyData;
-    uint8_t i, tmp8;
-    uint16_t tmp16;
-    // swap source and destination fields
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        tmp8 = ether->destAddress[i];
-        ether->destAddress[i] = ether->sourceAddress[i];
-        ether->sourceAddress[i] = tmp8;
-    }
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        tmp8 = ip->destIp[i];
-        ip->destIp[i] = ip->sourceIp[i];
-        ip->sourceIp[i] = tmp8;
-    }
-    // set source port of resp will be dest port of req
-    // dest port of resp will be left at source port of req
-    // unusual nomenclature, but this allows a different tx
-    // and rx port on other machine
-    udp->sourcePort = udp->destPort;
-    // adjust lengths
-    ip->length = htons(((ip->revSize & 0xF) * 4) + 8 + udpSize);
-    // 32-bit sum over ip header
-    sum = 0;
-    etherSumWords(&ip->revSize, 10);
-    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
-    ip->headerChecksum = getEtherChecksum();
-    udp->length = htons(8 + udpSize);
-    // copy data
-    copyData = &udp->data;
-    for (i = 0; i < udpSize; i++)
-        copyData[i] = udpData[i];
-    // 32-bit sum over pseudo-header
-    sum = 0;
-    etherSumWords(ip->sourceIp, 8);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    etherSumWords(&udp->length, 2);
-    // add udp header except crc
-    etherSumWords(udp, 6);
-    etherSumWords(&udp->data, udpSize);
-    udp->check = getEtherChecksum();
-
-    // send packet with size = ether + udp hdr + ip header + udp_size
-    etherPutPacket(ether, 22 + ((ip->revSize & 0xF) * 4) + udpSize);
-}
-
-uint16_t etherGetId()
-{
-    return htons(sequenceId);
-}
-
-void etherIncId()
-{
-    sequenceId++;
-}
-
-// Enable or disable DHCP mode
-void etherEnableDhcpMode()
-{
-    dhcpEnabled = true;
-}
-
-void etherDisableDhcpMode()
-{
-    dhcpEnabled = false;
-}
-
-bool etherIsDhcpEnabled()
-{
-    return dhcpEnabled;
-}
-// Determines if the IP address is valid
-bool etherIsIpValid()
-{
-    return ipAddress[0] || ipAddress[1] || ipAddress[2] || ipAddress[3];
-}
-
-// Sets IP address
-void etherSetIpAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
-{
-    ipAddress[0] = ip0;
-    ipAddress[1] = ip1;
-    ipAddress[2] = ip2;
-    ipAddress[3] = ip3;
-}
-
-// Gets IP address
-void etherGetIpAddress(uint8_t ip[4])
-{
-    uint8_t i;
-    for (i = 0; i < 4; i++)
-        ip[i] = ipAddress[i];
-}
-
-// Sets IP subnet mask
-void etherSetIpSubnetMask(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3)
-{
-    ipSubnetMask[0] = mask0;
-    ipSubnetMask[1] = mask1;
-    ipSubnetMask[2] = mask2;
-    ipSubnetMask[3] = mask3;
-}
-
-// Gets IP subnet mask
-void etherGetIpSubnetMask(uint8_t mask[4])
-{
-    uint8_t i;
-    for (i = 0; i < 4; i++)
-        mask[i] = ipSubnetMask[i];
-}
-
-// Sets DNS
-void etherSetDns(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3)
-{
-    ipDNS[0] = mask0;
-    ipDNS[1] = mask1;
-    ipDNS[2] = mask2;
-    ipDNS[3] = mask3;
-}
-
-// Gets DNS
-void etherGetDns(uint8_t dns[4])
-{
-    uint8_t i;
-    for (i = 0; i < 4; i++)
-        dns[i] = ipDNS[i];
-}
-
-// Sets IP gateway address
-void etherSetIpGatewayAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
-{
-    ipGwAddress[0] = ip0;
-    ipGwAddress[1] = ip1;
-    ipGwAddress[2] = ip2;
-    ipGwAddress[3] = ip3;
-}
-
-// Gets IP gateway address
-void etherGetIpGatewayAddress(uint8_t ip[4])
-{
-    uint8_t i;
-    for (i = 0; i < 4; i++)
-        ip[i] = ipGwAddress[i];
-}
-
-// Sets MAC address
-void etherSetMacAddress(uint8_t mac0, uint8_t mac1, uint8_t mac2, uint8_t mac3, uint8_t mac4, uint8_t mac5)
-{
-    macAddress[0] = mac0;
-    macAddress[1] = mac1;
-    macAddress[2] = mac2;
-    macAddress[3] = mac3;
-    macAddress[4] = mac4;
-    macAddress[5] = mac5;
-}
-
-// Gets MAC address
-void etherGetMacAddress(uint8_t mac[6])
-{
-    uint8_t i;
-    for (i = 0; i < 6; i++)
-        mac[i] = macAddress[i];
-}
+// ETH0 Library
+// Jason Losh
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL w/ ENC28J60
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// ENC28J60 Ethernet controller on SPI0
+//   MOSI (SSI0Tx) on PA5
+//   MISO (SSI0Rx) on PA4
+//   SCLK (SSI0Clk) on PA2
+//   ~CS (SW controlled) on PA3
+//   WOL on PB3
+//   INT on PC6
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <eth0.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "wait.h"
+#include "gpio.h"
+#include "spi0.h"
+#include <string.h>
+#include "common.h"
+#include "dhcp.h"
+
+// Pins
+#define CS PORTA,3
+#define WOL PORTB,3
+#define INT PORTC,6
+
+// Ether registers
+#define ERDPTL      0x00
+#define ERDPTH      0x01
+#define EWRPTL      0x02
+#define EWRPTH      0x03
+#define ETXSTL      0x04
+#define ETXSTH      0x05
+#define ETXNDL      0x06
+#define ETXNDH      0x07
+#define ERXSTL      0x08
+#define ERXSTH      0x09
+#define ERXNDL      0x0A
+#define ERXNDH      0x0B
+#define ERXRDPTL    0x0C
+#define ERXRDPTH    0x0D
+#define ERXWRPTL    0x0E
+#define ERXWRPTH    0x0F
+#define EIE         0x1B
+#define EIR         0x1C
+#define RXERIF  0x01
+#define TXERIF  0x02
+#define TXIF    0x08
+#define PKTIF   0x40
+#define ESTAT       0x1D
+#define CLKRDY  0x01
+#define TXABORT 0x02
+#define ECON2       0x1E
+#define PKTDEC  0x40
+#define ECON1       0x1F
+#define RXEN    0x04
+#define TXRTS   0x08
+#define ERXFCON     0x38
+#define EPKTCNT     0x39
+#define MACON1      0x40
+#define MARXEN  0x01
+#define RXPAUS  0x04
+#define TXPAUS  0x08
+#define MACON2      0x41
+#define MARST   0x80
+#define MACON3      0x42
+#define FULDPX  0x01
+#define FRMLNEN 0x02
+#define TXCRCEN 0x10
+#define PAD60   0x20
+#define MACON4      0x43
+#define MABBIPG     0x44
+#define MAIPGL      0x46
+#define MAIPGH      0x47
+#define MACLCON1    0x48
+#define MACLCON2    0x49
+#define MAMXFLL     0x4A
+#define MAMXFLH     0x4B
+#define MICMD       0x52
+#define MIIRD   0x01
+#define MIREGADR    0x54
+#define MIWRL       0x56
+#define MIWRH       0x57
+#define MIRDL       0x58
+#define MIRDH       0x59
+#define MAADR1      0x60
+#define MAADR0      0x61
+#define MAADR3      0x62
+#define MAADR2      0x63
+#define MAADR5      0x64
+#define MAADR4      0x65
+#define MISTAT      0x6A
+#define MIBUSY  0x01
+#define ECOCON      0x75
+
+// Ether phy registers
+#define PHCON1      0x00
+#define PDPXMD 0x0100
+#define PHSTAT1     0x01
+#define LSTAT  0x0400
+#define PHCON2      0x10
+#define HDLDIS 0x0100
+#define PHLCON      0x14
+
+// Buffer layout
+#define RX_START    0x0000
+#define RX_END      0x11FF  // odd, the read pointer starts here
+#define TX_START    0x1200  // frames sent once
+#define STORE_START 0x1800  // frames kept for retransmission
+#define STORE_END   0x2000
+#define TX_STATUS_SIZE 7    // status vector the controller writes after a frame
+#define STORE_FRAMES 16
+
+
+
+// ------------------------------------------------------------------------------
+//  Globals
+// ------------------------------------------------------------------------------
+
+uint8_t nextPacketLsb = 0x00;
+uint8_t nextPacketMsb = 0x00;
+uint8_t sequenceId = 1;
+uint32_t sum;
+uint8_t macAddress[HW_ADD_LENGTH] = {2,3,4,5,6,131};
+uint8_t ipAddress[IP_ADD_LENGTH] = {0,0,0,0};
+uint8_t ipSubnetMask[IP_ADD_LENGTH] = {255,255,255,0};
+uint8_t ipGwAddress[IP_ADD_LENGTH] = {0,0,0,0};
+uint8_t ipDNS[IP_ADD_LENGTH] = {0, 0, 0, 0};
+bool    dhcpEnabled = true;
+
+// ------------------------------------------------------------------------------
+//  Structures
+// ------------------------------------------------------------------------------
+
+// This M4F is little endian (TI hardwired it this way)
+// Network byte order is big endian
+// Must interpret uint16_t in reverse order
+
+typedef struct _enc28j60Frame // 4-bytes
+{
+  uint16_t size;
+  uint16_t status;
+  uint8_t data;
+} enc28j60Frame;
+
+// A frame kept in the store, freed in any order but reclaimed oldest first
+typedef struct _storedFrame
+{
+  uint16_t address;   // control byte, the frame follows
+  uint16_t size;
+  bool inUse;
+} storedFrame;
+
+storedFrame storedFrames[STORE_FRAMES];
+uint8_t storeHead = 0;   // oldest frame
+uint8_t storeCount = 0;
+uint16_t storeNext = STORE_START;
+
+
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+// Buffer is configured as follows
+// Receive buffer starts at 0x0000 (bottom 4608 bytes of 8K space)
+// Transmit buffer at 0x1200 (1536 bytes)
+// Store at 0x1800 (top 2048 bytes of 8K space), frames that may be sent again
+
+void etherCsOn()
+{
+    setPinValue(CS, 0);
+    __asm (" NOP");                    // allow line to settle
+    __asm (" NOP");
+    __asm (" NOP");
+    __asm (" NOP");
+}
+
+void etherCsOff()
+{
+    setPinValue(CS, 1);
+}
+
+void etherWriteReg(uint8_t reg, uint8_t data)
+{
+    etherCsOn();
+    writeSpi0Data(0x40 | (reg & 0x1F));
+    readSpi0Data();
+    writeSpi0Data(data);
+    readSpi0Data();
+    etherCsOff();
+}
+
+uint8_t etherReadReg(uint8_t reg)
+{
+    uint8_t data;
+    etherCsOn();
+    writeSpi0Data(0x00 | (reg & 0x1F));
+    readSpi0Data();
+    writeSpi0Data(0);
+    data = readSpi0Data();
+    etherCsOff();
+    return data;
+}
+
+void etherSetReg(uint8_t reg, uint8_t mask)
+{
+    etherCsOn();
+    writeSpi0Data(0x80 | (reg & 0x1F));
+    readSpi0Data();
+    writeSpi0Data(mask);
+    readSpi0Data();
+    etherCsOff();
+}
+
+void etherClearReg(uint8_t reg, uint8_t mask)
+{
+    etherCsOn();
+    writeSpi0Data(0xA0 | (reg & 0x1F));
+    readSpi0Data();
+    writeSpi0Data(mask);
+    readSpi0Data();
+    etherCsOff();
+}
+
+void etherSetBank(uint8_t reg)
+{
+    etherClearReg(ECON1, 0x03);
+    etherSetReg(ECON1, reg >> 5);
+}
+
+void etherWritePhy(uint8_t reg, uint16_t data)
+{
+    etherSetBank(MIREGADR);
+    etherWriteReg(MIREGADR, reg);
+    etherWriteReg(MIWRL, data & 0xFF);
+    etherWriteReg(MIWRH, (data >> 8) & 0xFF);
+}
+
+uint16_t etherReadPhy(uint8_t reg)
+{
+    uint16_t data, dataH;
+    etherSetBank(MIREGADR);
+    etherWriteReg(MIREGADR, reg);
+    etherWriteReg(MICMD, MIIRD);
+    waitMicrosecond(11);
+    etherSetBank(MISTAT);
+    while ((etherReadReg(MISTAT) & MIBUSY) != 0);
+    etherSetBank(MICMD);
+    etherWriteReg(MICMD, 0);
+    data = etherReadReg(MIRDL);
+    dataH = etherReadReg(MIRDH);
+    data |= (dataH << 8);
+    return data;
+}
+
+void etherWriteMemStart()
+{
+    etherCsOn();
+    writeSpi0Data(0x7A);
+    readSpi0Data();
+}
+
+void etherWriteMem(uint8_t data)
+{
+    writeSpi0Data(data);
+    readSpi0Data();
+}
+
+void etherWriteMemStop()
+{
+    etherCsOff();
+}
+
+void etherReadMemStart()
+{
+    etherCsOn();
+    writeSpi0Data(0x3A);
+    readSpi0Data();
+}
+
+uint8_t etherReadMem()
+{
+    writeSpi0Data(0);
+    return readSpi0Data();
+}
+
+void etherReadMemStop()
+{
+    etherCsOff();
+}
+
+// Initializes ethernet device
+// Uses order suggested in Chapter 6 of datasheet except 6.4 OST which is first here
+void etherInit(uint16_t mode)
+{
+    // Initialize SPI0
+    initSpi0(USE_SSI0_RX);
+    setSpi0BaudRate(4e6, 40e6);
+    setSpi0Mode(0, 0);
+
+    // Enable clocks
+    enablePort(PORTA);
+    enablePort(PORTB);
+    enablePort(PORTC);
+
+    // Configure pins for ethernet module
+    selectPinPushPullOutput(CS);
+    selectPinDigitalInput(WOL);
+    selectPinDigitalInput(INT);
+
+    // make sure that oscillator start-up timer has expired
+    while ((etherReadReg(ESTAT) & CLKRDY) == 0) {}
+
+    // disable transmission and reception of packets
+    etherClearReg(ECON1, RXEN);
+    etherClearReg(ECON1, TXRTS);
+
+    // initialize receive buffer space
+    etherSetBank(ERXSTL);
+    etherWriteReg(ERXSTL, LOBYTE(RX_START));
+    etherWriteReg(ERXSTH, HIBYTE(RX_START));
+    etherWriteReg(ERXNDL, LOBYTE(RX_END));
+    etherWriteReg(ERXNDH, HIBYTE(RX_END));
+   
+    // initialize receiver write and read ptrs
+    // at startup, will write from 0 to 11FE only and will not overwrite rd ptr
+    etherWriteReg(ERXWRPTL, LOBYTE(RX_START));
+    etherWriteReg(ERXWRPTH, HIBYTE(RX_START));
+    etherWriteReg(ERXRDPTL, LOBYTE(RX_END));
+    etherWriteReg(ERXRDPTH, HIBYTE(RX_END));
+    etherWriteReg(ERDPTL, LOBYTE(RX_START));
+    etherWriteReg(ERDPTH, HIBYTE(RX_START));
+
+    // setup receive filter
+    // always check CRC, use OR mode
+    etherSetBank(ERXFCON);
+    etherWriteReg(ERXFCON, (mode | ETHER_CHECKCRC) & 0xFF);
+
+    // bring mac out of reset
+    etherSetBank(MACON2);
+    etherWriteReg(MACON2, 0);
+  
+    // enable mac rx, enable pause control for full duplex
+    etherWriteReg(MACON1, TXPAUS | RXPAUS | MARXEN);
+
+    // enable padding to 60 bytes (no runt packets)
+    // add crc to tx packets, set full or half duplex
+    if ((mode & ETHER_FULLDUPLEX) != 0)
+        etherWriteReg(MACON3, FULDPX | FRMLNEN | TXCRCEN | PAD60);
+    else
+        etherWriteReg(MACON3, FRMLNEN | TXCRCEN | PAD60);
+
+    // leave MACON4 as reset
+
+    // set maximum rx packet size
+    etherWriteReg(MAMXFLL, LOBYTE(1518));
+    etherWriteReg(MAMXFLH, HIBYTE(1518));
+
+    // set back-to-back inter-packet gap to 9.6us
+    if ((mode & ETHER_FULLDUPLEX) != 0)
+        etherWriteReg(MABBIPG, 0x15);
+    else
+        etherWriteReg(MABBIPG, 0x12);
+
+    // set non-back-to-back inter-packet gap registers
+    etherWriteReg(MAIPGL, 0x12);
+    etherWriteReg(MAIPGH, 0x0C);
+
+    // leave collision window MACLCON2 as reset
+
+    // setup mac address
+    etherSetBank(MAADR0);
+    etherWriteReg(MAADR5, macAddress[0]);
+    etherWriteReg(MAADR4, macAddress[1]);
+    etherWriteReg(MAADR3, macAddress[2]);
+    etherWriteReg(MAADR2, macAddress[3]);
+    etherWriteReg(MAADR1, macAddress[4]);
+    etherWriteReg(MAADR0, macAddress[5]);
+
+    // initialize phy duplex
+    if ((mode & ETHER_FULLDUPLEX) != 0)
+        etherWritePhy(PHCON1, PDPXMD);
+    else
+        etherWritePhy(PHCON1, 0);
+
+    // disable phy loopback if in half-duplex mode
+    etherWritePhy(PHCON2, HDLDIS);
+
+    // Flash LEDA and LEDB
+    etherWritePhy(PHLCON, 0x0880);
+    waitMicrosecond(100000);
+
+    // set LEDA (link status) and LEDB (tx/rx activity)
+    // stretch LED on to 40ms (default)
+    etherWritePhy(PHLCON, 0x0472);
+    // enable reception
+    etherSetReg(ECON1, RXEN);
+}
+
+// Returns true if link is up
+bool etherIsLinkUp()
+{
+    return (etherReadPhy(PHSTAT1) & LSTAT) != 0;
+}
+
+// Returns TRUE if packet received
+bool etherIsDataAvailable()
+{
+    return ((etherReadReg(EIR) & PKTIF) != 0);
+}
+
+// Returns true if rx buffer overflowed after correcting the problem
+bool etherIsOverflow()
+{
+    bool err;
+    err = (etherReadReg(EIR) & RXERIF) != 0;
+    if (err)
+        etherClearReg(EIR, RXERIF);
+    return err;
+}
+
+// Returns up to max_size characters in data buffer
+// Returns number of bytes copied to buffer
+// Contents written are 16-bit size, 16-bit status, payload excl crc
+uint16_t etherGetPacket(uint8_t packet[], uint16_t maxSize)
+{
+    uint16_t i = 0, size, tmp16, status;
+
+    // enable read from FIFO buffers
+    etherReadMemStart();
+
+    // get next packet information
+    nextPacketLsb = etherReadMem();
+    nextPacketMsb = etherReadMem();
+
+    // calc size
+    // don't return crc, instead return size + status, so size is correct
+    size = etherReadMem();
+    tmp16 = etherReadMem();
+    size |= (tmp16 << 8);
+
+    // get status (currently unused)
+    status = etherReadMem();
+    tmp16 = etherReadMem();
+    status |= (tmp16 << 8);
+
+    // copy data
+    if (size > maxSize)
+        size = maxSize;
+    while (i < size)
+        packet[i++] = etherReadMem();
+
+    // end read from FIFO buffers
+    etherReadMemStop();
+
+    // advance read pointer
+    etherSetBank(ERXRDPTL);
+    etherWriteReg(ERXRDPTL, nextPacketLsb); // hw ptr
+    etherWriteReg(ERXRDPTH, nextPacketMsb);
+    etherWriteReg(ERDPTL, nextPacketLsb);   // dma rd ptr
+    etherWriteReg(ERDPTH, nextPacketMsb);
+
+    // decrement packet counter so that PKTIF is maintained correctly
+    etherSetReg(ECON2, PKTDEC);
+
+    return size;
+}
+
+// Copies a frame to controller memory at address, after the per packet control byte
+void etherWriteFrame(uint16_t address, uint8_t packet[], uint16_t size)
+{
+    uint16_t i;
+
+    // set DMA start address
+    etherSetBank(EWRPTL);
+    etherWriteReg(EWRPTL, LOBYTE(address));
+    etherWriteReg(EWRPTH, HIBYTE(address));
+
+    // start FIFO buffer write
+    etherWriteMemStart();
+
+    // write control byte
+    etherWriteMem(0);
+
+    // write data
+    for (i = 0; i < size; i++)
+        etherWriteMem(packet[i]);
+
+    // stop write
+    etherWriteMemStop();
+}
+
+// Transmits the frame at address, as written by etherWriteFrame
+bool etherTransmit(uint16_t address, uint16_t size)
+{
+    // clear out any tx errors
+    if ((etherReadReg(EIR) & TXERIF) != 0)
+    {
+        etherClearReg(EIR, TXERIF);
+        etherSetReg(ECON1, TXRTS);
+        etherClearReg(ECON1, TXRTS);
+    }
+
+    // request transmit
+    etherSetBank(ETXSTL);
+    etherWriteReg(ETXSTL, LOBYTE(address));
+    etherWriteReg(ETXSTH, HIBYTE(address));
+    etherWriteReg(ETXNDL, LOBYTE(address + size));
+    etherWriteReg(ETXNDH, HIBYTE(address + size));
+    etherClearReg(EIR, TXIF);
+    etherSetReg(ECON1, TXRTS);
+
+    // wait for completion
+    while ((etherReadReg(ECON1) & TXRTS) != 0);
+
+    // determine success
+    return ((etherReadReg(ESTAT) & TXABORT) == 0);
+}
+
+// Writes a packet
+bool etherPutPacket(uint8_t packet[], uint16_t size)
+{
+    etherWriteFrame(TX_START, packet, size);
+    return etherTransmit(TX_START, size);
+}
+
+// Writes a packet into the store and sends it, so it can be sent again later
+// without crossing spi (see etherResendStoredPacket)
+// Returns a handle for the stored copy, or ETHER_NOT_STORED if the store was full
+// and the packet was only sent
+uint8_t etherPutStoredPacket(uint8_t packet[], uint16_t size)
+{
+    uint16_t need = 1 + size + TX_STATUS_SIZE;
+    uint16_t address = storeNext;
+    uint16_t limit = storedFrames[storeHead].address;
+    uint8_t handle;
+
+    // the free space runs from storeNext up to the oldest frame, wrapping once
+    if (storeCount == 0)
+    {
+        address = STORE_START;
+        limit = STORE_END;
+    }
+    else if (storeCount == STORE_FRAMES)
+    {
+        limit = address;
+    }
+    else if (address > limit)
+    {
+        if (address + need > STORE_END)
+            address = STORE_START;
+        else
+            limit = STORE_END;
+    }
+    if (address + need > limit)
+    {
+        etherPutPacket(packet, size);
+        return ETHER_NOT_STORED;
+    }
+
+    handle = (storeHead + storeCount) % STORE_FRAMES;
+    storedFrames[handle].address = address;
+    storedFrames[handle].size = size;
+    storedFrames[handle].inUse = true;
+    storeCount++;
+    storeNext = address + need;
+    etherWriteFrame(address, packet, size);
+    etherTransmit(address, size);
+    return handle;
+}
+
+// Overwrites size bytes at offset into a stored packet, then sends it again
+bool etherResendStoredPacket(uint8_t handle, uint16_t offset, uint8_t data[],
+                             uint16_t size)
+{
+    uint16_t i;
+    uint16_t address = storedFrames[handle].address + 1 + offset;
+
+    etherSetBank(EWRPTL);
+    etherWriteReg(EWRPTL, LOBYTE(address));
+    etherWriteReg(EWRPTH, HIBYTE(address));
+    etherWriteMemStart();
+    for (i = 0; i < size; i++)
+        etherWriteMem(data[i]);
+    etherWriteMemStop();
+    return etherTransmit(storedFrames[handle].address, storedFrames[handle].size);
+}
+
+// Gives a stored packet's space back, once every older one is freed as well
+void etherFreeStoredPacket(uint8_t handle)
+{
+    storedFrames[handle].inUse = false;
+    while (storeCount > 0 && !storedFrames[storeHead].inUse)
+    {
+        storeHead = (storeHead + 1) % STORE_FRAMES;
+        storeCount--;
+    }
+}
+
+// Calculate sum of words
+// Must use getEtherChecksum to complete 1's compliment addition
+// Adds 32 bits per step: 2^16 = 1 (mod 0xFFFF), so folding the wider sum later
+// gives the same result as adding 16-bit words, at a fraction of the cost per byte
+void etherSumWords(void* data, uint16_t sizeInBytes)
+{
+    uint8_t* pData = (uint8_t*)data;
+    uint64_t acc = 0;
+    uint32_t word;
+    while (sizeInBytes >= 4)
+    {
+        memcpy(&word, pData, 4);
+        acc += word;
+        pData += 4;
+        sizeInBytes -= 4;
+    }
+    if (sizeInBytes >= 2)
+    {
+        acc += pData[0] | (pData[1] << 8);
+        pData += 2;
+        sizeInBytes -= 2;
+    }
+    if (sizeInBytes > 0)
+        acc += *pData;
+    // fold to 16 bits so the caller's 32-bit sum cannot overflow
+    while ((acc >> 16) > 0)
+        acc = (acc & 0xFFFF) + (acc >> 16);
+    sum += (uint32_t)acc;
+}
+
+// Completes 1's compliment addition by folding carries back into field
+uint16_t getEtherChecksum()
+{
+    uint16_t result;
+    // this is based on rfc1071
+    while ((sum >> 16) > 0)
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    result = sum & 0xFFFF;
+    return ~result;
+}
+
+void etherCalcIpChecksum(ipFrame* ip)
+{
+    // 32-bit sum over ip header
+    sum = 0;
+    etherSumWords(&ip->revSize, 10);
+    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
+    ip->headerChecksum = getEtherChecksum();
+}
+
+// Converts from host to network order and vice versa
+uint16_t htons(uint16_t value)
+{
+    return ((value & 0xFF00) >> 8) + ((value & 0x00FF) << 8);
+}
+#define ntohs htons
+
+uint32_t htonl(uint32_t value)
+{
+    uint8_t *s = (uint8_t *)&value;
+    return ((uint32_t) s[0] << 24) | ((uint32_t) s[1] << 16) | ((uint32_t) s[2] << 8) | s[3];
+}
+
+// Determines whether packet is IP datagram
+bool etherIsIp(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    bool ok;
+    ok = (ether->frameType == htons(0x0800));
+    if (ok)
+    {
+        sum = 0;
+        etherSumWords(&ip->revSize, (ip->revSize & 0xF) * 4);
+        ok = (getEtherChecksum() == 0);
+    }
+    return ok;
+}
+
+// Determines whether packet is unicast to this ip
+// Must be an IP packet
+bool etherIsIpUnicast(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    uint8_t i = 0;
+    bool ok = true;
+    while (ok & (i < IP_ADD_LENGTH))
+    {
+        ok = (ip->destIp[i] == ipAddress[i]);
+        i++;
+    }
+    return ok;
+}
+
+// Determines whether packet is ping request
+// Must be an IP packet
+bool etherIsPingRequest(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    icmpFrame* icmp = (icmpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
+    return (ip->protocol == 0x01 & icmp->type == 8);
+}
+
+// Sends a ping response given the request data
+void etherSendPingResponse(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    icmpFrame* icmp = (icmpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
+    uint8_t i, tmp;
+    uint16_t icmp_size;
+    // swap source and destination fields
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        tmp = ether->destAddress[i];
+        ether->destAddress[i] = ether->sourceAddress[i];
+        ether->sourceAddress[i] = tmp;
+    }
+    for (i = 0; i < IP_ADD_LENGTH; i++)
+    {
+        tmp = ip->destIp[i];
+        ip->destIp[i] = ip ->sourceIp[i];
+        ip->sourceIp[i] = tmp;
+    }
+    // this is a response
+    icmp->type = 0;
+    // calc icmp checksum
+    sum = 0;
+    etherSumWords(&icmp->type, 2);
+    icmp_size = ntohs(ip->length);
+    icmp_size -= 24; // sub ip header and icmp code, type, and check
+    etherSumWords(&icmp->id, icmp_size);
+    icmp->check = getEtherChecksum();
+    // send packet
+    etherPutPacket(ether, 14 + ntohs(ip->length));
+}
+
+// Determines whether packet is ARP
+bool etherIsArpRequest(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    arpFrame* arp = (arpFrame*) &ether->data;
+    bool ok;
+    uint8_t i = 0;
+    ok = (ether->frameType == htons(0x0806));
+    while (ok & (i < IP_ADD_LENGTH))
+    {
+        ok = (arp->destIp[i] == ipAddress[i]);
+        i++;
+    }
+    if (ok)
+        ok = (arp->op == htons(1));
+    return ok;
+}
+
+// Sends an ARP response given the request data
+void etherSendArpResponse(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    arpFrame* arp = (arpFrame*) &ether->data;
+    uint8_t i, tmp;
+    // set op to response
+    arp->op = htons(2);
+    // swap source and destination fields
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        arp->destAddress[i] = arp->sourceAddress[i];
+        ether->destAddress[i] = ether->sourceAddress[i];
+        ether->sourceAddress[i] = arp->sourceAddress[i] = macAddress[i];
+    }
+    for (i = 0; i < IP_ADD_LENGTH; i++)
+    {
+        tmp = arp->destIp[i];
+        arp->destIp[i] = arp->sourceIp[i];
+        arp->sourceIp[i] = tmp;
+    }
+    // send packet
+    etherPutPacket(ether, 42);
+}
+
+// Sends an ARP request
+void etherSendArpRequest(uint8_t packet[], uint8_t ip[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    arpFrame* arp = (arpFrame*) &ether->data;
+    uint8_t i;
+    // fill ethernet frame
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        ether->destAddress[i] = 0xFF;
+        ether->sourceAddress[i] = macAddress[i];
+    }
+    ether->frameType = 0x0608;
+    // fill arp frame
+    arp->hardwareType = htons(1);
+    arp->protocolType = htons(0x0800);
+    arp->hardwareSize = HW_ADD_LENGTH;
+    arp->protocolSize = IP_ADD_LENGTH;
+    arp->op = htons(1);
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        arp->sourceAddress[i] = macAddress[i];
+        arp->destAddress[i] = 0xFF;
+    }
+    for (i = 0; i < IP_ADD_LENGTH; i++)
+    {
+        arp->sourceIp[i] = ipAddress[i];
+        arp->destIp[i] = ip[i];
+    }
+    // send packet
+    etherPutPacket(ether, 42);
+}
+
+
+// Determines whether packet is UDP datagram
+// Must be an IP packet
+bool etherIsUdp(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
+    bool ok;
+    uint16_t tmp16;
+    ok = (ip->protocol == 0x11);
+    if (ok)
+    {
+        // 32-bit sum over pseudo-header
+        sum = 0;
+        etherSumWords(ip->sourceIp, 8);
+        tmp16 = ip->protocol;
+        sum += (tmp16 & 0xff) << 8;
+        etherSumWords(&udp->length, 2);
+        // add udp header and data
+        etherSumWords(udp, ntohs(udp->length));
+        ok = (getEtherChecksum() == 0);
+    }
+    return ok;
+}
+
+// Gets pointer to UDP payload of frame
+uint8_t* etherGetUdpData(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
+    return &udp->data;
+}
+
+// Send responses to a udp datagram 
+// destination port, ip, and hardware address are extracted from provided data
+// uses destination port of received packet as destination of this packet
+void etherSendUdpResponse(uint8_t packet[], uint8_t* udpData, uint8_t udpSize)
+{
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    udpFrame* udp = (udpFrame*)((uint8_t*)ip + ((ip->revSize & 0xF) * 4));
+    uint8_t *copyData;
+    uint8_t i, tmp8;
+    uint16_t tmp16;
+    // swap source and destination fields
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        tmp8 = ether->destAddress[i];
+        ether->destAddress[i] = ether->sourceAddress[i];
+        ether->sourceAddress[i] = tmp8;
+    }
+    for (i = 0; i < IP_ADD_LENGTH; i++)
+    {
+        tmp8 = ip->destIp[i];
+        ip->destIp[i] = ip->sourceIp[i];
+        ip->sourceIp[i] = tmp8;
+    }
+    // set source port of resp will be dest port of req
+    // dest port of resp will be left at source port of req
+    // unusual nomenclature, but this allows a different tx
+    // and rx port on other machine
+    udp->sourcePort = udp->destPort;
+    // adjust lengths
+    ip->length = htons(((ip->revSize & 0xF) * 4) + 8 + udpSize);
+    // 32-bit sum over ip header
+    sum = 0;
+    etherSumWords(&ip->revSize, 10);
+    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
+    ip->headerChecksum = getEtherChecksum();
+    udp->length = htons(8 + udpSize);
+    // copy data
+    copyData = &udp->data;
+    for (i = 0; i < udpSize; i++)
+        copyData[i] = udpData[i];
+    // 32-bit sum over pseudo-header
+    sum = 0;
+    etherSumWords(ip->sourceIp, 8);
+    tmp16 = ip->protocol;
+    sum += (tmp16 & 0xff) << 8;
+    etherSumWords(&udp->length, 2);
+    // add udp header except crc
+    etherSumWords(udp, 6);
+    etherSumWords(&udp->data, udpSize);
+    udp->check = getEtherChecksum();
+
+    // send packet with size = ether + udp hdr + ip header + udp_size
+    etherPutPacket(ether, 22 + ((ip->revSize & 0xF) * 4) + udpSize);
+}
+
+uint16_t etherGetId()
+{
+    return htons(sequenceId);
+}
+
+void etherIncId()
+{
+    sequenceId++;
+}
+
+// Sends a udp datagram that is not a response
+// destination port, ip, and hardware address are given by the caller
+void etherSendUdp(uint8_t destMac[], uint8_t destIp[], uint16_t sourcePort,
+                  uint16_t destPort, uint8_t* udpData, uint16_t udpSize)
+{
+    uint8_t packet[MAX_PACKET_SIZE];
+    etherFrame* ether = (etherFrame*)packet;
+    ipFrame* ip = (ipFrame*)&ether->data;
+    udpFrame* udp = (udpFrame*)((uint8_t*)ip + 20);
+    uint8_t *copyData;
+    uint8_t i;
+    uint16_t j;
+    uint16_t tmp16;
+    if (udpSize > MAX_PACKET_SIZE - 42)
+        return;
+    for (i = 0; i < HW_ADD_LENGTH; i++)
+    {
+        ether->destAddress[i] = destMac[i];
+        ether->sourceAddress[i] = macAddress[i];
+    }
+    ether->frameType = htons(0x0800);
+    ip->revSize = 0x45;
+    ip->typeOfService = 0;
+    ip->id = etherGetId();
+    etherIncId();
+    ip->flagsAndOffset = 0;
+    ip->ttl = 128;
+    ip->protocol = 0x11;
+    for (i = 0; i < IP_ADD_LENGTH; i++)
+    {
+        ip->destIp[i] = destIp[i];
+        ip->sourceIp[i] = ipAddress[i];
+    }
+    ip->length = htons(20 + 8 + udpSize);
+    // 32-bit sum over ip header
+    sum = 0;
+    etherSumWords(&ip->revSize, 10);
+    etherSumWords(ip->sourceIp, 8);
+    ip->headerChecksum = getEtherChecksum();
+    udp->sourcePort = htons(sourcePort);
+    udp->destPort = htons(destPort);
+    udp->length = htons(8 + udpSize);
+    // copy data
+    copyData = &udp->data;
+    for (j = 0; j < udpSize; j++)
+        copyData[j] = udpData[j];
+    // 32-bit sum over pseudo-header
+    sum = 0;
+    etherSumWords(ip->sourceIp, 8);
+    tmp16 = ip->protocol;
+    sum += (tmp16 & 0xff) << 8;
+    etherSumWords(&udp->length, 2);
+    // add udp header except crc
+    etherSumWords(udp, 6);
+    etherSumWords(&udp->data, udpSize);
+    udp->check = getEtherChecksum();
+
+    // send packet with size = ether + ip header + udp hdr + udp_size
+    etherPutPacket((uint8_t*) ether, 42 + udpSize);
+}
+
+// Enable or disable DHCP mode
+void etherEnableDhcpMode()
+{
+    dhcpEnabled = true;
+}
+
+void etherDisableDhcpMode()
+{
+    dhcpEnabled = false;
+}
+
+bool etherIsDhcpEnabled()
+{
+    return dhcpEnabled;
+}
+// Determines if the IP address is valid
+bool etherIsIpValid()
+{
+    return ipAddress[0] || ipAddress[1] || ipAddress[2] || ipAddress[3];
+}
+
+// Sets IP address
+void etherSetIpAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
+{
+    ipAddress[0] = ip0;
+    ipAddress[1] = ip1;
+    ipAddress[2] = ip2;
+    ipAddress[3] = ip3;
+}
+
+// Gets IP address
+void etherGetIpAddress(uint8_t ip[4])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+        ip[i] = ipAddress[i];
+}
+
+// Sets IP subnet mask
+void etherSetIpSubnetMask(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3)
+{
+    ipSubnetMask[0] = mask0;
+    ipSubnetMask[1] = mask1;
+    ipSubnetMask[2] = mask2;
+    ipSubnetMask[3] = mask3;
+}
+
+// Gets IP subnet mask
+void etherGetIpSubnetMask(uint8_t mask[4])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+        mask[i] = ipSubnetMask[i];
+}
+
+// Sets DNS
+void etherSetDns(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3)
+{
+    ipDNS[0] = mask0;
+    ipDNS[1] = mask1;
+    ipDNS[2] = mask2;
+    ipDNS[3] = mask3;
+}
+
+// Gets DNS
+void etherGetDns(uint8_t dns[4])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+        dns[i] = ipDNS[i];
+}
+
+// Sets IP gateway address
+void etherSetIpGatewayAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
+{
+    ipGwAddress[0] = ip0;
+    ipGwAddress[1] = ip1;
+    ipGwAddress[2] = ip2;
+    ipGwAddress[3] = ip3;
+}
+
+// Gets IP gateway address
+void etherGetIpGatewayAddress(uint8_t ip[4])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+        ip[i] = ipGwAddress[i];
+}
+
+// Sets MAC address
+void etherSetMacAddress(uint8_t mac0, uint8_t mac1, uint8_t mac2, uint8_t mac3, uint8_t mac4, uint8_t mac5)
+{
+    macAddress[0] = mac0;
+    macAddress[1] = mac1;
+    macAddress[2] = mac2;
+    macAddress[3] = mac3;
+    macAddress[4] = mac4;
+    macAddress[5] = mac5;
+}
+
+// Gets MAC address
+void etherGetMacAddress(uint8_t mac[6])
+{
+    uint8_t i;
+    for (i = 0; i < 6; i++)
+        mac[i] = macAddress[i];
+}
@@ -1,70 +1,79 @@
-// ETH0 Library
-// Jason Losh
-
-//-----------------------------------------------------------------------------
-// Hardware Target
-//-----------------------------------------------------------------------------
-
-// Target Platform: EK-TM4C123GXL w/ ENC28J60
-// Target uC:       TM4C123GH6PM
-// System Clock:    40 MHz
-
-// Hardware configuration:
-// ENC28J60 Ethernet controller on SPI0
-//   MOSI (SSI0Tx) on PA5
-//   MISO (SSI0Rx) on PA4
-//   SCLK (SSI0Clk) on PA2
-//   ~CS (SW controlled) on PA3
-//   WOL on PB3
-//   INT on PC6
-
-//-----------------------------------------------------------------------------
-// Device includes, defines, and assembler directives
-//-----------------------------------------------------------------------------
-
-#ifndef ETH0_H_
-#define ETH0_H_
-
-#include <stdint.h>
-#include <stdbool.h>
-
-//-----------------------------------------------------------------------------
-// Subroutines
-//-----------------------------------------------------------------------------
-
-void etherInit(uint16_t mode);
-bool etherIsLinkUp();
-
-bool etherIsDataAvailable();
-bool etherIsOverflow();
-uint16_t etherGetPacket(uint8_t packet[], uint16_t maxSize);
-bool etherPutPacket(uint8_t packet[], uint16_t size);
-
-bool etherIsIp(uint8_t packet[]);
-bool etherIsIpUnicast(uint8_t packet[]);
-
-bool etherIsPingRequest(uint8_t packet[]);
-void etherSendPingResponse(uint8_t packet[]);
-
-bool etherIsArpRequest(uint8_t packet[]);
-void etherSendArpResponse(uint8_t packet[]);
-void etherSendArpRequest(uint8_t packet[], uint8_t ip[]);
-
-bool etherIsUdp(uint8_t packet[]);
-uint8_t* etherGetUdpData(uint8_t packet[]);
-void etherSendUdpResponse(uint8_t packet[], uint8_t* udpData, uint8_t udpSize);
-
-void etherEnableDhcpMode();
-void etherDisableDhcpMode();
-bool etherIsDhcpEnabled();
-bool etherIsIpValid();
-void etherSetIpAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
-void etherGetIpAddress(uint8_t ip[4]);
-void etherSetIpGatewayAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
-void etherGetIpGatewayAddress(uint8_t ip[4]);
-void etherSetIpSubnetMask(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3);
-void etherGetIpSubnetMask(uint8_t mask[4]);
-void etherSetMacAddress(uint8_t mac0, uint8_t mac1, uint8_t mac2, uint8_t mac3, uint8_t mac4, uint8_t mac5);
-void etherGetMacAddress(uint8_t mac[6]);
-
-#endif
+// ETH0 Library
+// Jason Losh
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL w/ ENC28J60
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// ENC28J60 Ethernet controller on SPI0
+//   MOSI (SSI0Tx) on PA5
+//   MISO (SSI0Rx) on PA4
+//   SCLK (SSI0Clk) on PA2
+//   ~CS (SW controlled) on PA3
+//   WOL on PB3
+//   INT on PC6
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#ifndef ETH0_H_
+#define ETH0_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+void etherInit(uint16_t mode);
+bool etherIsLinkUp();
+
+bool etherIsDataAvailable();
+bool etherIsOverflow();
+uint16_t etherGetPacket(uint8_t packet[], uint16_t maxSize);
+bool etherPutPacket(uint8_t packet[], uint16_t size);
+uint8_t etherPutStoredPacket(uint8_t packet[], uint16_t size);
+bool etherResendStoredPacket(uint8_t handle, uint16_t offset, uint8_t data[],
+                             uint16_t size);
+void etherFreeStoredPacket(uint8_t handle);
+
+void etherSumWords(void* data, uint16_t sizeInBytes);
+uint16_t getEtherChecksum();
+
+bool etherIsIp(uint8_t packet[]);
+bool etherIsIpUnicast(uint8_t packet[]);
+
+bool etherIsPingRequest(uint8_t packet[]);
+void etherSendPingResponse(uint8_t packet[]);
+
+bool etherIsArpRequest(uint8_t packet[]);
+void etherSendArpResponse(uint8_t packet[]);
+void etherSendArpRequest(uint8_t packet[], uint8_t ip[]);
+
+bool etherIsUdp(uint8_t packet[]);
+uint8_t* etherGetUdpData(uint8_t packet[]);
+void etherSendUdpResponse(uint8_t packet[], uint8_t* udpData, uint8_t udpSize);
+void etherSendUdp(uint8_t destMac[], uint8_t destIp[], uint16_t sourcePort,
+                  uint16_t destPort, uint8_t* udpData, uint16_t udpSize);
+
+void etherEnableDhcpMode();
+void etherDisableDhcpMode();
+bool etherIsDhcpEnabled();
+bool etherIsIpValid();
+void etherSetIpAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
+void etherGetIpAddress(uint8_t ip[4]);
+void etherSetIpGatewayAddress(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
+void etherGetIpGatewayAddress(uint8_t ip[4]);
+void etherSetIpSubnetMask(uint8_t mask0, uint8_t mask1, uint8_t mask2, uint8_t mask3);
+void etherGetIpSubnetMask(uint8_t mask[4]);
+void etherSetMacAddress(uint8_t mac0, uint8_t mac1, uint8_t mac2, uint8_t mac3, uint8_t mac4, uint8_t mac5);
+void etherGetMacAddress(uint8_t mac[6]);
+
+#endif
@@ -1,272 +1,296 @@
-// Ethernet Example
-// Jason Losh
-
-//-----------------------------------------------------------------------------
-// Hardware Target
-//-----------------------------------------------------------------------------
-
-// Target Platform: EK-TM4C123GXL w/ ENC28J60
-// Target uC:       TM4C123GH6PM
-// System Clock:    40 MHz
-
-// Hardware configuration:
-// ENC28J60 Ethernet controller on SPI0
-//   MOSI (SSI0Tx) on PA5
-//   MISO (SSI0Rx) on PA4
-//   SCLK (SSI0Clk) on PA2ss
-//   ~CS (SW controlled) on PA3
-//   WOL on PB3
-//   INT on PC6
-
-// Pinning for IoT projects with wireless modules:
-// N24L01+ RF transceiver
-//   MOSI (SSI0Tx) on PA5
-//   MISO (SSI0Rx) on PA4
-//   SCLK (SSI0Clk) on PA2
-//   ~CS on PE0
-//   INT on PB2
-// Xbee module
-//   DIN (UART1TX) on PC5
-//   DOUT (UART1RX) on PC4
-
-//-----------------------------------------------------------------------------
-// Device includes, defines, and assembler directives
-//-----------------------------------------------------------------------------
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <string.h>
-#include "tm4c123gh6pm.h"
-#include "eth0.h"
-#include "gpio.h"
-#include "spi0.h"
-#include "uart0.h"
-#include "wait.h"
-#include "dhcp.h"
-#include "timer.h"
-#include "tcp.h"
-#include "common.h"
-#include "eeprom.h"
-#include "mqtt.h"
-
-// Pins
-#define RED_LED PORTF,1
-#define BLUE_LED PORTF,2
-#define GREEN_LED PORTF,3
-#define PUSH_BUTTON PORTF,4
-
-//-----------------------------------------------------------------------------
-// Subroutines                
-//-----------------------------------------------------------------------------
-
-// Initialize Hardware
-void initHw()
-{
-    // Configure HW to work with 16 MHz XTAL, PLL enabled, system clock of 40 MHz
-    SYSCTL_RCC_R = SYSCTL_RCC_XTAL_16MHZ | SYSCTL_RCC_OSCSRC_MAIN
-            | SYSCTL_RCC_USESYSDIV | (4 << SYSCTL_RCC_SYSDIV_S);
-
-    // Enable clocks
-    enablePort(PORTF);
-    _delay_cycles(3);
-
-    // Configure LED and pushbutton pins
-    selectPinPushPullOutput(RED_LED);
-    selectPinPushPullOutput(GREEN_LED);
-    selectPinPushPullOutput(BLUE_LED);
-    selectPinDigitalInput(PUSH_BUTTON);
-}
-
-void displayConnectionInfo()
-{
-    uint8_t i;
-    char str[10];
-    uint8_t mac[6];
-    uint8_t ip[4];
-    etherGetMacAddress(mac);
-    putsUart0("HW: ");
-    for (i = 0; i < 6; i++)
-    {
-        sprintf(str, "%02x", mac[i]);
-        putsUart0(str);
-        if (i < 6 - 1)
-            putcUart0(':');
-    }
-    putcUart0('\n');
-    etherGetIpAddress(ip);
-    putsUart0("IP: ");
-    for (i = 0; i < 4; i++)
-    {
-        sprintf(str, "%u", ip[i]);
-        putsUart0(str);
-        if (i < 4 - 1)
-            putcUart0('.');
-    }
-    if (etherIsDhcpEnabled())
-        putsUart0(" (dhcp)");
-    else
-        putsUart0(" (static)");
-    putcUart0('\n');
-    etherGetIpSubnetMask(ip);
-    putsUart0("SN: ");
-    for (i = 0; i < 4; i++)
-    {
-        sprintf(str, "%u", ip[i]);
-        putsUart0(str);
-        if (i < 4 - 1)
-            putcUart0('.');
-    }
-    putcUart0('\n');
-    etherGetIpGatewayAddress(ip);
-    putsUart0("GW: ");
-    for (i = 0; i < 4; i++)
-    {
-        sprintf(str, "%u", ip[i]);
-        putsUart0(str);
-        if (i < 4 - 1)
-            putcUart0('.');
-    }
-    putcUart0('\n');
-    if (etherIsLinkUp())
-        putsUart0("Link is up\n");
-    else
-        putsUart0("Link is down\n");
-}
-
-//-----------------------------------------------------------------------------
-// Main
-//-----------------------------------------------------------------------------
-
-int main(void)
-{
-    uint8_t* udpData;
-    uint8_t data[MAX_PACKET_SIZE];
-
-    // Init controller
-    initHw();
-    initTimer();
-    //initEeprom();
-
-    // Setup UART0
-    initUart0();
-    setUart0BaudRate(115200, 40e6);
-
-    // Init ethernet interface (eth0)
-    putsUart0("\nStarting eth0\n");
-    etherSetMacAddress(2, 3, 4, 5, 6, 131);
-    etherInit(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
-
-    //disabling dhcp for quicker mqtt debug process
-    etherDisableDhcpMode();
-
-
-
-    if(etherIsDhcpEnabled())
-    {
-        transitionToState(INIT);
-    }
-    else
-    {
-      etherSetIpAddress(192, 168, 1, 131);
-      etherSetIpSubnetMask(255, 255, 255, 0);
-      etherSetIpGatewayAddress(192, 168, 1, 199);
-    }
-
-    waitMicrosecond(100000);
-    //displayConnectionInfo();
-
-
-
-    // Flash LED
-    setPinValue(GREEN_LED, 1);
-    waitMicrosecond(100000);
-    setPinValue(GREEN_LED, 0);
-    waitMicrosecond(100000);
-
-//     uint8_t serverIP[] = {192, 168, 1 ,199};
-//     uint8_t serverMac[] = {0x00, 0xe0,0x4c,0x68, 0x19, 0xf4};
-//     uint8_t serverMac[] = {0x60, 0x45,0xbd,0xfa, 0xf6, 0x2b};
-//     uint16_t destPort = 1883;
-   //sendTcpPacket(0, 0, SYN, serverMac, serverIP,destPort );
-   //establishConnection(serverMac, serverIP, destPort);
-     //mqttConnect(serverIP, serverMac, 0);
-   //send a tcp syn for testing
-
-
-
-    // Main Loop
-    // RTOS and interrupts would greatly improve this code,
-    // but the goal here is simplicity
-    while (true)
-    {
-        // Put terminal processing here
-        if (kbhitUart0())
-        {
-            USER_DATA uartinput;
-            getsUart0(&uartinput);
-            parseFields(&uartinput);
-            executeUrtCommand(&uartinput);
-        }
-
-        // Packet processing
-        if (etherIsDataAvailable())
-        {
-            if (etherIsOverflow())
-            {
-                setPinValue(RED_LED, 1);
-                waitMicrosecond(100000);
-                setPinValue(RED_LED, 0);
-            }
-
-            // Get packet
-            etherGetPacket(data, MAX_PACKET_SIZE);
-
-/*            if (etherIsDhcpEnabled())
-            {
-                if (etherIsDhcp(data))
-                    dhcpStateMachineReceivedPacketHandler(data);
-            }
-*/
-
-            // Handle ARP request
-            if (etherIsArpRequest(data))
-            {
-                etherSendArpResponse(data);
-            }
-
-            // Handle IP datagram
-            if (etherIsIp(data))
-            {
-                if (etherIsIpUnicast(data))
-                {
-                    // handle icmp ping request
-                    if (etherIsPingRequest(data))
-                    {
-                        etherSendPingResponse(data);
-                    }
-
-                    // Process UDP datagram
-                    // test this with a udp send utility like sendip
-                    //   if sender IP (-is) is 192.168.1.198, this will attempt to
-                    //   send the udp datagram (-d) to 192.168.1.199, port 1024 (-ud)
-                    // sudo sendip -p ipv4 -is 192.168.1.198 -p udp -ud 1024 -d "on" 192.168.1.199
-                    // sudo sendip -p ipv4 -is 192.168.1.198 -p udp -ud 1024 -d "off" 192.168.1.199
-                    if (etherIsUdp(data))
-                    {
-                        udpData = etherGetUdpData(data);
-                        if (strcmp((char*) udpData, "on") == 0)
-                            setPinValue(GREEN_LED, 1);
-                        if (strcmp((char*) udpData, "off") == 0)
-                            setPinValue(GREEN_LED, 0);
-                        etherSendUdpResponse(data, (uint8_t*) "Received", 9);
-                    }
-                }
-            }
-            if (etherIsTcp(data))
-            {
-                processTcpMessage(data);
-            }
-        }
-    }
-}
+// Ethernet Example
+// Jason Losh
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL w/ ENC28J60
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// ENC28J60 Ethernet controller on SPI0
+//   MOSI (SSI0Tx) on PA5
+//   MISO (SSI0Rx) on PA4
+//   SCLK (SSI0Clk) on PA2ss
+//   ~CS (SW controlled) on PA3
+//   WOL on PB3
+//   INT on PC6
+
+// Pinning for IoT projects with wireless modules:
+// N24L01+ RF transceiver
+//   MOSI (SSI0Tx) on PA5
+//   MISO (SSI0Rx) on PA4
+//   SCLK (SSI0Clk) on PA2
+//   ~CS on PE0
+//   INT on PB2
+// Xbee module
+//   DIN (UART1TX) on PC5
+//   DOUT (UART1RX) on PC4
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "eth0.h"
+#include "gpio.h"
+#include "spi0.h"
+#include "uart0.h"
+#include "wait.h"
+#include "dhcp.h"
+#include "timer.h"
+#include "tcp.h"
+#include "common.h"
+#include "eeprom.h"
+#include "mqtt.h"
+#include "flashlog.h"
+#include "mqttsn.h"
+
+// Pins
+#define RED_LED PORTF,1
+#define BLUE_LED PORTF,2
+#define GREEN_LED PORTF,3
+#define PUSH_BUTTON PORTF,4
+
+//-----------------------------------------------------------------------------
+// Subroutines                
+//-----------------------------------------------------------------------------
+
+// Initialize Hardware
+void initHw()
+{
+    // Configure HW to work with 16 MHz XTAL, PLL enabled, system clock of 40 MHz
+    SYSCTL_RCC_R = SYSCTL_RCC_XTAL_16MHZ | SYSCTL_RCC_OSCSRC_MAIN
+            | SYSCTL_RCC_USESYSDIV | (4 << SYSCTL_RCC_SYSDIV_S);
+
+    // Enable clocks
+    enablePort(PORTF);
+    _delay_cycles(3);
+
+    // Configure LED and pushbutton pins
+    selectPinPushPullOutput(RED_LED);
+    selectPinPushPullOutput(GREEN_LED);
+    selectPinPushPullOutput(BLUE_LED);
+    selectPinDigitalInput(PUSH_BUTTON);
+}
+
+void displayConnectionInfo()
+{
+    uint8_t i;
+    char str[12];
+    uint8_t mac[6];
+    uint8_t ip[4];
+    etherGetMacAddress(mac);
+    putsUart0("HW: ");
+    for (i = 0; i < 6; i++)
+    {
+        sprintf(str, "%02x", mac[i]);
+        putsUart0(str);
+        if (i < 6 - 1)
+            putcUart0(':');
+    }
+    putcUart0('\n');
+    etherGetIpAddress(ip);
+    putsUart0("IP: ");
+    for (i = 0; i < 4; i++)
+    {
+        sprintf(str, "%u", ip[i]);
+        putsUart0(str);
+        if (i < 4 - 1)
+            putcUart0('.');
+    }
+    if (etherIsDhcpEnabled())
+        putsUart0(" (dhcp)");
+    else
+        putsUart0(" (static)");
+    putcUart0('\n');
+    etherGetIpSubnetMask(ip);
+    putsUart0("SN: ");
+    for (i = 0; i < 4; i++)
+    {
+        sprintf(str, "%u", ip[i]);
+        putsUart0(str);
+        if (i < 4 - 1)
+            putcUart0('.');
+    }
+    putcUart0('\n');
+    etherGetIpGatewayAddress(ip);
+    putsUart0("GW: ");
+    for (i = 0; i < 4; i++)
+    {
+        sprintf(str, "%u", ip[i]);
+        putsUart0(str);
+        if (i < 4 - 1)
+            putcUart0('.');
+    }
+    putcUart0('\n');
+    if (etherIsLinkUp())
+        putsUart0("Link is up\n");
+    else
+        putsUart0("Link is down\n");
+    sprintf(str, "%lu", (unsigned long) tcpGetRejectedSegments());
+    putsUart0("TCP segments rejected: ");
+    putsUart0(str);
+    putcUart0('\n');
+}
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+
+int main(void)
+{
+    uint8_t* udpData;
+    uint8_t data[MAX_PACKET_SIZE];
+    uint16_t size;
+
+    // Init controller
+    initHw();
+    initTimer();
+    initTcp();
+    // the ports the node has always accepted, anything sent to them is discarded
+    tcpListen(HTTP_PORT, NULL);
+    tcpListen(TELNET_PORT, NULL);
+    initFlashLog();
+    //initEeprom();
+
+    // Setup UART0
+    initUart0();
+    setUart0BaudRate(115200, 40e6);
+
+    // Init ethernet interface (eth0)
+    putsUart0("\nStarting eth0\n");
+    etherSetMacAddress(2, 3, 4, 5, 6, 131);
+    etherInit(ETHER_UNICAST | ETHER_BROADCAST | ETHER_HALFDUPLEX);
+
+    //disabling dhcp for quicker mqtt debug process
+    etherDisableDhcpMode();
+
+
+
+    if(etherIsDhcpEnabled())
+    {
+        transitionToState(INIT);
+    }
+    else
+    {
+      etherSetIpAddress(192, 168, 1, 131);
+      etherSetIpSubnetMask(255, 255, 255, 0);
+      etherSetIpGatewayAddress(192, 168, 1, 199);
+    }
+
+    waitMicrosecond(100000);
+    //displayConnectionInfo();
+
+
+
+    // Flash LED
+    setPinValue(GREEN_LED, 1);
+    waitMicrosecond(100000);
+    setPinValue(GREEN_LED, 0);
+    waitMicrosecond(100000);
+
+//     uint8_t serverIP[] = {192, 168, 1 ,199};
+//     uint8_t serverMac[] = {0x00, 0xe0,0x4c,0x68, 0x19, 0xf4};
+//     uint8_t serverMac[] = {0x60, 0x45,0xbd,0xfa, 0xf6, 0x2b};
+//     uint16_t destPort = 1883;
+   //sendTcpPacket(0, 0, SYN, serverMac, serverIP,destPort );
+   //establishConnection(serverMac, serverIP, destPort);
+     //mqttConnect(serverIP, serverMac, 0);
+   //send a tcp syn for testing
+
+
+
+    // Main Loop
+    // RTOS and interrupts would greatly improve this code,
+    // but the goal here is simplicity
+    while (true)
+    {
+        // Timer callbacks
+        processTimers();
+
+        // Put terminal processing here
+        if (kbhitUart0())
+        {
+            USER_DATA uartinput;
+            getsUart0(&uartinput);
+            tcpAddEntropy(random32());
+            parseFields(&uartinput);
+            executeUrtCommand(&uartinput);
+        }
+
+        // Packet processing
+        if (etherIsDataAvailable())
+        {
+            if (etherIsOverflow())
+            {
+                setPinValue(RED_LED, 1);
+                waitMicrosecond(100000);
+                setPinValue(RED_LED, 0);
+            }
+
+            // Get packet
+            size = etherGetPacket(data, MAX_PACKET_SIZE);
+            tcpAddEntropy(random32());
+
+/*            if (etherIsDhcpEnabled())
+            {
+                if (etherIsDhcp(data))
+                    dhcpStateMachineReceivedPacketHandler(data);
+            }
+*/
+
+            // Handle ARP request
+            if (etherIsArpRequest(data))
+            {
+                etherSendArpResponse(data);
+            }
+
+            // Handle IP datagram
+            if (etherIsIp(data))
+            {
+                if (etherIsIpUnicast(data))
+                {
+                    // handle icmp ping request
+                    if (etherIsPingRequest(data))
+                    {
+                        etherSendPingResponse(data);
+                    }
+
+                    // Process UDP datagram
+                    // test this with a udp send utility like sendip
+                    //   if sender IP (-is) is 192.168.1.198, this will attempt to
+                    //   send the udp datagram (-d) to 192.168.1.199, port 1024 (-ud)
+                    // sudo sendip -p ipv4 -is 192.168.1.198 -p udp -ud 1024 -d "on" 192.168.1.199
+                    // sudo sendip -p ipv4 -is 192.168.1.198 -p udp -ud 1024 -d "off" 192.168.1.199
+                    if (etherIsUdp(data))
+                    {
+                        if (mqttsnIsMessage(data))
+                        {
+                            processMqttsnMessage(data, size);
+                        }
+                        else
+                        {
+                            udpData = etherGetUdpData(data);
+                            if (strcmp((char*) udpData, "on") == 0)
+                                setPinValue(GREEN_LED, 1);
+                            if (strcmp((char*) udpData, "off") == 0)
+                                setPinValue(GREEN_LED, 0);
+                            etherSendUdpResponse(data, (uint8_t*) "Received", 9);
+                        }
+                    }
+                }
+            }
+            if (etherIsTcp(data))
+            {
+                processTcpMessage(data, size);
+            }
+        }
+    }
+}
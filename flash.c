@@ -0,0 +1,26 @@
+#include "flash.h"
+#include "tm4c123gh6pm.h"
+
+// the cpu stalls on reads from flash while it is being erased or programmed,
+// so these must not be called from code that runs out of the page being changed
+
+void eraseFlashPage(uint32_t add)
+{
+    FLASH_FMA_R = add & ~(FLASH_PAGE_SIZE - 1);
+    FLASH_FMC_R = FLASH_FMC_WRKEY | FLASH_FMC_ERASE;
+    while (FLASH_FMC_R & FLASH_FMC_ERASE);
+}
+
+// bits can only be cleared, a word must be erased before it is written with anything else
+void writeFlash(uint32_t add, uint32_t data)
+{
+    FLASH_FMD_R = data;
+    FLASH_FMA_R = add & ~3;
+    FLASH_FMC_R = FLASH_FMC_WRKEY | FLASH_FMC_WRITE;
+    while (FLASH_FMC_R & FLASH_FMC_WRITE);
+}
+
+uint32_t readFlash(uint32_t add)
+{
+    return *((volatile uint32_t*) add);
+}
@@ -0,0 +1,13 @@
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <stdint.h>
+
+#define FLASH_PAGE_SIZE 1024 // smallest erasable block
+#define FLASH_ERASED 0xFFFFFFFF
+
+void eraseFlashPage(uint32_t add);
+void writeFlash(uint32_t add, uint32_t data);
+uint32_t readFlash(uint32_t add);
+
+#endif
@@ -0,0 +1,303 @@
+#include "flashlog.h"
+#include <string.h>
+#include "timer.h"
+
+// the log is rebuilt from flash at reset, these only say where to look
+uint8_t logWritePage = 0;
+uint16_t logWriteOffset = FLASH_LOG_PAGE_HEADER;
+uint8_t logReadPage = 0;     // replay cursor, the oldest record that may be pending
+uint16_t logReadOffset = FLASH_LOG_PAGE_HEADER;
+uint32_t logSequence = 0;    // of the page being written
+uint32_t logPending = 0;
+uint32_t logTimeBase = 1;    // continues the clock of the records found at reset
+uint32_t logMaxErases = 0;
+
+// finds where the last reset left off, the status words written as records are
+// sent bring the replay cursor back to the oldest one still pending
+void initFlashLog()
+{
+    uint8_t page;
+    uint8_t i;
+    uint16_t offset;
+    uint16_t size;
+    bool found = false;
+    flashLogRecord record;
+
+    logPending = 0;
+    logTimeBase = 1;
+    logMaxErases = 0;
+    for (page = 0; page < FLASH_LOG_PAGES; page++)
+    {
+        if (!flashLogPageValid(page))
+            continue;
+        if (!found || readFlash(flashLogPageAddress(page) + 4) > logSequence)
+        {
+            logWritePage = page;
+            logSequence = readFlash(flashLogPageAddress(page) + 4);
+        }
+        if (readFlash(flashLogPageAddress(page) + 8) > logMaxErases)
+            logMaxErases = readFlash(flashLogPageAddress(page) + 8);
+        found = true;
+    }
+    if (!found)
+    {
+        logReadPage = logWritePage = 0;
+        flashLogStartPage(0);
+        return;
+    }
+
+    // the oldest page follows the newest one around the ring
+    logReadPage = logWritePage;
+    for (i = 1; i < FLASH_LOG_PAGES; i++)
+    {
+        page = (logWritePage + i) % FLASH_LOG_PAGES;
+        if (flashLogPageValid(page))
+        {
+            logReadPage = page;
+            break;
+        }
+    }
+    logReadOffset = FLASH_LOG_PAGE_HEADER;
+
+    for (i = 0; i < FLASH_LOG_PAGES; i++)
+    {
+        page = (logReadPage + i) % FLASH_LOG_PAGES;
+        if (flashLogPageValid(page))
+        {
+            offset = FLASH_LOG_PAGE_HEADER;
+            while ((size = flashLogRecordAt(flashLogPageAddress(page) + offset, &record)) > 0)
+            {
+                if (record.valid && record.pending)
+                    logPending++;
+                if (record.valid && record.timestamp >= logTimeBase)
+                    logTimeBase = record.timestamp + 1;
+                offset += size;
+            }
+            if (page == logWritePage)
+            {
+                // a torn record header is not erased, flashLogAppend moves on from it
+                logWriteOffset = offset;
+                break;
+            }
+        }
+    }
+}
+
+// returns false if the record is too large, the oldest page is given up when the log is full
+bool flashLogAppend(uint8_t* data, uint16_t len)
+{
+    uint16_t size = flashLogRecordSize(len);
+    uint32_t address;
+    uint32_t timestamp;
+    uint32_t word;
+    uint16_t i;
+    uint8_t crcData[4];
+
+    if (len == 0 || len > FLASH_LOG_MAX_RECORD)
+    {
+        return false;
+    }
+    if (logWriteOffset + size > FLASH_PAGE_SIZE
+            || readFlash(flashLogPageAddress(logWritePage) + logWriteOffset) != FLASH_ERASED)
+    {
+        flashLogStartPage((logWritePage + 1) % FLASH_LOG_PAGES);
+    }
+    address = flashLogPageAddress(logWritePage) + logWriteOffset;
+    timestamp = flashLogTime();
+    memcpy(crcData, &timestamp, sizeof(timestamp));
+
+    // the header goes first, a reset part way through leaves a record that fails
+    // its crc but can still be stepped over
+    writeFlash(address, ((uint32_t) FLASH_LOG_RECORD_MAGIC << 24) | ((uint32_t) len << 16)
+               | flashLogCrc(flashLogCrc(0xFFFF, crcData, 4), data, len));
+    writeFlash(address + 4, timestamp);
+    for (i = 0; i < len; i += 4)
+    {
+        word = FLASH_ERASED;
+        memcpy(&word, &data[i], len - i < 4 ? len - i : 4);
+        writeFlash(address + FLASH_LOG_RECORD_HEADER + i, word);
+    }
+    logWriteOffset += size;
+    logPending++;
+    return true;
+}
+
+// finds the oldest pending record, the cursor steps over sent and torn ones
+bool flashLogPeek(flashLogRecord* record)
+{
+    uint16_t size;
+    while (logPending > 0)
+    {
+        size = 0;
+        if (flashLogPageValid(logReadPage))
+            size = flashLogRecordAt(flashLogPageAddress(logReadPage) + logReadOffset, record);
+        if (size == 0)
+        {
+            if (logReadPage == logWritePage)
+                break;
+            logReadPage = (logReadPage + 1) % FLASH_LOG_PAGES;
+            logReadOffset = FLASH_LOG_PAGE_HEADER;
+            continue;
+        }
+        if (record->valid && record->pending)
+            return true;
+        logReadOffset += size;
+    }
+    logPending = 0; // nothing left for the cursor, the count had drifted
+    return false;
+}
+
+// copies the data of a record, returns its length
+uint16_t flashLogRead(flashLogRecord* record, uint8_t* data, uint16_t size)
+{
+    uint16_t i;
+    uint32_t word;
+    if (size > record->len)
+        size = record->len;
+    for (i = 0; i < size; i += 4)
+    {
+        word = readFlash(record->address + FLASH_LOG_RECORD_HEADER + i);
+        memcpy(&data[i], &word, size - i < 4 ? size - i : 4);
+    }
+    return size;
+}
+
+// marks the record flashLogPeek returned as sent and moves the cursor past it
+void flashLogConsume(flashLogRecord* record)
+{
+    writeFlash(record->address + 8, FLASH_LOG_SENT);
+    record->pending = false;
+    if (logPending > 0)
+        logPending--;
+    if (record->address == flashLogPageAddress(logReadPage) + logReadOffset)
+        logReadOffset += flashLogRecordSize(record->len);
+}
+
+uint32_t flashLogDepth()
+{
+    return logPending;
+}
+
+// timestamp of the oldest pending record, 0 when there is none
+uint32_t flashLogOldest()
+{
+    flashLogRecord record;
+    if (!flashLogPeek(&record))
+        return 0;
+    return record.timestamp;
+}
+
+// seconds since the first record was written, uptime carried over from the records
+// found at reset since there is no calendar clock
+uint32_t flashLogTime()
+{
+    return logTimeBase + getUptime();
+}
+
+// pages are erased in turn, so this stays close to every page's count
+uint32_t flashLogEraseCount()
+{
+    return logMaxErases;
+}
+
+uint32_t flashLogPageAddress(uint8_t page)
+{
+    return FLASH_LOG_START + (uint32_t) page * FLASH_PAGE_SIZE;
+}
+
+bool flashLogPageValid(uint8_t page)
+{
+    return readFlash(flashLogPageAddress(page)) == FLASH_LOG_PAGE_MAGIC;
+}
+
+// erases the next page of the ring for writing, records still pending in it are lost
+void flashLogStartPage(uint8_t page)
+{
+    uint32_t address = flashLogPageAddress(page);
+    uint32_t erases = 0;
+    uint16_t offset;
+    uint16_t size;
+    flashLogRecord record;
+
+    if (flashLogPageValid(page))
+    {
+        erases = readFlash(address + 8);
+        if (page == logReadPage && page != logWritePage)
+        {
+            offset = logReadOffset;
+            while ((size = flashLogRecordAt(address + offset, &record)) > 0)
+            {
+                if (record.valid && record.pending && logPending > 0)
+                    logPending--;
+                offset += size;
+            }
+            logReadPage = (page + 1) % FLASH_LOG_PAGES;
+            logReadOffset = FLASH_LOG_PAGE_HEADER;
+        }
+    }
+    eraseFlashPage(address);
+    erases++;
+    if (erases > logMaxErases)
+        logMaxErases = erases;
+    // the magic goes last so a reset in between leaves a page that is not used
+    writeFlash(address + 4, ++logSequence);
+    writeFlash(address + 8, erases);
+    writeFlash(address, FLASH_LOG_PAGE_MAGIC);
+    logWritePage = page;
+    logWriteOffset = FLASH_LOG_PAGE_HEADER;
+    if (logReadPage == page)
+        logReadOffset = FLASH_LOG_PAGE_HEADER;
+}
+
+// returns the size of the record at address, 0 at the end of the written part of the page
+uint16_t flashLogRecordAt(uint32_t address, flashLogRecord* record)
+{
+    uint32_t header;
+    uint32_t end = (address & ~(FLASH_PAGE_SIZE - 1)) + FLASH_PAGE_SIZE;
+    uint16_t crc;
+    uint16_t i;
+    uint32_t word;
+    uint8_t data[4];
+
+    if (address + FLASH_LOG_RECORD_HEADER > end)
+        return 0;
+    header = readFlash(address);
+    record->address = address;
+    record->len = (header >> 16) & 0xFF;
+    if ((header >> 24) != FLASH_LOG_RECORD_MAGIC || record->len == 0
+            || address + flashLogRecordSize(record->len) > end)
+    {
+        return 0;
+    }
+    record->timestamp = readFlash(address + 4);
+    record->pending = readFlash(address + 8) != FLASH_LOG_SENT;
+    memcpy(data, &record->timestamp, sizeof(record->timestamp));
+    crc = flashLogCrc(0xFFFF, data, 4);
+    for (i = 0; i < record->len; i += 4)
+    {
+        word = readFlash(address + FLASH_LOG_RECORD_HEADER + i);
+        memcpy(data, &word, 4);
+        crc = flashLogCrc(crc, data, record->len - i < 4 ? record->len - i : 4);
+    }
+    record->valid = crc == (header & 0xFFFF);
+    return flashLogRecordSize(record->len);
+}
+
+uint16_t flashLogRecordSize(uint16_t len)
+{
+    return FLASH_LOG_RECORD_HEADER + ((len + 3) & ~3);
+}
+
+// crc-16-ccitt, start with 0xFFFF
+uint16_t flashLogCrc(uint16_t crc, uint8_t* data, uint16_t len)
+{
+    uint16_t i;
+    uint8_t bit;
+    for (i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t) data[i] << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
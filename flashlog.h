@@ -0,0 +1,51 @@
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "flash.h"
+
+// records that could not be delivered are kept in a ring of flash pages at the top
+// of the 256 KB part, the linker command file must keep the program out of it
+#define FLASH_LOG_START 0x3C000
+#define FLASH_LOG_PAGES 16
+#define FLASH_LOG_MAX_RECORD 128 // data bytes in one record
+
+// a page starts with its magic, a sequence number and how often it was erased,
+// pages are filled in ring order so the highest sequence is the one being written
+#define FLASH_LOG_PAGE_MAGIC 0x464C4F47
+#define FLASH_LOG_PAGE_HEADER 12
+
+// a record is a header word (magic, length and crc), the timestamp, a status word
+// and the data padded to a whole word
+#define FLASH_LOG_RECORD_MAGIC 0xA5
+#define FLASH_LOG_RECORD_HEADER 12
+#define FLASH_LOG_SENT 0 // the status word is left erased while the record is pending
+
+typedef struct _flashLogRecord
+{
+    uint32_t address;
+    uint32_t timestamp; // seconds, see flashLogTime
+    uint16_t len;
+    bool valid;         // the crc matched, a record torn by a reset does not
+    bool pending;
+} flashLogRecord;
+
+void initFlashLog();
+bool flashLogAppend(uint8_t* data, uint16_t len);
+bool flashLogPeek(flashLogRecord* record);
+uint16_t flashLogRead(flashLogRecord* record, uint8_t* data, uint16_t size);
+void flashLogConsume(flashLogRecord* record);
+uint32_t flashLogDepth();
+uint32_t flashLogOldest();
+uint32_t flashLogTime();
+uint32_t flashLogEraseCount();
+
+uint32_t flashLogPageAddress(uint8_t page);
+bool flashLogPageValid(uint8_t page);
+void flashLogStartPage(uint8_t page);
+uint16_t flashLogRecordAt(uint32_t address, flashLogRecord* record);
+uint16_t flashLogRecordSize(uint16_t len);
+uint16_t flashLogCrc(uint16_t crc, uint8_t* data, uint16_t len);
+
+#endif
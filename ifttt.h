@@ -1,13 +1,13 @@
-/*
- * ifttt.h
- *      Author: Pavel
- */
-
-#ifndef IFTTT_H_
-#define IFTTT_H_
-
-void printInputList(char* strMsg);
-void printOutputList(char* strMsg);
-
-
-#endif /* IFTTT_H_ */
+/*
+ * ifttt.h
+ *      Author: Pavel
+ */
+
+#ifndef IFTTT_H_
+#define IFTTT_H_
+
+void printInputList(char* strMsg);
+void printOutputList(char* strMsg);
+
+
+#endif /* IFTTT_H_ */
@@ -1,359 +1,1866 @@
-#include "mqtt.h"
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include "tm4c123gh6pm.h"
-#include "gpio.h"
-#include "spi0.h"
-#include "wait.h"
-#include "timer.h"
-#include "tcp.h"
-
-
-#define MQTT_BROKER_PORT 1883
-#define MQTT_MAX_MSGSIZE 110
-
-#define MQTT_CONNECTED 1
-#define MQTT_DISCONNECTED 2
-
-uint16_t guid = 1;
-mqttSubscribedTopic subscribedTopics[MAX_SUBSCRIBED_TOPIC];
-
-typedef struct _mqttClientState
-{
-    uint8_t qos;
-    uint8_t brokerIP[IP_ADD_LENGTH];
-    uint8_t brokerMac[HW_ADD_LENGTH];
-    uint8_t connectionState;
-} mqttClientState;
-typedef struct _mqttMessageBuffer
-{
-    bool isEmpty;
-    uint16_t msgLen;
-    uint8_t buff[MQTT_MAX_MSGSIZE];
-} mqttMessageBuffer;
-
-mqttClientState clientState = { .qos = 0, .brokerIP = { 0, 0, 0, 0 },
-                                .brokerMac = { 0xf, 0xff, 0xff, 0xff },
-                                .connectionState = MQTT_DISCONNECTED };
-
-mqttMessageBuffer msgBuff = {.isEmpty = true, .msgLen = 0};
-
-
-uint8_t appendToPayload(uint8_t *buffer, uint8_t *data, uint8_t len)
-{
-    memcpy(&buffer[0], data, len);
-    return len;
-}
-
-void mqttConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos)
-{
-    memcpy(&clientState.brokerMac, serverMacAddress, HW_ADD_LENGTH);
-    memcpy(&clientState.brokerIP, serverIP, IP_ADD_LENGTH);
-
-    uint8_t i;
-    for(i = 0; i < MAX_SUBSCRIBED_TOPIC; i++)
-    {
-        subscribedTopics[i].topicId = 0xff;
-    }
-
-
-    clientState.qos = qos;
-    mqttFrameConnect mqtt ;
-    fixedMqttHeader mqttfh;
-    char* clientName = "hello";
-    uint8_t clientSize = strlen(clientName);
-    uint8_t sizeofclient = sizeof(clientName);
-    mqttfh.packetType = MQTT_CONNECT;
-    mqttfh.flags = 0;
-    mqtt.protocolLen = htons(4);
-    mqtt.protocolName[0] = 'M';
-    mqtt.protocolName[1] = 'Q';
-    mqtt.protocolName[2] = 'T';
-    mqtt.protocolName[3] = 'T';
-    mqtt.version = 0x04;
-    mqtt.flag = 0x02;
-    mqtt.keepalive = htons(60);
-    mqtt.clen = htons(clientSize);//htons(strlen(clientName));
-
-    uint8_t totalMsgSize = sizeof(mqttFrameConnect) + clientSize;
-    mqttfh.msglen = totalMsgSize;
-
-    //memset(msgBuff, 0, sizeof(mqttMessageBuffer));
-
-    uint8_t len = 0;
-    //add stuff to message buffer
-    len += appendToPayload(&msgBuff.buff[len], &mqttfh, sizeof(mqttfh));
-    len += appendToPayload(&msgBuff.buff[len], &mqtt, sizeof(mqtt));
-    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
-    len += appendToPayload(&msgBuff.buff[len], clientName, clientSize);
-    msgBuff.msgLen = len;
-    msgBuff.isEmpty = false;
-
-    if(getTcpConnectionState() == ESTABLISHED)
-    {
-        sendMqttPayload();
-    }
-    else
-    {
-        establishConnection(clientState.brokerMac, clientState.brokerIP, MQTT_BROKER_PORT);
-        startPeriodicTimer(retryMqttMsgResend, 15);
-    }
-}
-
-void mqttDisconnect()
-{
-    fixedMqttHeader mqtt;
-    mqtt.packetType = MQTT_DISCONNECT;
-    mqtt.flags = 0;
-    mqtt.msglen = 0;
-    stopTimer(mqttPing);
-    stopTimer(retryMqttMsgResend);
-    clientState.connectionState = MQTT_DISCONNECTED;
-    sendTcpPacket(&mqtt, sizeof(mqtt), ACK|PUSH, clientState.brokerMac, clientState.brokerIP, MQTT_BROKER_PORT);
-}
-
-void mqttPing()
-{
-    fixedMqttHeader mqtt;
-    mqtt.packetType = MQTT_PINGREQ;
-    mqtt.flags = 0;
-    mqtt.msglen = 0;
-    sendTcpPacket(&mqtt, sizeof(mqtt), ACK|PUSH, clientState.brokerMac, clientState.brokerIP, MQTT_BROKER_PORT);
-}
-
-void mqttSubscribe(char* topicFilter, uint16_t topicNameLen)
-{
-    fixedMqttHeader mqttfh;
-    mqttfh.packetType = MQTT_SUBSCRIBE;
-    mqttfh.flags = 0x02;
-    mqttfh.msglen = 0;
-    mqttFrameSubscribe subs;
-    uint16_t topicId = getNewGuid();
-    subs.packetIdentifier = htons(topicId);
-    subs.topicnamelen = htons(topicNameLen);
-
-    mqttfh.msglen = sizeof(mqttFrameSubscribe) + topicNameLen + 1; //1 for qos field
-
-    uint8_t len = 0;
-    //add stuff to message buffer
-    len += appendToPayload(&msgBuff.buff[len], &mqttfh, sizeof(mqttfh));
-    len += appendToPayload(&msgBuff.buff[len], &subs, sizeof(subs));
-    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
-    len += appendToPayload(&msgBuff.buff[len], topicFilter, topicNameLen);
-    len += appendToPayload(&msgBuff.buff[len], &clientState.qos, 1);
-    msgBuff.msgLen = len;
-    msgBuff.isEmpty = false;
-
-    sendMqttPayload();
-    storeSubscribedTopic(topicFilter, topicId);
-
-}
-
-void mqttUnsubscribe(char* topicFilter, uint16_t topicNameLen)
-{
-    fixedMqttHeader mqttfh;
-    mqttfh.packetType = MQTT_UNSUBSCRIBE;
-    mqttfh.flags = 0x02;
-    mqttfh.msglen = 0;
-    mqttFrameUnsubscribe unsubs;
-    uint16_t topicId = getTopicIdByName(topicFilter);
-
-    unsubs.packetIdentifier = htons(topicId);
-    unsubs.topicnamelen = htons(topicNameLen);
-
-    mqttfh.msglen = sizeof(mqttFrameUnsubscribe) + topicNameLen; //1 for qos fiel
-
-    uint8_t len = 0;
-    //add stuff to message buffer
-    len += appendToPayload(&msgBuff.buff[len], &mqttfh, sizeof(mqttfh));
-    len += appendToPayload(&msgBuff.buff[len], &unsubs, sizeof(unsubs));
-    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
-    len += appendToPayload(&msgBuff.buff[len], topicFilter, topicNameLen);
-    msgBuff.msgLen = len;
-    msgBuff.isEmpty = false;
-
-    removeUnsubscribedTopic(topicFilter, topicId);
-
-    sendMqttPayload();
-}
-
-void mqttPublish(char* topicFilter, uint16_t topicNameLen, char* topicValue,
-                 uint16_t topicValueLen)
-{
-    fixedMqttHeader mqttfh;
-    mqttfh.packetType = MQTT_PUBLISH;
-    if (clientState.qos == 0)
-    {
-        mqttfh.flags = 0;
-    }
-    else if (clientState.qos == 1)
-    {
-        mqttfh.flags = 0b0010;
-    }
-    else if (clientState.qos == 2)
-    {
-        mqttfh.flags = 0b0100;
-    }
-
-    if (clientState.qos == 0)
-    {
-        mqttfh.msglen = strlen(topicFilter) + strlen(topicValue) + 2; //topic name size+ payload size+ topic length size
-    }
-    else
-    {
-        mqttfh.msglen = strlen(topicFilter) + strlen(topicValue) + 2 + 2; //qos 0 size + packet identifier 2 byte
-    }
-
-    uint8_t len = 0;
-    //add stuff to message buffer
-    len += appendToPayload(&msgBuff.buff[len], &mqttfh, sizeof(mqttfh));
-    uint16_t tmp16TopicNamelen = htons(topicNameLen);
-    len += appendToPayload(&msgBuff.buff[len], &tmp16TopicNamelen,
-                           sizeof(tmp16TopicNamelen));
-    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
-    len += appendToPayload(&msgBuff.buff[len], topicFilter, topicNameLen);
-    if (clientState.qos == 1 || clientState.qos == 2)
-    {
-        uint16_t packetID = htons(getNewGuid());
-        len += appendToPayload(&msgBuff.buff[len], &packetID, sizeof(packetID));
-    }
-
-    len += appendToPayload(&msgBuff.buff[len], topicValue, topicValueLen);
-
-    msgBuff.msgLen = len;
-    msgBuff.isEmpty = false;
-    sendMqttPayload();
-
-}
-
-void retryMqttMsgResend()
-{
-    sendMqttPayload();
-}
-
-void sendMqttPayload()
-{
-    if(msgBuff.isEmpty == false)
-    {
-        //stopTimer(retryMqttMsgResend);
-        sendTcpPacket(msgBuff.buff, msgBuff.msgLen, ACK|PUSH, clientState.brokerMac, clientState.brokerIP, MQTT_BROKER_PORT);
-     //   memset(msgBuff, 0, sizeof(mqttMessageBuffer));
-        msgBuff.isEmpty = true;
-    }
-}
-
-void processMqttMessage(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    fixedMqttHeader* mqttFxHdr = (fixedMqttHeader*) (&tcp->data);
-
-    switch (mqttFxHdr->packetType)
-    {
-    case MQTT_CONNACK:
-        startPeriodicTimer(mqttPing, 50);
-        clientState.connectionState = MQTT_CONNECTED;
-        break;
-    case MQTT_PINGRESP:
-        flashBlue();
-        break;
-    default:
-        break;
-    }
-    return;
-}
-
-bool etherIsMqtt(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    bool ok = false;
-    uint16_t tmp16;
-
-    if ((ip->protocol == 0x06) && (ntohs(tcp->sourcePort) == MQTT_BROKER_PORT))
-    {
-        ok = true;
-    }
-
-    return ok;
-}
-
-uint16_t getNewGuid()
-{
-    return guid++;
-}
-
-void storeSubscribedTopic(topicFilter, topicId)
-{
-    uint8_t i;
-    for (i = 0; i < MAX_SUBSCRIBED_TOPIC; i++)
-    {
-        if (subscribedTopics[i].topicId == 0xff)
-        {
-            subscribedTopics[i].topicId = topicId;
-            strcpy(subscribedTopics[i].topicName, topicFilter);
-            break;
-        }
-    }
-}
-void removeUnsubscribedTopic(topicFilter, topicId)
-{
-    uint8_t i;
-    for (i = 0; i < MAX_SUBSCRIBED_TOPIC; i++)
-    {
-        if (subscribedTopics[i].topicId == topicId)
-        {
-            subscribedTopics[i].topicId = 0xff;
-            strcpy(subscribedTopics[i].topicName, "");
-            break;
-        }
-    }
-}
-uint16_t getTopicIdByName(topicFilter)
-{
-    uint8_t i;
-    for (i = 0; i < MAX_SUBSCRIBED_TOPIC; i++)
-    {
-        if (strcmp(subscribedTopics[i].topicName, topicFilter) == 0)
-        {
-            return subscribedTopics[i].topicId;
-        }
-    }
-}
-
-void setMqttBrokerIp(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
-{
-    clientState.brokerIP[0] = ip0;
-    clientState.brokerIP[1] = ip1;
-    clientState.brokerIP[2] = ip2;
-    clientState.brokerIP[3] = ip3;
-}
-
-void mqttGetIpAddress(uint8_t ip[4])
-{
-    uint8_t i;
-    for (i = 0; i < 4; i++)
-        ip[i] = clientState.brokerIP[i];
-}
-
-mqttSubscribedTopic* getMqttSubscribedTopics()
-{
-    return subscribedTopics;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+#include "mqtt.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "gpio.h"
+#include "spi0.h"
+#include "wait.h"
+#include "timer.h"
+#include "tcp.h"
+#include "flashlog.h"
+
+
+#define MQTT_BROKER_PORT 1883
+#define MQTT_MAX_MSGSIZE 110
+#define MQTT_MAX_RX_MSGSIZE 256 // inbound packets are handled from the stack, not the queue
+
+#define MQTT_CONNECTED 1
+#define MQTT_DISCONNECTED 2
+#define MQTT_CONNECTING 3
+
+// tcp keepalive on the broker connection, a silent broker is given up on after
+// MQTT_TCP_KEEPALIVE_IDLE + MQTT_TCP_KEEPALIVE_COUNT * MQTT_TCP_KEEPALIVE_INTERVAL seconds
+#define MQTT_TCP_KEEPALIVE_IDLE 10
+#define MQTT_TCP_KEEPALIVE_INTERVAL 2
+#define MQTT_TCP_KEEPALIVE_COUNT 3
+
+// mqtt keepalive, a PINGREQ only goes out after MQTT_KEEPALIVE seconds with nothing
+// else sent, the broker allows one and a half times that
+#define MQTT_KEEPALIVE 60
+#define MQTT_PING_TIMEOUT 10 // seconds for the broker to answer before it is given up on
+
+// a lost broker is tried again after MQTT_RECONNECT_MIN seconds, doubling up to
+// MQTT_RECONNECT_MAX until a CONNACK arrives
+#define MQTT_RECONNECT_MIN 1
+#define MQTT_RECONNECT_MAX 64
+
+uint32_t packetIdsInUse[MQTT_PACKET_IDS / 32];
+uint16_t lastPacketId = 0;
+uint32_t rxSkip = 0; // bytes left of an inbound packet that is being discarded
+uint16_t sendIdle = 0;   // seconds since anything was written to the broker
+uint8_t pingTimeout = 0; // seconds left to hear from the broker after a PINGREQ, 0 for none
+bool pingLed = false;    // blue led lit by a PINGRESP, off again on the next keepalive tick
+uint8_t reconnectDelay = MQTT_RECONNECT_MIN; // seconds before the next reconnect attempt
+bool resubscribing = false;             // kept subscriptions are still being sent again
+uint8_t resubscribeNode = MQTT_NO_NODE; // the last one sent
+mqttTopicNode topicNodes[MQTT_MAX_TOPIC_NODES];
+char levelPool[MQTT_LEVEL_POOL_SIZE];
+uint16_t levelPoolUsed = 0;
+// kept across reconnects, unlike the subscriptions
+mqttHandler topicHandlers[MAX_TOPIC_HANDLERS];
+uint8_t replayRate = MQTT_REPLAY_RATE;
+uint8_t protocolVersion = MQTT_VERSION_3_1_1; // used from the next mqttConnect on
+mqttTopicAlias topicAliases[MQTT_MAX_TOPIC_ALIASES];
+uint16_t topicAliasUse = 0;
+
+typedef struct _mqttClientState
+{
+    uint8_t qos;
+    uint8_t brokerIP[IP_ADD_LENGTH];
+    uint8_t brokerMac[HW_ADD_LENGTH];
+    uint8_t connectionState;
+    uint16_t localPort;
+    uint8_t version;
+    // limits from an mqtt 5 CONNACK
+    uint16_t brokerReceiveMaximum;
+    uint32_t brokerMaximumPacketSize;  // 0 for no limit
+    uint16_t brokerTopicAliasMaximum;
+} mqttClientState;
+// whole mqtt packets waiting for tcp, back to back in a ring
+typedef struct _mqttOutQueue
+{
+    uint16_t head;
+    uint16_t length;
+    bool push;        // a packet that should not wait for more is queued, see tcpFlush
+    uint8_t buff[MQTT_QUEUE_SIZE];
+} mqttOutQueue;
+
+mqttClientState clientState = { .qos = 0, .brokerIP = { 0, 0, 0, 0 },
+                                .brokerMac = { 0xf, 0xff, 0xff, 0xff },
+                                .connectionState = MQTT_DISCONNECTED,
+                                .localPort = 0, .version = MQTT_VERSION_3_1_1,
+                                .brokerReceiveMaximum = 0xFFFF,
+                                .brokerMaximumPacketSize = 0,
+                                .brokerTopicAliasMaximum = 0 };
+
+mqttOutQueue outQueue = {.head = 0, .length = 0, .push = false};
+
+// a publish written to tcp piece by piece, see mqttPublishBegin
+typedef struct _mqttPublishStream
+{
+    bool active;
+    uint32_t remaining; // payload bytes still to come
+} mqttPublishStream;
+
+mqttPublishStream publishStream = {.active = false, .remaining = 0};
+
+typedef struct _mqttInflightMessage
+{
+    uint8_t state;       // MQTT_INFLIGHT_FREE or what the broker owes us
+    uint16_t packetId;
+    uint16_t order;      // messages go out in the order they were made
+    bool queued;         // waiting to be written to tcp, first or again
+    uint8_t timeout;     // seconds until it is sent again
+    uint16_t len;        // 0 for a streamed publish, which cannot be resent
+    uint8_t alias;       // topic alias the PUBLISH uses, 0 for none
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+} mqttInflightMessage;
+
+mqttInflightMessage inflight[MQTT_MAX_INFLIGHT];
+uint16_t inflightOrder = 0;
+
+// broker packet ids already handed to the application
+uint16_t inboundQos2[MQTT_MAX_INBOUND_IDS]; // until PUBREL, 0 is a free entry
+uint16_t recentQos1[MQTT_MAX_INBOUND_IDS];
+uint8_t inboundQos2Next = 0;
+uint8_t recentQos1Next = 0;
+
+
+// the broker connection is identified by its 4-tuple, so a reused slot is never mistaken for it
+tcpControlBlock* getMqttConnection()
+{
+    return tcpFindConnection(clientState.brokerIP, MQTT_BROKER_PORT,
+                             clientState.localPort);
+}
+
+uint16_t appendToPayload(uint8_t *buffer, uint8_t *data, uint16_t len)
+{
+    memcpy(&buffer[0], data, len);
+    return len;
+}
+
+// a new session from the user starts without subscriptions
+void mqttConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos)
+{
+    reconnectDelay = MQTT_RECONNECT_MIN;
+    mqttClearSubscriptions();
+    mqttSendConnect(serverIP, serverMacAddress, qos);
+}
+
+// opens the broker connection if needed and sends CONNECT, the subscriptions
+// kept are asked for again on CONNACK
+void mqttSendConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos)
+{
+    memcpy(&clientState.brokerMac, serverMacAddress, HW_ADD_LENGTH);
+    memcpy(&clientState.brokerIP, serverIP, IP_ADD_LENGTH);
+
+    clientState.qos = qos;
+    clientState.version = protocolVersion;
+    clientState.brokerReceiveMaximum = 0xFFFF;
+    clientState.brokerMaximumPacketSize = 0;
+    clientState.brokerTopicAliasMaximum = 0;
+    mqttFrameConnect mqtt ;
+    char* clientName = "hello";
+    uint8_t clientSize = strlen(clientName);
+    uint8_t sizeofclient = sizeof(clientName);
+    mqtt.protocolLen = htons(4);
+    mqtt.protocolName[0] = 'M';
+    mqtt.protocolName[1] = 'Q';
+    mqtt.protocolName[2] = 'T';
+    mqtt.protocolName[3] = 'T';
+    mqtt.version = clientState.version;
+    mqtt.flag = 0x02;
+    mqtt.keepalive = htons(MQTT_KEEPALIVE);
+    mqtt.clen = htons(clientSize);//htons(strlen(clientName));
+
+    // mqtt 5, the broker keeps to what the receive side here can take
+    uint8_t properties[8];
+    uint8_t propertiesLen = 0;
+    propertiesLen += mqttWriteProperty(&properties[propertiesLen], MQTT_PROP_RECEIVE_MAXIMUM,
+                                       MQTT_MAX_INBOUND_IDS, 2);
+    propertiesLen += mqttWriteProperty(&properties[propertiesLen], MQTT_PROP_MAXIMUM_PACKET_SIZE,
+                                       MQTT_MAX_RX_MSGSIZE, 4);
+    uint8_t propBuff[1 + sizeof(properties)];
+    uint8_t propSize = mqttWriteProperties(propBuff, properties, propertiesLen);
+
+    uint32_t totalMsgSize = sizeof(mqttFrameConnect) + propSize + clientSize;
+
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+    uint16_t len = 0;
+    //add stuff to message buffer
+    len += mqttWriteFixedHeader(&buff[len], MQTT_CONNECT, 0, totalMsgSize);
+    // the properties go between the keepalive and the client id
+    len += appendToPayload(&buff[len], &mqtt, sizeof(mqtt) - sizeof(mqtt.clen));
+    len += appendToPayload(&buff[len], propBuff, propSize);
+    len += appendToPayload(&buff[len], &mqtt.clen, sizeof(mqtt.clen));
+    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
+    len += appendToPayload(&buff[len], clientName, clientSize);
+    // anything left over was meant for the last connection, or is a CONNECT
+    // that never went out
+    if (getTcpConnectionState(getMqttConnection()) != ESTABLISHED)
+    {
+        outQueue.length = 0;
+        outQueue.push = false;
+    }
+    mqttQueuePacket(buff, len, true);
+
+    clientState.connectionState = MQTT_CONNECTING;
+    if(getTcpConnectionState(getMqttConnection()) == ESTABLISHED)
+    {
+        sendMqttPayload();
+    }
+    else
+    {
+        mqttOpenConnection();
+        startPeriodicTimer(retryMqttMsgResend, 15);
+    }
+}
+
+// starts the tcp handshake with the broker, the CONNECT waiting in the queue follows
+// once it completes
+void mqttOpenConnection()
+{
+    tcpControlBlock* tcb = tcpConnect(clientState.brokerMac, clientState.brokerIP, MQTT_BROKER_PORT,
+                                      mqttTcpEvent);
+    if (tcb != NULL)
+    {
+        clientState.localPort = tcb->localPort;
+        tcpSetKeepalive(tcb, MQTT_TCP_KEEPALIVE_IDLE, MQTT_TCP_KEEPALIVE_INTERVAL,
+                        MQTT_TCP_KEEPALIVE_COUNT);
+    }
+}
+
+// events on the broker connection
+void mqttTcpEvent(tcpControlBlock* tcb, uint8_t event)
+{
+    switch (event)
+    {
+    case TCP_EVENT_CONNECTED:
+    case TCP_EVENT_WRITABLE:
+        sendMqttPayload();
+        break;
+    case TCP_EVENT_READABLE:
+        processMqttMessage(tcb);
+        break;
+    case TCP_EVENT_CLOSED:
+        // the broker hung up, finish our half before starting over
+        tcpClose(tcb);
+        mqttConnectionLost(tcb);
+        break;
+    case TCP_EVENT_LOST:
+        mqttConnectionLost(tcb);
+        break;
+    default:
+        break;
+    }
+}
+
+// the broker connection was reset, closed by the peer or stopped answering
+// losing the broker unexpectedly starts a new session with the same
+// subscriptions once reconnectDelay has passed, see retryMqttMsgResend
+void mqttConnectionLost(tcpControlBlock* tcb)
+{
+    if (tcb != getMqttConnection())
+    {
+        return;
+    }
+    clientState.localPort = 0;
+    outQueue.length = 0; // a partly written packet died with the connection
+    publishStream.active = false;
+    rxSkip = 0;
+    mqttInflightLost();
+    stopTimer(mqttKeepaliveTick);
+    setPinValue(BLUE_LED, 0);
+    pingLed = false;
+    stopTimer(mqttInflightTick);
+    stopTimer(mqttReplayTick);
+    if (clientState.connectionState != MQTT_DISCONNECTED)
+    {
+        // publishes go to flash until the next CONNACK
+        clientState.connectionState = MQTT_CONNECTING;
+        startOneshotTimer(retryMqttMsgResend, reconnectDelay);
+        if (reconnectDelay < MQTT_RECONNECT_MAX)
+            reconnectDelay *= 2;
+    }
+}
+
+void mqttDisconnect()
+{
+    fixedMqttHeader mqtt;
+    mqtt.packetType = MQTT_DISCONNECT;
+    mqtt.flags = 0;
+    mqtt.msglen = 0;
+    stopTimer(mqttKeepaliveTick);
+    setPinValue(BLUE_LED, 0);
+    pingLed = false;
+    stopTimer(retryMqttMsgResend);
+    stopTimer(mqttInflightTick);
+    stopTimer(mqttReplayTick);
+    clientState.connectionState = MQTT_DISCONNECTED;
+    tcpControlBlock* tcb = getMqttConnection();
+    if (tcb != NULL && publishStream.active)
+    {
+        // a DISCONNECT now would land inside the payload
+        tcpAbortConnection(tcb);
+    }
+    else if (tcb != NULL)
+    {
+        // the broker expects the client to close the connection after DISCONNECT
+        mqttQueuePacket((uint8_t*) &mqtt, sizeof(mqtt), true);
+        sendMqttPayload();
+        tcpClose(tcb);
+    }
+}
+
+void mqttPing()
+{
+    fixedMqttHeader mqtt;
+    mqtt.packetType = MQTT_PINGREQ;
+    mqtt.flags = 0;
+    mqtt.msglen = 0;
+    // a streamed publish keeps the broker busy enough, the next ping will do
+    if (publishStream.active)
+    {
+        return;
+    }
+    if (mqttQueuePacket((uint8_t*) &mqtt, sizeof(mqtt), true))
+    {
+        pingTimeout = MQTT_PING_TIMEOUT;
+    }
+    sendMqttPayload();
+}
+
+// once a second, pings a broker that has heard nothing from us for the keepalive
+// time and drops the connection if a PINGREQ goes unanswered, the lost connection
+// is started over by mqttConnectionLost
+void mqttKeepaliveTick()
+{
+    tcpControlBlock* tcb = getMqttConnection();
+    if (pingLed)
+    {
+        setPinValue(BLUE_LED, 0);
+        pingLed = false;
+    }
+    if (pingTimeout > 0 && --pingTimeout == 0)
+    {
+        if (tcb != NULL)
+            tcpAbortConnection(tcb);
+        return;
+    }
+    if (sendIdle < MQTT_KEEPALIVE)
+        sendIdle++;
+    if (sendIdle >= MQTT_KEEPALIVE && pingTimeout == 0)
+    {
+        mqttPing();
+    }
+}
+
+// writes a SUBSCRIBE for topicFilter with the current qos to buffer
+// returns its size, 0 if it does not fit MQTT_MAX_MSGSIZE
+uint16_t mqttBuildSubscribe(uint8_t* buffer, char* topicFilter, uint16_t topicNameLen,
+                            uint16_t packetId)
+{
+    mqttFrameSubscribe subs;
+    subs.packetIdentifier = htons(packetId);
+    subs.topicnamelen = htons(topicNameLen);
+    uint8_t propBuff[1];
+    uint8_t propSize = mqttWriteProperties(propBuff, NULL, 0);
+
+    uint32_t msglen = sizeof(mqttFrameSubscribe) + propSize + topicNameLen + 1; //1 for qos field
+    if (MQTT_MAX_FIXED_HEADER + msglen > MQTT_MAX_MSGSIZE)
+    {
+        return 0;
+    }
+
+    uint16_t len = 0;
+    //add stuff to message buffer
+    len += mqttWriteFixedHeader(&buffer[len], MQTT_SUBSCRIBE, 0x02, msglen);
+    len += appendToPayload(&buffer[len], &subs.packetIdentifier, sizeof(subs.packetIdentifier));
+    len += appendToPayload(&buffer[len], propBuff, propSize);
+    len += appendToPayload(&buffer[len], &subs.topicnamelen, sizeof(subs.topicnamelen));
+    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
+    len += appendToPayload(&buffer[len], topicFilter, topicNameLen);
+    len += appendToPayload(&buffer[len], &clientState.qos, 1);
+    return len;
+}
+
+void mqttSubscribe(char* topicFilter, uint16_t topicNameLen)
+{
+    uint16_t topicId = getNewGuid();
+    if (topicId == MQTT_NO_TOPIC_ID)
+    {
+        return;
+    }
+
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+    uint16_t len = mqttBuildSubscribe(buff, topicFilter, topicNameLen, topicId);
+    if (len == 0 || mqttQueueFree() < len)
+    {
+        mqttReleasePacketId(topicId);
+        return;
+    }
+
+    if (!storeSubscribedTopic(topicFilter, topicId))
+    {
+        mqttReleasePacketId(topicId); // no room to track it, so do not ask for it
+        return;
+    }
+    mqttQueuePacket(buff, len, true);
+    sendMqttPayload();
+
+}
+
+// the broker starts a clean session without subscriptions, so the ones kept
+// across a lost connection are sent again, each with a new packet id
+// as many go as packet ids and the queue allow, sendMqttPayload picks up the
+// rest once SUBACKs give ids back
+void mqttResubscribe()
+{
+    uint8_t node;
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+    char topicFilter[MQTT_MAX_MSGSIZE];
+    uint16_t topicNameLen;
+    uint16_t packetId;
+    uint16_t len;
+    while (resubscribing)
+    {
+        node = mqttNextSubscription(resubscribeNode);
+        if (node == MQTT_NO_NODE)
+        {
+            resubscribing = false;
+            break;
+        }
+        packetId = getNewGuid();
+        if (packetId == MQTT_NO_TOPIC_ID)
+        {
+            return;
+        }
+        topicNameLen = mqttGetTopicName(node, topicFilter, sizeof(topicFilter));
+        len = mqttBuildSubscribe(buff, topicFilter, topicNameLen, packetId);
+        if (len > 0 && !mqttQueuePacket(buff, len, true))
+        {
+            mqttReleasePacketId(packetId);
+            return;
+        }
+        // a filter too long for a SUBSCRIBE never fits, it is passed over
+        if (len == 0)
+            mqttReleasePacketId(packetId);
+        else
+            topicNodes[node].topicId = packetId;
+        resubscribeNode = node;
+    }
+}
+
+void mqttUnsubscribe(char* topicFilter, uint16_t topicNameLen)
+{
+    mqttFrameUnsubscribe unsubs;
+    uint16_t topicId = getTopicIdByName(topicFilter);
+    // the id of the SUBSCRIBE was given back with its SUBACK
+    uint16_t packetId = getNewGuid();
+    if (packetId == MQTT_NO_TOPIC_ID)
+    {
+        return;
+    }
+
+    unsubs.packetIdentifier = htons(packetId);
+    unsubs.topicnamelen = htons(topicNameLen);
+    uint8_t propBuff[1];
+    uint8_t propSize = mqttWriteProperties(propBuff, NULL, 0);
+
+    uint32_t msglen = sizeof(mqttFrameUnsubscribe) + propSize + topicNameLen; //1 for qos fiel
+    if (MQTT_MAX_FIXED_HEADER + msglen > MQTT_MAX_MSGSIZE)
+    {
+        mqttReleasePacketId(packetId);
+        return;
+    }
+
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+    uint16_t len = 0;
+    //add stuff to message buffer
+    len += mqttWriteFixedHeader(&buff[len], MQTT_UNSUBSCRIBE, 0x02, msglen);
+    len += appendToPayload(&buff[len], &unsubs.packetIdentifier, sizeof(unsubs.packetIdentifier));
+    len += appendToPayload(&buff[len], propBuff, propSize);
+    len += appendToPayload(&buff[len], &unsubs.topicnamelen, sizeof(unsubs.topicnamelen));
+    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
+    len += appendToPayload(&buff[len], topicFilter, topicNameLen);
+    if (!mqttQueuePacket(buff, len, true))
+    {
+        mqttReleasePacketId(packetId);
+        return;
+    }
+
+    removeUnsubscribedTopic(topicFilter, topicId);
+
+    sendMqttPayload();
+}
+
+// without a broker the message is logged to flash and sent after the next CONNACK
+// returns false if it could be neither sent nor logged
+bool mqttPublish(char* topicFilter, uint16_t topicNameLen, char* topicValue,
+                 uint16_t topicValueLen)
+{
+    if (clientState.connectionState != MQTT_CONNECTED)
+    {
+        return mqttStorePublish(topicFilter, topicNameLen, topicValue, topicValueLen);
+    }
+    return mqttSendPublish(topicFilter, topicNameLen, topicValue, topicValueLen);
+}
+
+// qos 0 goes straight into the queue, qos 1 and 2 take a slot in the in-flight
+// window and are sent again until the broker acknowledges them
+// with mqtt 5 a topic sent once goes as a 2 byte alias after that
+// returns false if the message is too large, the queue or the window is full
+bool mqttSendPublish(char* topicFilter, uint16_t topicNameLen, char* topicValue,
+                     uint16_t topicValueLen)
+{
+    uint8_t i;
+    mqttInflightMessage* slot = NULL;
+    uint8_t alias = mqttFindTopicAlias(topicFilter, topicNameLen);
+    uint16_t sentNameLen = topicNameLen;
+    // larger messages go through mqttPublishBegin instead, the topic in full has to
+    // fit too as that is how a message is resent on a new connection
+    if (!mqttPublishFits(topicNameLen, topicValueLen, 0))
+    {
+        return false;
+    }
+    if (alias != 0 && !mqttPublishFits(topicNameLen, topicValueLen, alias))
+    {
+        alias = 0;
+    }
+    // once the broker has the alias the topic is left out
+    if (mqttIsTopicAliasKnown(alias, topicFilter, topicNameLen))
+    {
+        sentNameLen = 0;
+    }
+
+    if (clientState.qos == 0)
+    {
+        uint8_t buff[MQTT_MAX_MSGSIZE];
+        // publishes go without PUSH so tcp may coalesce them
+        if (!mqttQueuePacket(buff, mqttBuildPublish(buff, topicFilter, sentNameLen,
+                                                    (uint8_t*) topicValue, topicValueLen, 0,
+                                                    alias),
+                             false))
+        {
+            return false;
+        }
+        mqttUseTopicAlias(alias, topicFilter, topicNameLen);
+        sendMqttPayload();
+        return true;
+    }
+
+    i = mqttFreeInflightSlot();
+    if (i == MQTT_MAX_INFLIGHT)
+    {
+        return false;
+    }
+    slot = &inflight[i];
+    if ((slot->packetId = getNewGuid()) == MQTT_NO_TOPIC_ID)
+    {
+        return false;
+    }
+    slot->len = mqttBuildPublish(slot->buff, topicFilter, sentNameLen,
+                                 (uint8_t*) topicValue, topicValueLen, slot->packetId, alias);
+    slot->alias = alias;
+    mqttUseTopicAlias(alias, topicFilter, topicNameLen);
+    slot->state = clientState.qos == 1 ? MQTT_INFLIGHT_PUBACK : MQTT_INFLIGHT_PUBREC;
+    slot->order = inflightOrder++;
+    slot->queued = true;
+    sendMqttPayload();
+    return true;
+}
+
+// writes a whole PUBLISH with the current qos to buffer, packetId is left out for qos 0
+// a topicNameLen of 0 relies on the broker knowing the alias
+// returns its size
+uint16_t mqttBuildPublish(uint8_t* buffer, char* topicName, uint16_t topicNameLen,
+                          uint8_t* payload, uint16_t payloadLen, uint16_t packetId,
+                          uint8_t alias)
+{
+    uint16_t len = 0;
+    uint16_t tmp16;
+    uint8_t properties[3];
+    uint8_t propertiesLen = 0;
+    len += mqttWriteFixedHeader(&buffer[len], MQTT_PUBLISH, clientState.qos << 1,
+                                mqttPublishLength(topicNameLen, payloadLen, alias));
+    tmp16 = htons(topicNameLen);
+    len += appendToPayload(&buffer[len], (uint8_t*) &tmp16, sizeof(tmp16));
+    //adding string data. no pointer for str types in the header as it makes calculating the size of payload difficult
+    len += appendToPayload(&buffer[len], (uint8_t*) topicName, topicNameLen);
+    if (clientState.qos > 0)
+    {
+        tmp16 = htons(packetId);
+        len += appendToPayload(&buffer[len], (uint8_t*) &tmp16, sizeof(tmp16));
+    }
+    if (alias != 0)
+        propertiesLen += mqttWriteProperty(properties, MQTT_PROP_TOPIC_ALIAS, alias, 2);
+    len += mqttWriteProperties(&buffer[len], properties, propertiesLen);
+    len += appendToPayload(&buffer[len], payload, payloadLen);
+    return len;
+}
+
+// whether a publish fits the buffers here and the broker's Maximum Packet Size
+bool mqttPublishFits(uint16_t topicNameLen, uint32_t payloadLen, uint8_t alias)
+{
+    uint32_t msglen = mqttPublishLength(topicNameLen, payloadLen, alias);
+    return MQTT_MAX_FIXED_HEADER + msglen <= MQTT_MAX_MSGSIZE && mqttFitsBroker(msglen);
+}
+
+// whether a packet with this remaining length is within the broker's Maximum Packet Size
+bool mqttFitsBroker(uint32_t msglen)
+{
+    uint8_t length[4];
+    return clientState.brokerMaximumPacketSize == 0
+            || 1 + mqttEncodeRemainingLength(length, msglen) + msglen
+                    <= clientState.brokerMaximumPacketSize;
+}
+
+// a record is the topic length, the topic and the payload
+bool mqttStorePublish(char* topicName, uint16_t topicNameLen, char* payload,
+                      uint16_t payloadLen)
+{
+    uint8_t record[FLASH_LOG_MAX_RECORD];
+    if (topicNameLen > 255 || 1 + topicNameLen + payloadLen > FLASH_LOG_MAX_RECORD
+            || MQTT_MAX_FIXED_HEADER + mqttPublishLength(topicNameLen, payloadLen, 0) > MQTT_MAX_MSGSIZE)
+    {
+        return false;
+    }
+    record[0] = topicNameLen;
+    memcpy(&record[1], topicName, topicNameLen);
+    memcpy(&record[1 + topicNameLen], payload, payloadLen);
+    return flashLogAppend(record, 1 + topicNameLen + payloadLen);
+}
+
+// sends the oldest logged publish with the current qos, it leaves the log once the
+// queue or the in-flight window has taken it, which keeps it across a lost connection
+void mqttReplayTick()
+{
+    flashLogRecord record;
+    uint8_t data[FLASH_LOG_MAX_RECORD];
+    uint16_t len;
+    if (clientState.connectionState != MQTT_CONNECTED || !flashLogPeek(&record))
+    {
+        stopTimer(mqttReplayTick);
+        return;
+    }
+    len = flashLogRead(&record, data, sizeof(data));
+    // a full queue or window leaves it for the next tick, one that cannot be read
+    // or can never go out to this broker is dropped
+    if (len == 0 || 1 + data[0] > len || !mqttPublishFits(data[0], len - 1 - data[0], 0)
+            || mqttSendPublish((char*) &data[1], data[0], (char*) &data[1 + data[0]],
+                               len - 1 - data[0]))
+    {
+        flashLogConsume(&record);
+    }
+}
+
+void mqttSetReplayRate(uint8_t messagesPerSecond)
+{
+    if (messagesPerSecond == 0)
+        messagesPerSecond = 1;
+    if (messagesPerSecond > TIMER_TICKS_PER_SECOND)
+        messagesPerSecond = TIMER_TICKS_PER_SECOND;
+    replayRate = messagesPerSecond;
+    if (clientState.connectionState == MQTT_CONNECTED && flashLogDepth() > 0)
+    {
+        startPeriodicTimerTicks(mqttReplayTick, TIMER_TICKS_PER_SECOND / replayRate);
+    }
+}
+
+// publishes logged and not yet sent
+uint32_t mqttBacklogDepth()
+{
+    return flashLogDepth();
+}
+
+// when the oldest unsent publish was logged, in flashLogTime seconds, 0 without a backlog
+uint32_t mqttBacklogOldest()
+{
+    return flashLogOldest();
+}
+
+void retryMqttMsgResend()
+{
+    uint8_t brokerIP[IP_ADD_LENGTH];
+    uint8_t brokerMac[HW_ADD_LENGTH];
+    // the broker was lost or there was no free connection slot, start over
+    if (clientState.connectionState != MQTT_DISCONNECTED && getMqttConnection() == NULL)
+    {
+        memcpy(brokerIP, clientState.brokerIP, IP_ADD_LENGTH);
+        memcpy(brokerMac, clientState.brokerMac, HW_ADD_LENGTH);
+        mqttSendConnect(brokerIP, brokerMac, clientState.qos);
+        return;
+    }
+    sendMqttPayload();
+}
+
+void sendMqttPayload()
+{
+    // publishes wait for the CONNACK, they may be left over from the last connection
+    if (clientState.connectionState == MQTT_CONNECTED)
+    {
+        if (resubscribing)
+            mqttResubscribe();
+        mqttSendInflight();
+    }
+    mqttDrainQueue();
+}
+
+// adds a whole packet to the outbound queue, push asks for it to be sent without
+// waiting to be coalesced with more
+// returns false if the queue has no room for it, nothing is queued then
+bool mqttQueuePacket(uint8_t* packet, uint16_t len, bool push)
+{
+    uint16_t i;
+    uint16_t tail = (outQueue.head + outQueue.length) % MQTT_QUEUE_SIZE;
+    if (mqttQueueFree() < len)
+    {
+        return false;
+    }
+    for (i = 0; i < len; i++)
+    {
+        outQueue.buff[tail] = packet[i];
+        tail = (tail + 1) % MQTT_QUEUE_SIZE;
+    }
+    outQueue.length += len;
+    outQueue.push |= push;
+    return true;
+}
+
+uint16_t mqttQueueFree()
+{
+    return MQTT_QUEUE_SIZE - outQueue.length;
+}
+
+// hands the queue to tcp in as few writes as the ring allows, so the packets
+// that gathered since the last send share segments, tcp takes what fits and the
+// rest follows on TCP_EVENT_WRITABLE
+void mqttDrainQueue()
+{
+    uint16_t size;
+    uint16_t taken;
+    tcpControlBlock* tcb = getMqttConnection();
+    // nothing may cut into a streamed publish
+    if (publishStream.active || getTcpConnectionState(tcb) != ESTABLISHED)
+    {
+        return;
+    }
+    while (outQueue.length > 0)
+    {
+        size = outQueue.length;
+        if (outQueue.head + size > MQTT_QUEUE_SIZE)
+            size = MQTT_QUEUE_SIZE - outQueue.head;
+        taken = tcpWrite(tcb, &outQueue.buff[outQueue.head], size);
+        if (taken > 0)
+            sendIdle = 0;
+        outQueue.head = (outQueue.head + taken) % MQTT_QUEUE_SIZE;
+        outQueue.length -= taken;
+        if (taken < size)
+        {
+            return;
+        }
+    }
+    if (outQueue.push)
+    {
+        outQueue.push = false;
+        tcpFlush(tcb);
+    }
+}
+
+// moves in-flight messages due to be sent into the queue, in the order they were
+// made, a message that does not fit waits for the queue to drain
+void mqttSendInflight()
+{
+    uint8_t i;
+    mqttInflightMessage* next;
+    while (true)
+    {
+        next = NULL;
+        for (i = 0; i < MQTT_MAX_INFLIGHT; i++)
+        {
+            if (inflight[i].state != MQTT_INFLIGHT_FREE && inflight[i].queued
+                    && (next == NULL || (int16_t) (inflight[i].order - next->order) < 0))
+                next = &inflight[i];
+        }
+        if (next == NULL || !mqttQueuePacket(next->buff, next->len, false))
+        {
+            return;
+        }
+        next->queued = false;
+        next->timeout = MQTT_RETRY_TIME;
+    }
+}
+
+// PUBACK and PUBCOMP finish a message, PUBREC turns it into a PUBREL
+void mqttInflightAck(uint8_t packetType, uint16_t packetId)
+{
+    uint8_t i;
+    mqttInflightMessage* slot = NULL;
+    for (i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        if (inflight[i].state != MQTT_INFLIGHT_FREE && inflight[i].packetId == packetId)
+            slot = &inflight[i];
+    }
+    if (slot == NULL)
+    {
+        // a late duplicate, the PUBREL still has to answer it
+        if (packetType == MQTT_PUBREC)
+            mqttSendAck(MQTT_PUBREL, packetId);
+        return;
+    }
+    if (packetType == MQTT_PUBREC && slot->state != MQTT_INFLIGHT_PUBACK)
+    {
+        slot->len = mqttWriteFixedHeader(slot->buff, MQTT_PUBREL, 0x02, 2);
+        slot->buff[slot->len++] = packetId >> 8;
+        slot->buff[slot->len++] = packetId & 0xFF;
+        slot->state = MQTT_INFLIGHT_PUBCOMP;
+        slot->alias = 0;
+        slot->queued = true;
+        sendMqttPayload();
+    }
+    else if ((packetType == MQTT_PUBACK && slot->state == MQTT_INFLIGHT_PUBACK)
+            || (packetType == MQTT_PUBCOMP && slot->state == MQTT_INFLIGHT_PUBCOMP))
+    {
+        slot->state = MQTT_INFLIGHT_FREE;
+        mqttReleasePacketId(packetId);
+    }
+}
+
+// once a second, messages the broker has not acknowledged in MQTT_RETRY_TIME are
+// queued again, a PUBLISH with DUP set
+// mqtt 5 only allows that on a new connection [MQTT-4.4.0-1], see mqttInflightLost
+void mqttInflightTick()
+{
+    uint8_t i;
+    if (clientState.version == MQTT_VERSION_5)
+    {
+        return;
+    }
+    for (i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        if (inflight[i].state == MQTT_INFLIGHT_FREE || inflight[i].queued
+                || inflight[i].len == 0)
+        {
+            continue;
+        }
+        if (--inflight[i].timeout == 0)
+        {
+            if (inflight[i].state != MQTT_INFLIGHT_PUBCOMP)
+                inflight[i].buff[0] |= 0x08;
+            inflight[i].queued = true;
+        }
+    }
+    sendMqttPayload();
+}
+
+// everything not acknowledged goes out again on the next connection, streamed
+// publishes are lost and ids of subscribe requests are given back
+// topic aliases end with the connection, so the topics are put back in
+void mqttInflightLost()
+{
+    uint8_t i;
+    memset(packetIdsInUse, 0, sizeof(packetIdsInUse));
+    for (i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        if (inflight[i].state != MQTT_INFLIGHT_FREE && inflight[i].len == 0)
+        {
+            inflight[i].state = MQTT_INFLIGHT_FREE;
+        }
+        if (inflight[i].state != MQTT_INFLIGHT_FREE)
+        {
+            if (inflight[i].alias != 0)
+                mqttUnaliasPublish(i);
+            if (inflight[i].state != MQTT_INFLIGHT_PUBCOMP)
+                inflight[i].buff[0] |= 0x08;
+            inflight[i].queued = true;
+            packetIdsInUse[(inflight[i].packetId - 1) / 32] |= 1UL << ((inflight[i].packetId - 1) % 32);
+        }
+    }
+    memset(topicAliases, 0, sizeof(topicAliases));
+}
+
+// a free slot in the in-flight window, MQTT_MAX_INFLIGHT if there is none or the
+// broker's Receive Maximum is reached
+uint8_t mqttFreeInflightSlot()
+{
+    uint8_t i;
+    uint8_t slot = MQTT_MAX_INFLIGHT;
+    uint16_t busy = 0;
+    for (i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        if (inflight[i].state != MQTT_INFLIGHT_FREE)
+            busy++;
+        else if (slot == MQTT_MAX_INFLIGHT)
+            slot = i;
+    }
+    if (busy >= clientState.brokerReceiveMaximum)
+    {
+        return MQTT_MAX_INFLIGHT;
+    }
+    return slot;
+}
+
+// rewrites an in-flight PUBLISH that used an alias with the topic in full
+void mqttUnaliasPublish(uint8_t slot)
+{
+    mqttInflightMessage* msg = &inflight[slot];
+    mqttProperties properties;
+    uint8_t buff[MQTT_MAX_MSGSIZE];
+    uint8_t* data;
+    uint8_t* packetId;
+    char* topicName;
+    uint16_t topicNameLen;
+    uint32_t msglen;
+    uint32_t payloadLen;
+    uint16_t used;
+    uint16_t len = 0;
+
+    data = &msg->buff[1 + mqttDecodeRemainingLength(&msg->buff[1], MQTT_MAX_FIXED_HEADER - 1,
+                                                    &msglen)];
+    // the message that told the broker about the alias still has the topic
+    topicNameLen = (data[0] << 8) | data[1];
+    topicName = (char*) &data[2];
+    packetId = &data[2 + topicNameLen];
+    used = 2 + topicNameLen + 2;
+    if (topicNameLen == 0)
+    {
+        topicNameLen = topicAliases[msg->alias - 1].nameLen;
+        topicName = topicAliases[msg->alias - 1].name;
+    }
+    used += mqttDecodeProperties(&data[used], msglen - used, &properties);
+    payloadLen = msglen - used;
+
+    len += mqttWriteFixedHeader(&buff[len], MQTT_PUBLISH, msg->buff[0] & 0xF,
+                                2 + topicNameLen + 2 + 1 + payloadLen);
+    buff[len++] = topicNameLen >> 8;
+    buff[len++] = topicNameLen & 0xFF;
+    len += appendToPayload(&buff[len], (uint8_t*) topicName, topicNameLen);
+    len += appendToPayload(&buff[len], packetId, 2);
+    len += mqttWriteProperties(&buff[len], NULL, 0);
+    len += appendToPayload(&buff[len], &data[used], payloadLen);
+    memcpy(msg->buff, buff, len);
+    msg->len = len;
+    msg->alias = 0;
+}
+
+// qos 2 ids are held until PUBREL, qos 1 ids only catch resends that have DUP set
+bool mqttIsDuplicate(mqttPublishMessage* msg)
+{
+    uint8_t i;
+    for (i = 0; i < MQTT_MAX_INBOUND_IDS; i++)
+    {
+        if (msg->qos == 2 && inboundQos2[i] == msg->packetId)
+            return true;
+        if (msg->qos == 1 && msg->dup && recentQos1[i] == msg->packetId)
+            return true;
+    }
+    return false;
+}
+
+void mqttRememberInbound(mqttPublishMessage* msg)
+{
+    uint8_t i;
+    if (msg->qos == 1)
+    {
+        recentQos1[recentQos1Next] = msg->packetId;
+        recentQos1Next = (recentQos1Next + 1) % MQTT_MAX_INBOUND_IDS;
+    }
+    else if (msg->qos == 2)
+    {
+        // the oldest entry goes if the broker has more outstanding than we track
+        for (i = 0; i < MQTT_MAX_INBOUND_IDS; i++)
+        {
+            if (inboundQos2[i] == 0)
+            {
+                inboundQos2[i] = msg->packetId;
+                return;
+            }
+        }
+        inboundQos2[inboundQos2Next] = msg->packetId;
+        inboundQos2Next = (inboundQos2Next + 1) % MQTT_MAX_INBOUND_IDS;
+    }
+}
+
+void mqttForgetInbound(uint16_t packetId)
+{
+    uint8_t i;
+    for (i = 0; i < MQTT_MAX_INBOUND_IDS; i++)
+    {
+        if (inboundQos2[i] == packetId)
+            inboundQos2[i] = 0;
+    }
+}
+
+// handles every complete mqtt packet waiting in the connection's receive stream
+void processMqttMessage(tcpControlBlock* tcb)
+{
+    uint8_t message[MQTT_MAX_RX_MSGSIZE];
+    fixedMqttHeader* mqttFxHdr = (fixedMqttHeader*) message;
+    mqttPublishMessage publish;
+    mqttProperties properties;
+    uint32_t size;
+    uint32_t msglen;
+    uint16_t available;
+    uint8_t headerLen;
+
+    while (tcpReceivedLength(tcb) > 0)
+    {
+        // the rest of a packet too large for us, it can be bigger than the receive window
+        if (rxSkip > 0)
+        {
+            available = tcpReceivedLength(tcb);
+            if (available > rxSkip)
+                available = rxSkip;
+            tcpReleaseReceived(tcb, available);
+            rxSkip -= available;
+            continue;
+        }
+        available = tcpReceivedLength(tcb);
+        if (available > MQTT_MAX_FIXED_HEADER)
+            available = MQTT_MAX_FIXED_HEADER;
+        tcpPeekReceived(tcb, 0, message, available);
+        headerLen = mqttDecodeRemainingLength(&message[1], available - 1, &msglen);
+        if (headerLen == 0)
+        {
+            if (available < MQTT_MAX_FIXED_HEADER)
+                break; // rest of the length is still on its way
+            tcpAbortConnection(tcb); // no valid length in 4 bytes, the stream is lost
+            break;
+        }
+        size = 1 + headerLen + msglen;
+        if (size > MQTT_MAX_RX_MSGSIZE)
+        {
+            rxSkip = size; // too large for us, skip it
+            continue;
+        }
+        if (tcpReceivedLength(tcb) < size)
+        {
+            break; // rest of the packet is still on its way
+        }
+        tcpPeekReceived(tcb, 0, message, size);
+        tcpReleaseReceived(tcb, size);
+        // any packet shows the broker is still there, not just a PINGRESP
+        pingTimeout = 0;
+
+        switch (mqttFxHdr->packetType)
+        {
+        case MQTT_CONNACK:
+            // mqtt 5 has the broker's limits after the flags and the reason code
+            if (clientState.version == MQTT_VERSION_5 && msglen > 2
+                    && mqttDecodeProperties(&message[1 + headerLen + 2], msglen - 2,
+                                            &properties) > 0)
+            {
+                if (properties.receiveMaximum > 0)
+                    clientState.brokerReceiveMaximum = properties.receiveMaximum;
+                clientState.brokerMaximumPacketSize = properties.maximumPacketSize;
+                clientState.brokerTopicAliasMaximum = properties.topicAliasMaximum;
+            }
+            memset(topicAliases, 0, sizeof(topicAliases));
+            sendIdle = 0;
+            pingTimeout = 0;
+            reconnectDelay = MQTT_RECONNECT_MIN;
+            startPeriodicTimer(mqttKeepaliveTick, 1);
+            startPeriodicTimer(mqttInflightTick, 1);
+            clientState.connectionState = MQTT_CONNECTED;
+            // a clean session, the broker reuses its packet ids
+            memset(inboundQos2, 0, sizeof(inboundQos2));
+            memset(recentQos1, 0, sizeof(recentQos1));
+            resubscribing = true;
+            resubscribeNode = MQTT_NO_NODE;
+            if (flashLogDepth() > 0)
+            {
+                startPeriodicTimerTicks(mqttReplayTick, TIMER_TICKS_PER_SECOND / replayRate);
+            }
+            sendMqttPayload();
+            break;
+        case MQTT_PINGRESP:
+            setPinValue(BLUE_LED, 1);
+            pingLed = true;
+            break;
+        case MQTT_PUBLISH:
+            // a malformed PUBLISH is a protocol error, the connection is closed
+            if (!mqttParsePublish(message, headerLen, msglen, &publish))
+            {
+                tcpAbortConnection(tcb);
+                return;
+            }
+            // qos 2 is handed over on the PUBLISH and its id held until PUBREL
+            if (!mqttIsDuplicate(&publish))
+            {
+                mqttDispatchPublish(&publish);
+                mqttRememberInbound(&publish);
+            }
+            if (publish.qos == 1)
+                mqttSendAck(MQTT_PUBACK, publish.packetId);
+            else if (publish.qos == 2)
+                mqttSendAck(MQTT_PUBREC, publish.packetId);
+            break;
+        // mqtt 5 may add a reason code and properties after the packet identifier
+        case MQTT_PUBREL:
+            if (msglen >= 2)
+            {
+                mqttForgetInbound((message[2] << 8) | message[3]);
+                mqttSendAck(MQTT_PUBCOMP, (message[2] << 8) | message[3]);
+            }
+            break;
+        case MQTT_PUBACK:
+        case MQTT_PUBREC:
+        case MQTT_PUBCOMP:
+            if (msglen >= 2)
+                mqttInflightAck(mqttFxHdr->packetType, (message[2] << 8) | message[3]);
+            break;
+        case MQTT_SUBACK:
+        case MQTT_UNSUBACK:
+            if (msglen >= 2)
+                mqttReleasePacketId((message[2] << 8) | message[3]);
+            if (resubscribing)
+                sendMqttPayload();
+            break;
+        default:
+            break;
+        }
+    }
+    return;
+}
+
+// writes length as an mqtt remaining length, 7 bits per byte least significant
+// first with the top bit set while more follow
+// returns the number of bytes used, 1 to 4
+uint8_t mqttEncodeRemainingLength(uint8_t* buffer, uint32_t length)
+{
+    uint8_t count = 0;
+    do
+    {
+        buffer[count] = length & 0x7F;
+        length >>= 7;
+        if (length > 0)
+            buffer[count] |= 0x80;
+        count++;
+    } while (length > 0 && count < 4);
+    return count;
+}
+
+// reads a remaining length from the size bytes at buffer
+// returns the number of bytes it took, 0 if it is incomplete or longer than 4 bytes
+uint8_t mqttDecodeRemainingLength(uint8_t* buffer, uint8_t size, uint32_t* length)
+{
+    uint8_t count = 0;
+    *length = 0;
+    while (count < size && count < 4)
+    {
+        *length |= (uint32_t) (buffer[count] & 0x7F) << (7 * count);
+        if ((buffer[count++] & 0x80) == 0)
+            return count;
+    }
+    return 0;
+}
+
+// packet type and flags followed by the remaining length
+// returns the header size, at most MQTT_MAX_FIXED_HEADER
+uint8_t mqttWriteFixedHeader(uint8_t* buffer, uint8_t packetType, uint8_t flags,
+                             uint32_t length)
+{
+    buffer[0] = (packetType << 4) | (flags & 0xF);
+    return 1 + mqttEncodeRemainingLength(&buffer[1], length);
+}
+
+// remaining length of a publish, the packet identifier only goes with qos 1 and 2
+// and mqtt 5 adds the properties, an alias is one of them
+uint32_t mqttPublishLength(uint16_t topicNameLen, uint32_t payloadLen, uint8_t alias)
+{
+    uint32_t length = 2 + topicNameLen + payloadLen;
+    if (clientState.qos > 0)
+        length += 2;
+    if (clientState.version == MQTT_VERSION_5)
+        length += alias != 0 ? 4 : 1;
+    return length;
+}
+
+// starts a publish of payloadLen bytes that follow through mqttPublishWrite, so a
+// payload of several kilobytes needs no buffer of its own here
+// with qos 1 and 2 it takes a slot in the in-flight window but cannot be resent
+// returns false if the broker is not connected, another message is still going
+// out, the window is full or tcp has no room for the header yet
+bool mqttPublishBegin(char* topicName, uint16_t topicNameLen, uint32_t payloadLen)
+{
+    uint8_t header[MQTT_MAX_FIXED_HEADER + 4];
+    uint8_t properties[1];
+    uint8_t propertiesLen = mqttWriteProperties(properties, NULL, 0);
+    uint16_t len = 0;
+    uint16_t tmp16;
+    uint8_t i;
+    mqttInflightMessage* slot = NULL;
+    uint32_t msglen = mqttPublishLength(topicNameLen, payloadLen, 0);
+    tcpControlBlock* tcb = getMqttConnection();
+
+    if (clientState.connectionState != MQTT_CONNECTED || publishStream.active
+            || outQueue.length > 0
+            || msglen > MQTT_MAX_REMAINING_LENGTH || !mqttFitsBroker(msglen))
+    {
+        return false;
+    }
+    if (clientState.qos > 0 && (i = mqttFreeInflightSlot()) < MQTT_MAX_INFLIGHT)
+    {
+        slot = &inflight[i];
+    }
+    // the header goes in one piece, it is small
+    if ((clientState.qos > 0 && slot == NULL)
+            || tcpWriteSpace(tcb) < MQTT_MAX_FIXED_HEADER + 2 + topicNameLen + 2 + propertiesLen)
+    {
+        return false;
+    }
+    if (slot != NULL && (slot->packetId = getNewGuid()) == MQTT_NO_TOPIC_ID)
+    {
+        return false;
+    }
+    len += mqttWriteFixedHeader(&header[len], MQTT_PUBLISH, clientState.qos << 1, msglen);
+    tmp16 = htons(topicNameLen);
+    len += appendToPayload(&header[len], (uint8_t*) &tmp16, sizeof(tmp16));
+    tcpWrite(tcb, header, len);
+    tcpWrite(tcb, (uint8_t*) topicName, topicNameLen);
+    if (clientState.qos > 0)
+    {
+        slot->state = clientState.qos == 1 ? MQTT_INFLIGHT_PUBACK : MQTT_INFLIGHT_PUBREC;
+        slot->order = inflightOrder++;
+        slot->queued = false;
+        slot->len = 0;
+        slot->alias = 0;
+        tmp16 = htons(slot->packetId);
+        tcpWrite(tcb, (uint8_t*) &tmp16, sizeof(tmp16));
+    }
+    tcpWrite(tcb, properties, propertiesLen);
+    publishStream.active = true;
+    publishStream.remaining = payloadLen;
+    sendIdle = 0;
+    return true;
+}
+
+// hands the next part of the payload to tcp
+// returns the number of bytes taken, on a short count try again later
+uint16_t mqttPublishWrite(uint8_t* data, uint16_t size)
+{
+    uint16_t taken;
+    if (!publishStream.active)
+    {
+        return 0;
+    }
+    if (size > publishStream.remaining)
+        size = publishStream.remaining;
+    taken = tcpWrite(getMqttConnection(), data, size);
+    if (taken > 0)
+        sendIdle = 0;
+    publishStream.remaining -= taken;
+    return taken;
+}
+
+// finishes a streamed publish once the whole payload has been written
+// returns false while payload bytes are still missing
+bool mqttPublishEnd()
+{
+    if (!publishStream.active || publishStream.remaining > 0)
+    {
+        return false;
+    }
+    publishStream.active = false;
+    tcpFlush(getMqttConnection());
+    sendMqttPayload();
+    return true;
+}
+
+// fills msg from the PUBLISH in message, nothing is copied
+// returns false if the lengths inside do not add up
+bool mqttParsePublish(uint8_t* message, uint8_t headerLen, uint32_t msglen,
+                      mqttPublishMessage* msg)
+{
+    uint8_t* data = &message[1 + headerLen];
+    uint32_t used;
+    uint32_t propertiesLen;
+    mqttProperties properties;
+
+    msg->qos = (message[0] >> 1) & 3;
+    msg->retain = (message[0] & 1) > 0;
+    msg->dup = (message[0] & 8) > 0;
+    if (msglen < 2 || msg->qos == 3)
+    {
+        return false;
+    }
+    msg->topicLen = (data[0] << 8) | data[1];
+    msg->topic = (char*) &data[2];
+    // the topic must lie within the msglen bytes received
+    if (msg->topicLen > msglen - 2)
+    {
+        return false;
+    }
+    used = 2 + msg->topicLen;
+    msg->packetId = 0;
+    if (msg->qos > 0)
+    {
+        if (msglen < used + 2)
+        {
+            return false;
+        }
+        msg->packetId = (data[used] << 8) | data[used + 1];
+        used += 2;
+        // 0 is not a packet identifier, mqtt 3.1.1 2.3.1
+        if (msg->packetId == 0)
+        {
+            return false;
+        }
+    }
+    if (msglen < used)
+    {
+        return false;
+    }
+    // no Topic Alias Maximum is sent in the CONNECT, so the topic is always there
+    if (clientState.version == MQTT_VERSION_5)
+    {
+        propertiesLen = mqttDecodeProperties(&data[used], msglen - used, &properties);
+        if (propertiesLen == 0 || msg->topicLen == 0)
+        {
+            return false;
+        }
+        used += propertiesLen;
+    }
+    msg->payload = &data[used];
+    msg->payloadLen = msglen - used;
+    return true;
+}
+
+// calls every handler whose filter matches the message's topic, handlers must not
+// change the registry while they run
+void mqttDispatchPublish(mqttPublishMessage* msg)
+{
+    mqttTopicMatch(MQTT_NO_NODE, msg->topic, msg->topicLen, msg);
+}
+
+// PUBACK, PUBREC, PUBREL and PUBCOMP only carry the packet identifier
+void mqttSendAck(uint8_t packetType, uint16_t packetId)
+{
+    uint8_t ack[4];
+    mqttWriteFixedHeader(ack, packetType, packetType == MQTT_PUBREL ? 0x02 : 0, 2);
+    ack[2] = packetId >> 8;
+    ack[3] = packetId & 0xFF;
+    // with no room the broker resends and we ack that
+    mqttQueuePacket(ack, sizeof(ack), true);
+    sendMqttPayload();
+}
+
+// routes PUBLISH messages matching topicFilter, which may hold + and #, to handler
+// replacing an earlier one for the same filter, a NULL handler removes it
+// returns false if the filter is invalid or there is no room for it
+bool mqttSetTopicHandler(char* topicFilter, mqttHandler handler)
+{
+    uint8_t i;
+    uint8_t node;
+    if (handler == NULL)
+    {
+        node = mqttTopicFind(topicFilter);
+        if (node != MQTT_NO_NODE && topicNodes[node].handler > 0)
+        {
+            topicHandlers[topicNodes[node].handler - 1] = NULL;
+            topicNodes[node].handler = 0;
+            mqttTopicPrune(node);
+        }
+        return true;
+    }
+    node = mqttTopicInsert(topicFilter);
+    if (node == MQTT_NO_NODE)
+    {
+        return false;
+    }
+    for (i = 0; i < MAX_TOPIC_HANDLERS && topicNodes[node].handler == 0; i++)
+    {
+        if (topicHandlers[i] == NULL)
+            topicNodes[node].handler = i + 1;
+    }
+    if (topicNodes[node].handler == 0)
+    {
+        mqttTopicPrune(node);
+        return false;
+    }
+    topicHandlers[topicNodes[node].handler - 1] = handler;
+    return true;
+}
+
+// + fills exactly one level and # the rest, both only as a whole level, see
+// mqtt 3.1.1 section 4.7
+bool mqttIsValidFilter(char* topicFilter)
+{
+    uint16_t i;
+    uint16_t len = strlen(topicFilter);
+    if (len == 0)
+    {
+        return false;
+    }
+    for (i = 0; i < len; i++)
+    {
+        if (topicFilter[i] != '+' && topicFilter[i] != '#')
+            continue;
+        if (i > 0 && topicFilter[i - 1] != '/')
+            return false;
+        if (topicFilter[i] == '#' && i + 1 != len)
+            return false;
+        if (topicFilter[i] == '+' && i + 1 != len && topicFilter[i + 1] != '/')
+            return false;
+    }
+    return true;
+}
+
+// returns the pool reference of the level name, adding it if it is new, or 0 if
+// the pool is full
+uint16_t mqttTopicIntern(char* name, uint16_t len)
+{
+    uint16_t offset = 0;
+    while (offset < levelPoolUsed)
+    {
+        if (strlen(&levelPool[offset]) == len && strncmp(&levelPool[offset], name, len) == 0)
+        {
+            return offset + 1;
+        }
+        offset += strlen(&levelPool[offset]) + 1;
+    }
+    if (levelPoolUsed + len + 1 > MQTT_LEVEL_POOL_SIZE)
+    {
+        return 0;
+    }
+    memcpy(&levelPool[offset], name, len);
+    levelPool[offset + len] = '\0';
+    levelPoolUsed += len + 1;
+    return offset + 1;
+}
+
+// drops the level name from the pool once no node uses it, later names move down
+void mqttTopicRelease(uint16_t level)
+{
+    uint8_t i;
+    uint16_t size;
+    for (i = 1; i < MQTT_MAX_TOPIC_NODES; i++)
+    {
+        if (topicNodes[i].level == level)
+            return;
+    }
+    size = strlen(&levelPool[level - 1]) + 1;
+    memmove(&levelPool[level - 1], &levelPool[level - 1 + size],
+            levelPoolUsed - (level - 1 + size));
+    levelPoolUsed -= size;
+    for (i = 1; i < MQTT_MAX_TOPIC_NODES; i++)
+    {
+        if (topicNodes[i].level > level)
+            topicNodes[i].level -= size;
+    }
+}
+
+uint8_t mqttTopicChild(uint8_t node, char* name, uint16_t len)
+{
+    uint8_t child = topicNodes[node].child;
+    while (child != MQTT_NO_NODE)
+    {
+        char* level = &levelPool[topicNodes[child].level - 1];
+        if (strlen(level) == len && strncmp(level, name, len) == 0)
+        {
+            return child;
+        }
+        child = topicNodes[child].sibling;
+    }
+    return MQTT_NO_NODE;
+}
+
+// returns the node of topicFilter, creating the missing levels, or MQTT_NO_NODE
+// if the filter is invalid or the trie is full
+uint8_t mqttTopicInsert(char* topicFilter)
+{
+    uint8_t node = MQTT_NO_NODE;
+    uint8_t child;
+    uint8_t i;
+    uint16_t len;
+    if (!mqttIsValidFilter(topicFilter))
+    {
+        return MQTT_NO_NODE;
+    }
+    while (true)
+    {
+        len = strcspn(topicFilter, "/");
+        child = mqttTopicChild(node, topicFilter, len);
+        if (child == MQTT_NO_NODE)
+        {
+            for (i = 1; i < MQTT_MAX_TOPIC_NODES && child == MQTT_NO_NODE; i++)
+            {
+                if (topicNodes[i].level == 0)
+                    child = i;
+            }
+            if (child == MQTT_NO_NODE
+                    || (topicNodes[child].level = mqttTopicIntern(topicFilter, len)) == 0)
+            {
+                mqttTopicPrune(node); // drop the levels added for this filter
+                return MQTT_NO_NODE;
+            }
+            topicNodes[child].topicId = MQTT_NO_TOPIC_ID;
+            topicNodes[child].handler = 0;
+            topicNodes[child].child = MQTT_NO_NODE;
+            topicNodes[child].parent = node;
+            topicNodes[child].sibling = topicNodes[node].child;
+            topicNodes[node].child = child;
+        }
+        node = child;
+        if (topicFilter[len] == '\0')
+        {
+            return node;
+        }
+        topicFilter += len + 1;
+    }
+}
+
+// exact lookup, + and # are taken literally
+uint8_t mqttTopicFind(char* topicFilter)
+{
+    uint8_t node = MQTT_NO_NODE;
+    uint16_t len;
+    while (true)
+    {
+        len = strcspn(topicFilter, "/");
+        node = mqttTopicChild(node, topicFilter, len);
+        if (node == MQTT_NO_NODE || topicFilter[len] == '\0')
+        {
+            return node;
+        }
+        topicFilter += len + 1;
+    }
+}
+
+// frees node and then its parents as long as nothing is left hanging off them
+void mqttTopicPrune(uint8_t node)
+{
+    uint8_t parent;
+    uint8_t* link;
+    uint16_t level;
+    while (node != MQTT_NO_NODE && topicNodes[node].topicId == MQTT_NO_TOPIC_ID
+            && topicNodes[node].handler == 0 && topicNodes[node].child == MQTT_NO_NODE)
+    {
+        parent = topicNodes[node].parent;
+        link = &topicNodes[parent].child;
+        while (*link != node)
+            link = &topicNodes[*link].sibling;
+        *link = topicNodes[node].sibling;
+        level = topicNodes[node].level;
+        topicNodes[node].level = 0;
+        mqttTopicRelease(level);
+        node = parent;
+    }
+}
+
+// walks the children of node that match the first level of topic, len bytes long
+// topics starting with $ are not matched by a leading wildcard
+void mqttTopicMatch(uint8_t node, char* topic, uint16_t len, mqttPublishMessage* msg)
+{
+    uint8_t child = topicNodes[node].child;
+    uint16_t levelLen = 0;
+    bool wildcards = node != MQTT_NO_NODE || len == 0 || topic[0] != '$';
+    char* level;
+    while (levelLen < len && topic[levelLen] != '/')
+        levelLen++;
+    for (; child != MQTT_NO_NODE; child = topicNodes[child].sibling)
+    {
+        level = &levelPool[topicNodes[child].level - 1];
+        if (strcmp(level, "#") == 0)
+        {
+            if (wildcards)
+                mqttTopicDeliver(child, msg);
+        }
+        else if ((strcmp(level, "+") == 0 && wildcards)
+                || (strlen(level) == levelLen && strncmp(level, topic, levelLen) == 0))
+        {
+            if (levelLen == len)
+            {
+                // a/# also covers a itself
+                mqttTopicDeliver(child, msg);
+                mqttTopicDeliver(mqttTopicChild(child, "#", 1), msg);
+            }
+            else
+            {
+                mqttTopicMatch(child, &topic[levelLen + 1], len - levelLen - 1, msg);
+            }
+        }
+    }
+}
+
+void mqttTopicDeliver(uint8_t node, mqttPublishMessage* msg)
+{
+    if (node != MQTT_NO_NODE && topicNodes[node].handler > 0)
+    {
+        topicHandlers[topicNodes[node].handler - 1](msg);
+    }
+}
+
+// the broker forgets them with a clean session, handlers stay
+void mqttClearSubscriptions()
+{
+    uint8_t i;
+    for (i = 1; i < MQTT_MAX_TOPIC_NODES; i++)
+    {
+        if (topicNodes[i].level > 0 && topicNodes[i].topicId != MQTT_NO_TOPIC_ID)
+        {
+            topicNodes[i].topicId = MQTT_NO_TOPIC_ID;
+            mqttTopicPrune(i);
+        }
+    }
+}
+
+// returns the next subscribed node after node, start with MQTT_NO_NODE, or
+// MQTT_NO_NODE after the last one
+uint8_t mqttNextSubscription(uint8_t node)
+{
+    for (node++; node < MQTT_MAX_TOPIC_NODES; node++)
+    {
+        if (topicNodes[node].level > 0 && topicNodes[node].topicId != MQTT_NO_TOPIC_ID)
+            return node;
+    }
+    return MQTT_NO_NODE;
+}
+
+// writes the filter of node to name, cut short to fit size
+// returns its full length
+uint16_t mqttGetTopicName(uint8_t node, char* name, uint16_t size)
+{
+    uint16_t len = 0;
+    uint16_t i;
+    char* level = &levelPool[topicNodes[node].level - 1];
+    if (topicNodes[node].parent != MQTT_NO_NODE)
+    {
+        len = mqttGetTopicName(topicNodes[node].parent, name, size) + 1;
+        if (len < size)
+            name[len - 1] = '/';
+    }
+    for (i = 0; level[i] != '\0'; i++, len++)
+    {
+        if (len < size - 1)
+            name[len] = level[i];
+    }
+    name[len < size ? len : size - 1] = '\0';
+    return len;
+}
+
+// selects mqtt 3.1.1 or 5, any other version is ignored
+// takes effect with the next CONNECT
+void mqttSetProtocolVersion(uint8_t version)
+{
+    if (version == MQTT_VERSION_3_1_1 || version == MQTT_VERSION_5)
+        protocolVersion = version;
+}
+
+// writes the property length and the properties, mqtt 3.1.1 packets have neither
+// returns the number of bytes written
+uint8_t mqttWriteProperties(uint8_t* buffer, uint8_t* properties, uint8_t len)
+{
+    uint8_t count;
+    if (clientState.version != MQTT_VERSION_5)
+    {
+        return 0;
+    }
+    count = mqttEncodeRemainingLength(buffer, len);
+    if (len > 0)
+        memcpy(&buffer[count], properties, len);
+    return count + len;
+}
+
+// a 2 or 4 byte integer property, most significant byte first
+uint8_t mqttWriteProperty(uint8_t* buffer, uint8_t id, uint32_t value, uint8_t size)
+{
+    uint8_t i;
+    buffer[0] = id;
+    for (i = 0; i < size; i++)
+        buffer[1 + i] = value >> (8 * (size - 1 - i));
+    return 1 + size;
+}
+
+// reads the property length and the properties that follow from the size bytes at
+// buffer, the ones not kept in props are stepped over
+// returns the number of bytes used, 0 if they are malformed
+uint32_t mqttDecodeProperties(uint8_t* buffer, uint32_t size, mqttProperties* props)
+{
+    uint32_t length;
+    uint32_t value;
+    uint32_t pos;
+    uint32_t end;
+    uint32_t field;
+    uint8_t id;
+    uint8_t i;
+
+    memset(props, 0, sizeof(mqttProperties));
+    pos = mqttDecodeRemainingLength(buffer, size < 4 ? size : 4, &length);
+    if (pos == 0 || length > size - pos)
+    {
+        return 0;
+    }
+    end = pos + length;
+    while (pos < end)
+    {
+        id = buffer[pos++];
+        switch (id)
+        {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+            field = 1;
+            break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            field = 2;
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            field = 4;
+            break;
+        case 0x0B: // subscription identifier, a varint
+            field = mqttDecodeRemainingLength(&buffer[pos], end - pos < 4 ? end - pos : 4, &value);
+            if (field == 0)
+                return 0;
+            break;
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A:
+        case 0x1C: case 0x1F: // strings and binary data, a 2 byte length first
+        case 0x26:            // user property, two strings
+            field = 0;
+            for (i = 0; i < (id == 0x26 ? 2 : 1); i++)
+            {
+                if (end - pos < field + 2)
+                    return 0;
+                field += 2 + ((buffer[pos + field] << 8) | buffer[pos + field + 1]);
+            }
+            break;
+        default:
+            return 0;
+        }
+        if (field > end - pos)
+        {
+            return 0;
+        }
+        value = 0;
+        for (i = 0; i < field && i < 4; i++)
+            value = (value << 8) | buffer[pos + i];
+        if (id == MQTT_PROP_RECEIVE_MAXIMUM)
+            props->receiveMaximum = value;
+        else if (id == MQTT_PROP_MAXIMUM_PACKET_SIZE)
+            props->maximumPacketSize = value;
+        else if (id == MQTT_PROP_TOPIC_ALIAS_MAXIMUM)
+            props->topicAliasMaximum = value;
+        else if (id == MQTT_PROP_TOPIC_ALIAS)
+            props->topicAlias = value;
+        pos += field;
+    }
+    return end;
+}
+
+// the alias that already stands for the topic, else a free one or the least recently
+// used one that no message in flight relies on
+// returns 0 if aliases are not in use or all of them are taken
+uint8_t mqttFindTopicAlias(char* topicName, uint16_t topicNameLen)
+{
+    uint8_t i;
+    uint8_t j;
+    uint8_t alias = 0;
+    uint8_t count = MQTT_MAX_TOPIC_ALIASES;
+    if (clientState.version != MQTT_VERSION_5 || topicNameLen == 0
+            || topicNameLen > MAX_TOPIC_NAME_SIZE)
+    {
+        return 0;
+    }
+    if (clientState.brokerTopicAliasMaximum < count)
+        count = clientState.brokerTopicAliasMaximum;
+    for (i = 0; i < count; i++)
+    {
+        if (mqttIsTopicAliasKnown(i + 1, topicName, topicNameLen))
+            return i + 1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < MQTT_MAX_INFLIGHT; j++)
+        {
+            if (inflight[j].state != MQTT_INFLIGHT_FREE && inflight[j].alias == i + 1)
+                break;
+        }
+        if (j < MQTT_MAX_INFLIGHT)
+            continue;
+        if (topicAliases[i].nameLen == 0)
+            return i + 1;
+        if (alias == 0 || (int16_t) (topicAliases[i].lastUse - topicAliases[alias - 1].lastUse) < 0)
+            alias = i + 1;
+    }
+    return alias;
+}
+
+// the packet that carries both the topic and the alias is on its way to the broker
+void mqttUseTopicAlias(uint8_t alias, char* topicName, uint16_t topicNameLen)
+{
+    if (alias == 0)
+    {
+        return;
+    }
+    memcpy(topicAliases[alias - 1].name, topicName, topicNameLen);
+    topicAliases[alias - 1].nameLen = topicNameLen;
+    topicAliases[alias - 1].lastUse = topicAliasUse++;
+}
+
+bool mqttIsTopicAliasKnown(uint8_t alias, char* topicName, uint16_t topicNameLen)
+{
+    return alias != 0 && topicAliases[alias - 1].nameLen == topicNameLen
+            && memcmp(topicAliases[alias - 1].name, topicName, topicNameLen) == 0;
+}
+
+// hands out the next free packet identifier after the last one, so a late
+// acknowledgement is unlikely to meet a reused id
+// returns MQTT_NO_TOPIC_ID if all are in use
+uint16_t getNewGuid()
+{
+    uint16_t i;
+    uint16_t id;
+    for (i = 0; i < MQTT_PACKET_IDS; i++)
+    {
+        id = (lastPacketId + i) % MQTT_PACKET_IDS + 1;
+        if ((packetIdsInUse[(id - 1) / 32] & (1UL << ((id - 1) % 32))) == 0)
+        {
+            packetIdsInUse[(id - 1) / 32] |= 1UL << ((id - 1) % 32);
+            lastPacketId = id;
+            return id;
+        }
+    }
+    return MQTT_NO_TOPIC_ID;
+}
+
+void mqttReleasePacketId(uint16_t packetId)
+{
+    if (packetId > 0 && packetId <= MQTT_PACKET_IDS)
+    {
+        packetIdsInUse[(packetId - 1) / 32] &= ~(1UL << ((packetId - 1) % 32));
+    }
+}
+
+bool storeSubscribedTopic(char* topicFilter, uint16_t topicId)
+{
+    uint8_t node = mqttTopicInsert(topicFilter);
+    if (node == MQTT_NO_NODE)
+    {
+        return false;
+    }
+    topicNodes[node].topicId = topicId;
+    return true;
+}
+void removeUnsubscribedTopic(char* topicFilter, uint16_t topicId)
+{
+    uint8_t node = mqttTopicFind(topicFilter);
+    if (node != MQTT_NO_NODE && topicNodes[node].topicId == topicId)
+    {
+        topicNodes[node].topicId = MQTT_NO_TOPIC_ID;
+        mqttTopicPrune(node);
+    }
+}
+uint16_t getTopicIdByName(char* topicFilter)
+{
+    uint8_t node = mqttTopicFind(topicFilter);
+    if (node == MQTT_NO_NODE)
+    {
+        return MQTT_NO_TOPIC_ID;
+    }
+    return topicNodes[node].topicId;
+}
+
+void setMqttBrokerIp(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3)
+{
+    clientState.brokerIP[0] = ip0;
+    clientState.brokerIP[1] = ip1;
+    clientState.brokerIP[2] = ip2;
+    clientState.brokerIP[3] = ip3;
+}
+
+void mqttGetIpAddress(uint8_t ip[4])
+{
+    uint8_t i;
+    for (i = 0; i < 4; i++)
+        ip[i] = clientState.brokerIP[i];
+}
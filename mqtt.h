@@ -1,82 +1,237 @@
-#ifndef MQTT_H
-#define MQTT_H
-#include "common.h"
-#include "stdint.h"
-
-#define MAX_TOPIC_NAME_SIZE 30
-#define MAX_SUBSCRIBED_TOPIC 10
-
-typedef struct _fixedMqttHeader{
-    uint8_t flags:4;
-    uint8_t packetType:4;
-    uint8_t msglen;
-} fixedMqttHeader;
-
-typedef struct _mqttFrameConnect
-{
-    uint16_t protocolLen;
-    char protocolName[4];
-    uint8_t version;
-    uint8_t flag;
-    uint16_t keepalive;
-    uint16_t clen;
-} mqttFrameConnect;
-
-typedef struct _mqttFrameSubscribe{
-    uint16_t packetIdentifier;
-    uint16_t topicnamelen;
-    //topic filter
-    //qos
-}mqttFrameSubscribe;
-
-typedef struct _mqttFrameUnsubscribe{
-    uint16_t packetIdentifier;
-    uint16_t topicnamelen;
-    //topic filter
-}mqttFrameUnsubscribe;
-
-typedef struct _storedTopicStruct{
-    uint16_t topicId;
-    char topicName[MAX_TOPIC_NAME_SIZE];
-}mqttSubscribedTopic;
-
-// mqtt control packet types
-#define MQTT_CONNECT 1
-#define MQTT_CONNACK 2
-#define MQTT_PUBLISH 3
-#define MQTT_PUBACK  4
-#define MQTT_PUBREC  5
-#define MQTT_PUBREL  6
-#define MQTT_PUBCOMP 7
-#define MQTT_SUBSCRIBE   8
-#define MQTT_SUBACK      9
-#define MQTT_UNSUBSCRIBE 10
-#define MQTT_UNSUBACK    11
-#define MQTT_PINGREQ     12
-#define MQTT_PINGRESP    13
-#define MQTT_DISCONNECT  14
-
-
-//core mqtt packets
-void mqttConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos);
-void mqttDisconnect();
-void mqttPing();
-void mqttSubscribe(char* topicFilter, uint16_t topicNameLen);
-void mqttUnsubscribe(char* topicFilter, uint16_t topicNameLen);
-
-uint16_t getNewGuid();
-uint8_t appendToPayload(uint8_t *buffer, uint8_t *data, uint8_t len);
-void retryMqttMsgResend();
-bool etherIsMqtt(uint8_t packet[]);
-void processMqttMessage(uint8_t packet[]);
-
-void storeSubscribedTopic(topicFilter, topicId);
-void removeUnsubscribedTopic(topicFilter, topicId);
-uint16_t getTopicIdByName(topicFilter);
-void setMqttBrokerIp(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
-void mqttGetIpAddress(uint8_t ip[4]);
-
-mqttSubscribedTopic* getMqttSubscribedTopics();
-
-
-#endif
+#ifndef MQTT_H
+#define MQTT_H
+#include "common.h"
+#include "stdint.h"
+#include "tcp.h"
+
+#define MAX_TOPIC_NAME_SIZE 30
+#define MAX_TOPIC_HANDLERS 8
+
+// subscriptions and handlers share a trie of topic levels, level strings are
+// interned in a pool so common prefixes and names cost their bytes once
+// a node is one level of one filter, filters that share their leading levels share
+// those nodes, 255 is the most a uint8_t index with 0 for none can reach
+#define MQTT_MAX_TOPIC_NODES 255
+#define MQTT_LEVEL_POOL_SIZE 1024
+#define MQTT_NO_NODE 0       // node 0 is the root, it is nobody's child or sibling
+#define MQTT_NO_TOPIC_ID 0   // packet identifiers start at 1
+
+// outbound packets wait here for tcp, a full queue makes publishes fail
+#define MQTT_QUEUE_SIZE 512
+
+// qos 1 and 2 publishes awaiting their acknowledgement, each keeps a copy for resending
+#define MQTT_MAX_INFLIGHT 4
+#define MQTT_RETRY_TIME 5        // seconds before an unacknowledged message is sent again
+#define MQTT_PACKET_IDS 64       // packet identifiers 1 to 64 are handed out, a multiple of 32
+#define MQTT_MAX_INBOUND_IDS 8   // inbound packet identifiers remembered to drop duplicates
+
+// what an in-flight message is waiting for
+#define MQTT_INFLIGHT_FREE 0
+#define MQTT_INFLIGHT_PUBACK 1
+#define MQTT_INFLIGHT_PUBREC 2
+#define MQTT_INFLIGHT_PUBCOMP 3
+
+// protocol levels, see mqttSetProtocolVersion
+#define MQTT_VERSION_3_1_1 4
+#define MQTT_VERSION_5 5
+
+// mqtt 5 properties that are used here, any other is stepped over on the way in
+#define MQTT_PROP_RECEIVE_MAXIMUM 0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT_PROP_TOPIC_ALIAS 0x23
+#define MQTT_PROP_MAXIMUM_PACKET_SIZE 0x27
+
+// outbound topic aliases, mqtt 5 only, the broker's Topic Alias Maximum can lower it
+#define MQTT_MAX_TOPIC_ALIASES 8
+
+// publishes made while the broker is away are logged to flash and replayed after
+// the next CONNACK, a few a second so live traffic still gets through
+#define MQTT_REPLAY_RATE 5       // default messages per second, see mqttSetReplayRate
+
+// the remaining length is a 1 to 4 byte varint, this struct only covers
+// packets under 128 bytes, see mqttWriteFixedHeader
+typedef struct _fixedMqttHeader{
+    uint8_t flags:4;
+    uint8_t packetType:4;
+    uint8_t msglen;
+} fixedMqttHeader;
+
+#define MQTT_MAX_FIXED_HEADER 5          // type and flags plus 4 length bytes
+#define MQTT_MAX_REMAINING_LENGTH 268435455
+
+typedef struct _mqttFrameConnect
+{
+    uint16_t protocolLen;
+    char protocolName[4];
+    uint8_t version;
+    uint8_t flag;
+    uint16_t keepalive;
+    uint16_t clen;
+} mqttFrameConnect;
+
+typedef struct _mqttFrameSubscribe{
+    uint16_t packetIdentifier;
+    uint16_t topicnamelen;
+    //topic filter
+    //qos
+}mqttFrameSubscribe;
+
+typedef struct _mqttFrameUnsubscribe{
+    uint16_t packetIdentifier;
+    uint16_t topicnamelen;
+    //topic filter
+}mqttFrameUnsubscribe;
+
+// properties of a received packet, 0 for the ones that were not present
+typedef struct _mqttProperties{
+    uint16_t receiveMaximum;
+    uint32_t maximumPacketSize;
+    uint16_t topicAliasMaximum;
+    uint16_t topicAlias;
+}mqttProperties;
+
+// the topic behind an outbound alias, aliases only last for one connection
+typedef struct _mqttTopicAlias{
+    uint8_t nameLen;   // 0 when the alias is not in use
+    uint16_t lastUse;  // the least recently used alias is given to a new topic
+    char name[MAX_TOPIC_NAME_SIZE];
+}mqttTopicAlias;
+
+typedef struct _mqttTopicNode{
+    uint16_t level;   // offset + 1 of the level string in the pool, 0 when the node is free
+    uint16_t topicId; // SUBSCRIBE packet id of this filter, MQTT_NO_TOPIC_ID if not subscribed
+    uint8_t parent;
+    uint8_t child;    // first child, the rest follow through sibling
+    uint8_t sibling;
+    uint8_t handler;  // index + 1 into topicHandlers, 0 for none
+}mqttTopicNode;
+
+// an inbound PUBLISH, topic and payload point into the received packet and are
+// only valid during the handler call, the topic is not zero terminated
+typedef struct _mqttPublishMessage{
+    char* topic;
+    uint16_t topicLen;
+    uint16_t packetId;   // 0 for qos 0
+    uint8_t qos;
+    bool retain;
+    bool dup;
+    uint8_t* payload;
+    uint16_t payloadLen;
+}mqttPublishMessage;
+
+typedef void (*mqttHandler)(mqttPublishMessage* msg);
+
+// mqtt control packet types
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK  4
+#define MQTT_PUBREC  5
+#define MQTT_PUBREL  6
+#define MQTT_PUBCOMP 7
+#define MQTT_SUBSCRIBE   8
+#define MQTT_SUBACK      9
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_UNSUBACK    11
+#define MQTT_PINGREQ     12
+#define MQTT_PINGRESP    13
+#define MQTT_DISCONNECT  14
+
+
+//core mqtt packets
+void mqttConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos);
+void mqttSendConnect(uint8_t* serverIP, uint8_t* serverMacAddress, uint8_t qos);
+bool mqttPublish(char* topicFilter, uint16_t topicNameLen, char* topicValue,
+                 uint16_t topicValueLen);
+bool mqttSendPublish(char* topicFilter, uint16_t topicNameLen, char* topicValue,
+                     uint16_t topicValueLen);
+void mqttDisconnect();
+void mqttPing();
+void mqttKeepaliveTick();
+void mqttSubscribe(char* topicFilter, uint16_t topicNameLen);
+void mqttUnsubscribe(char* topicFilter, uint16_t topicNameLen);
+void mqttResubscribe();
+
+uint16_t getNewGuid();
+void mqttReleasePacketId(uint16_t packetId);
+uint16_t mqttBuildSubscribe(uint8_t* buffer, char* topicFilter, uint16_t topicNameLen,
+                            uint16_t packetId);
+uint16_t mqttBuildPublish(uint8_t* buffer, char* topicName, uint16_t topicNameLen,
+                          uint8_t* payload, uint16_t payloadLen, uint16_t packetId,
+                          uint8_t alias);
+bool mqttQueuePacket(uint8_t* packet, uint16_t len, bool push);
+uint16_t mqttQueueFree();
+void mqttDrainQueue();
+void mqttSendInflight();
+void mqttInflightAck(uint8_t packetType, uint16_t packetId);
+void mqttInflightTick();
+void mqttInflightLost();
+uint8_t mqttFreeInflightSlot();
+bool mqttIsDuplicate(mqttPublishMessage* msg);
+void mqttRememberInbound(mqttPublishMessage* msg);
+void mqttForgetInbound(uint16_t packetId);
+uint16_t appendToPayload(uint8_t *buffer, uint8_t *data, uint16_t len);
+void retryMqttMsgResend();
+
+// store and forward
+bool mqttStorePublish(char* topicName, uint16_t topicNameLen, char* payload,
+                      uint16_t payloadLen);
+void mqttReplayTick();
+void mqttSetReplayRate(uint8_t messagesPerSecond);
+uint32_t mqttBacklogDepth();
+uint32_t mqttBacklogOldest();
+uint8_t mqttEncodeRemainingLength(uint8_t* buffer, uint32_t length);
+uint8_t mqttDecodeRemainingLength(uint8_t* buffer, uint8_t size, uint32_t* length);
+uint8_t mqttWriteFixedHeader(uint8_t* buffer, uint8_t packetType, uint8_t flags,
+                             uint32_t length);
+
+// streaming publish, topic and payload go straight to the tcp send path
+bool mqttPublishBegin(char* topicName, uint16_t topicNameLen, uint32_t payloadLen);
+uint16_t mqttPublishWrite(uint8_t* data, uint16_t size);
+bool mqttPublishEnd();
+uint32_t mqttPublishLength(uint16_t topicNameLen, uint32_t payloadLen, uint8_t alias);
+bool mqttPublishFits(uint16_t topicNameLen, uint32_t payloadLen, uint8_t alias);
+bool mqttFitsBroker(uint32_t msglen);
+
+// mqtt 5
+void mqttSetProtocolVersion(uint8_t version);
+uint8_t mqttWriteProperties(uint8_t* buffer, uint8_t* properties, uint8_t len);
+uint8_t mqttWriteProperty(uint8_t* buffer, uint8_t id, uint32_t value, uint8_t size);
+uint32_t mqttDecodeProperties(uint8_t* buffer, uint32_t size, mqttProperties* props);
+uint8_t mqttFindTopicAlias(char* topicName, uint16_t topicNameLen);
+void mqttUseTopicAlias(uint8_t alias, char* topicName, uint16_t topicNameLen);
+bool mqttIsTopicAliasKnown(uint8_t alias, char* topicName, uint16_t topicNameLen);
+void mqttUnaliasPublish(uint8_t slot);
+void processMqttMessage(tcpControlBlock* tcb);
+bool mqttParsePublish(uint8_t* message, uint8_t headerLen, uint32_t msglen,
+                      mqttPublishMessage* msg);
+void mqttDispatchPublish(mqttPublishMessage* msg);
+void mqttSendAck(uint8_t packetType, uint16_t packetId);
+bool mqttSetTopicHandler(char* topicFilter, mqttHandler handler);
+
+// topic trie
+bool mqttIsValidFilter(char* topicFilter);
+uint16_t mqttTopicIntern(char* name, uint16_t len);
+void mqttTopicRelease(uint16_t level);
+uint8_t mqttTopicChild(uint8_t node, char* name, uint16_t len);
+uint8_t mqttTopicInsert(char* topicFilter);
+uint8_t mqttTopicFind(char* topicFilter);
+void mqttTopicPrune(uint8_t node);
+void mqttTopicMatch(uint8_t node, char* topic, uint16_t len, mqttPublishMessage* msg);
+void mqttTopicDeliver(uint8_t node, mqttPublishMessage* msg);
+void mqttClearSubscriptions();
+uint8_t mqttNextSubscription(uint8_t node);
+uint16_t mqttGetTopicName(uint8_t node, char* name, uint16_t size);
+void mqttOpenConnection();
+void mqttTcpEvent(tcpControlBlock* tcb, uint8_t event);
+void mqttConnectionLost(tcpControlBlock* tcb);
+
+bool storeSubscribedTopic(char* topicFilter, uint16_t topicId);
+void removeUnsubscribedTopic(char* topicFilter, uint16_t topicId);
+uint16_t getTopicIdByName(char* topicFilter);
+void setMqttBrokerIp(uint8_t ip0, uint8_t ip1, uint8_t ip2, uint8_t ip3);
+void mqttGetIpAddress(uint8_t ip[4]);
+
+
+
+#endif
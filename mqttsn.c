@@ -0,0 +1,428 @@
+#include "mqttsn.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "eth0.h"
+#include "timer.h"
+
+#define MQTTSN_DISCONNECTED 0
+#define MQTTSN_CONNECTING 1
+#define MQTTSN_CONNECTED 2
+
+typedef struct _mqttsnClientState
+{
+    uint8_t gatewayIP[IP_ADD_LENGTH];
+    uint8_t gatewayMac[HW_ADD_LENGTH];
+    uint8_t connectionState;
+    uint16_t msgId;
+    uint16_t idle;         // seconds since anything was sent to the gateway
+} mqttsnClientState;
+
+// mqtt-sn allows a single message to wait for its answer, it is kept to be sent again
+typedef struct _mqttsnRequest
+{
+    bool active;
+    uint8_t answerType;
+    uint16_t msgId;
+    uint8_t topic;         // topics index of a REGISTER
+    uint8_t retries;
+    uint8_t timeout;
+    uint8_t len;
+    uint8_t buff[MQTTSN_MAX_MSGSIZE];
+} mqttsnRequest;
+
+mqttsnClientState snState = { .gatewayIP = { 0, 0, 0, 0 },
+                              .gatewayMac = { 0xf, 0xff, 0xff, 0xff },
+                              .connectionState = MQTTSN_DISCONNECTED,
+                              .msgId = 0, .idle = 0 };
+mqttsnRequest snRequest = { .active = false };
+mqttsnTopic snTopics[MQTTSN_MAX_TOPICS];
+
+// starts a clean session with the gateway, topics registered before are forgotten
+void mqttsnConnect(uint8_t* gatewayIP, uint8_t* gatewayMacAddress)
+{
+    uint8_t i;
+    char* clientName = "hello-sn";
+    uint8_t clientSize = strlen(clientName);
+    uint8_t message[MQTTSN_MAX_MSGSIZE];
+
+    mqttsnSetGateway(gatewayIP, gatewayMacAddress);
+    for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+    {
+        if (snTopics[i].type == MQTTSN_TOPIC_NORMAL)
+            snTopics[i].nameLen = 0;
+    }
+    message[0] = 6 + clientSize;
+    message[1] = MQTTSN_CONNECT;
+    message[2] = MQTTSN_FLAG_CLEAN_SESSION;
+    message[3] = 0x01; // protocol id
+    message[4] = MQTTSN_KEEPALIVE >> 8;
+    message[5] = MQTTSN_KEEPALIVE & 0xFF;
+    memcpy(&message[6], clientName, clientSize);
+
+    snRequest.active = false;
+    snState.connectionState = MQTTSN_CONNECTING;
+    mqttsnSendRequest(message, message[0], MQTTSN_CONNACK, 0);
+    startPeriodicTimer(mqttsnTick, 1);
+}
+
+void mqttsnDisconnect()
+{
+    uint8_t message[2] = { 2, MQTTSN_DISCONNECT };
+    if (snState.connectionState == MQTTSN_DISCONNECTED)
+    {
+        return;
+    }
+    mqttsnSend(message, sizeof(message));
+    snState.connectionState = MQTTSN_DISCONNECTED;
+    snRequest.active = false;
+    stopTimer(mqttsnTick);
+}
+
+bool mqttsnIsConnected()
+{
+    return snState.connectionState == MQTTSN_CONNECTED;
+}
+
+// enough for qos -1, which needs no connection
+void mqttsnSetGateway(uint8_t* gatewayIP, uint8_t* gatewayMacAddress)
+{
+    memcpy(snState.gatewayIP, gatewayIP, IP_ADD_LENGTH);
+    memcpy(snState.gatewayMac, gatewayMacAddress, HW_ADD_LENGTH);
+}
+
+// a topic id the gateway is configured with, it is used without a REGISTER
+bool mqttsnSetPredefinedTopic(char* topicName, uint16_t topicId)
+{
+    uint8_t i;
+    uint16_t topicNameLen = strlen(topicName);
+    mqttsnTopic* topic = mqttsnFindTopic(topicName, topicNameLen);
+    if (topicNameLen == 0 || topicNameLen > MAX_TOPIC_NAME_SIZE)
+    {
+        return false;
+    }
+    for (i = 0; i < MQTTSN_MAX_TOPICS && topic == NULL; i++)
+    {
+        if (snTopics[i].nameLen == 0)
+            topic = &snTopics[i];
+    }
+    if (topic == NULL)
+    {
+        return false;
+    }
+    memcpy(topic->name, topicName, topicNameLen);
+    topic->nameLen = topicNameLen;
+    topic->type = MQTTSN_TOPIC_PREDEFINED;
+    topic->topicId = topicId;
+    return true;
+}
+
+// asks the gateway for a topic id, it is known once the REGACK arrives
+// returns false if the name is already registered or cannot be right now
+bool mqttsnRegister(char* topicName, uint16_t topicNameLen)
+{
+    uint8_t i;
+    uint8_t message[MQTTSN_MAX_MSGSIZE];
+    uint16_t msgId;
+    if (snState.connectionState != MQTTSN_CONNECTED || snRequest.active
+            || topicNameLen == 0 || topicNameLen > MAX_TOPIC_NAME_SIZE
+            || mqttsnFindTopic(topicName, topicNameLen) != NULL)
+    {
+        return false;
+    }
+    for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+    {
+        if (snTopics[i].nameLen == 0)
+            break;
+    }
+    if (i == MQTTSN_MAX_TOPICS)
+    {
+        return false;
+    }
+    msgId = mqttsnNextMsgId();
+    message[0] = 6 + topicNameLen;
+    message[1] = MQTTSN_REGISTER;
+    message[2] = 0; // the gateway picks the topic id
+    message[3] = 0;
+    message[4] = msgId >> 8;
+    message[5] = msgId & 0xFF;
+    memcpy(&message[6], topicName, topicNameLen);
+
+    memcpy(snTopics[i].name, topicName, topicNameLen);
+    snTopics[i].nameLen = topicNameLen;
+    snTopics[i].type = MQTTSN_TOPIC_NORMAL;
+    snTopics[i].topicId = MQTTSN_NO_TOPIC_ID;
+    snRequest.topic = i;
+    return mqttsnSendRequest(message, message[0], MQTTSN_REGACK, msgId);
+}
+
+// a two character topic goes as a short name, others need a predefined or registered id
+// an unknown name is registered and the publish fails, try again after the REGACK
+// qos is -1, 0 or 1, qos 1 fails while another message waits for its answer
+bool mqttsnPublish(char* topicName, uint16_t topicNameLen, uint8_t* data,
+                   uint16_t dataLen, int8_t qos)
+{
+    mqttsnTopic* topic;
+    if (topicNameLen == 2)
+    {
+        return mqttsnPublishId((topicName[0] << 8) | topicName[1], MQTTSN_TOPIC_SHORT, data,
+                               dataLen, qos);
+    }
+    topic = mqttsnFindTopic(topicName, topicNameLen);
+    if (topic != NULL && topic->topicId != MQTTSN_NO_TOPIC_ID)
+    {
+        return mqttsnPublishId(topic->topicId, topic->type, data, dataLen, qos);
+    }
+    if (topic == NULL && qos != -1)
+    {
+        mqttsnRegister(topicName, topicNameLen);
+    }
+    return false;
+}
+
+bool mqttsnPublishId(uint16_t topicId, uint8_t topicIdType, uint8_t* data,
+                     uint16_t dataLen, int8_t qos)
+{
+    uint8_t message[MQTTSN_MAX_MSGSIZE];
+    uint16_t msgId = 0;
+    if (dataLen > MQTTSN_MAX_MSGSIZE - 7 || qos < -1 || qos > 1)
+    {
+        return false;
+    }
+    // qos -1 goes to the gateway without a connection, so only with ids it already knows
+    if (qos == -1 && (topicIdType == MQTTSN_TOPIC_NORMAL || snState.gatewayIP[0] == 0))
+    {
+        return false;
+    }
+    if (qos != -1 && snState.connectionState != MQTTSN_CONNECTED)
+    {
+        return false;
+    }
+    if (qos == 1)
+    {
+        if (snRequest.active)
+            return false;
+        msgId = mqttsnNextMsgId();
+    }
+    message[0] = 7 + dataLen;
+    message[1] = MQTTSN_PUBLISH;
+    message[2] = ((qos == -1 ? MQTTSN_QOS_MINUS_ONE : qos) << MQTTSN_FLAG_QOS_S) | topicIdType;
+    message[3] = topicId >> 8;
+    message[4] = topicId & 0xFF;
+    message[5] = msgId >> 8;
+    message[6] = msgId & 0xFF;
+    memcpy(&message[7], data, dataLen);
+    if (qos == 1)
+    {
+        return mqttsnSendRequest(message, message[0], MQTTSN_PUBACK, msgId);
+    }
+    mqttsnSend(message, message[0]);
+    return true;
+}
+
+// an udp datagram to our port from the gateway, the packet must be udp
+bool mqttsnIsMessage(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    udpFrame* udp = (udpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    return ntohs(udp->destPort) == MQTTSN_LOCAL_PORT
+            && memcmp(ip->sourceIp, snState.gatewayIP, IP_ADD_LENGTH) == 0;
+}
+
+void processMqttsnMessage(uint8_t packet[], uint16_t frameSize)
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    udpFrame* udp = (udpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    uint8_t* message = &udp->data;
+    uint16_t udpOffset = (uint8_t*) udp - packet;
+    uint16_t size;
+    uint16_t len;
+    uint8_t type;
+    uint8_t* body;
+    uint16_t topicId;
+    uint16_t msgId;
+    uint8_t i;
+    uint8_t pingResp[2] = { 2, MQTTSN_PINGRESP };
+
+    // the udp length is the sender's word, it has to cover the 8 byte header
+    // and stay inside what was actually received
+    if (udpOffset + 8 > frameSize)
+        return;
+    size = ntohs(udp->length);
+    if (size < 8 || udpOffset + size > frameSize)
+        return;
+    size -= 8;
+
+    // a length of 1 means the next 2 bytes hold it
+    if (size >= 4 && message[0] == 0x01)
+    {
+        len = (message[1] << 8) | message[2];
+        type = message[3];
+        body = &message[4];
+        if (len < 4)
+            return;
+        len -= 4;
+    }
+    else if (size >= 2 && message[0] >= 2)
+    {
+        len = message[0] - 2;
+        type = message[1];
+        body = &message[2];
+    }
+    else
+    {
+        return;
+    }
+    if (body + len > message + size)
+    {
+        return;
+    }
+
+    switch (type)
+    {
+    case MQTTSN_CONNACK:
+        if (len < 1 || !snRequest.active || snRequest.answerType != MQTTSN_CONNACK)
+            break;
+        snRequest.active = false;
+        if (body[0] == MQTTSN_ACCEPTED)
+        {
+            snState.connectionState = MQTTSN_CONNECTED;
+            snState.idle = 0;
+        }
+        else
+        {
+            snState.connectionState = MQTTSN_DISCONNECTED;
+            stopTimer(mqttsnTick);
+        }
+        break;
+    case MQTTSN_REGACK:
+        if (len < 5)
+            break;
+        topicId = (body[0] << 8) | body[1];
+        msgId = (body[2] << 8) | body[3];
+        if (!snRequest.active || snRequest.answerType != MQTTSN_REGACK || snRequest.msgId != msgId)
+            break;
+        snRequest.active = false;
+        if (body[4] == MQTTSN_ACCEPTED && topicId != MQTTSN_NO_TOPIC_ID)
+            snTopics[snRequest.topic].topicId = topicId;
+        else
+            snTopics[snRequest.topic].nameLen = 0;
+        break;
+    case MQTTSN_PUBACK:
+        if (len < 5)
+            break;
+        topicId = (body[0] << 8) | body[1];
+        msgId = (body[2] << 8) | body[3];
+        if (!snRequest.active || snRequest.answerType != MQTTSN_PUBACK || snRequest.msgId != msgId)
+            break;
+        snRequest.active = false;
+        // the gateway no longer knows the id, the next publish registers the name again
+        if (body[4] == MQTTSN_INVALID_TOPIC_ID && (snRequest.buff[2] & 3) == MQTTSN_TOPIC_NORMAL)
+        {
+            for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+            {
+                if (snTopics[i].nameLen > 0 && snTopics[i].type == MQTTSN_TOPIC_NORMAL
+                        && snTopics[i].topicId == topicId)
+                    snTopics[i].nameLen = 0;
+            }
+        }
+        break;
+    case MQTTSN_PINGRESP:
+        if (snRequest.active && snRequest.answerType == MQTTSN_PINGRESP)
+            snRequest.active = false;
+        break;
+    case MQTTSN_PINGREQ:
+        mqttsnSend(pingResp, sizeof(pingResp));
+        break;
+    case MQTTSN_DISCONNECT:
+        snState.connectionState = MQTTSN_DISCONNECTED;
+        snRequest.active = false;
+        stopTimer(mqttsnTick);
+        break;
+    default:
+        break;
+    }
+}
+
+mqttsnTopic* mqttsnFindTopic(char* topicName, uint16_t topicNameLen)
+{
+    uint8_t i;
+    for (i = 0; i < MQTTSN_MAX_TOPICS; i++)
+    {
+        if (snTopics[i].nameLen == topicNameLen
+                && memcmp(snTopics[i].name, topicName, topicNameLen) == 0)
+            return &snTopics[i];
+    }
+    return NULL;
+}
+
+// message ids start at 1, 0 goes with messages that have no answer
+uint16_t mqttsnNextMsgId()
+{
+    if (++snState.msgId == 0)
+        snState.msgId = 1;
+    return snState.msgId;
+}
+
+void mqttsnSend(uint8_t* message, uint8_t len)
+{
+    etherSendUdp(snState.gatewayMac, snState.gatewayIP, MQTTSN_LOCAL_PORT, MQTTSN_GATEWAY_PORT,
+                 message, len);
+    snState.idle = 0;
+}
+
+// sends a message that the gateway answers with answerType, it goes again every
+// MQTTSN_RETRY_TIME seconds until then
+// returns false if another one is still waiting
+bool mqttsnSendRequest(uint8_t* message, uint8_t len, uint8_t answerType, uint16_t msgId)
+{
+    if (snRequest.active)
+    {
+        return false;
+    }
+    memcpy(snRequest.buff, message, len);
+    snRequest.len = len;
+    snRequest.answerType = answerType;
+    snRequest.msgId = msgId;
+    snRequest.retries = 0;
+    snRequest.timeout = MQTTSN_RETRY_TIME;
+    snRequest.active = true;
+    mqttsnSend(message, len);
+    return true;
+}
+
+// once a second, resends an unanswered message and keeps the connection alive
+// when there has been nothing else to send
+void mqttsnTick()
+{
+    uint8_t ping[2] = { 2, MQTTSN_PINGREQ };
+    if (snRequest.active && --snRequest.timeout == 0)
+    {
+        if (++snRequest.retries > MQTTSN_MAX_RETRIES)
+        {
+            mqttsnGatewayLost();
+            return;
+        }
+        if (snRequest.buff[1] == MQTTSN_PUBLISH)
+            snRequest.buff[2] |= MQTTSN_FLAG_DUP;
+        snRequest.timeout = MQTTSN_RETRY_TIME;
+        mqttsnSend(snRequest.buff, snRequest.len);
+    }
+    if (snState.connectionState == MQTTSN_CONNECTED && ++snState.idle >= MQTTSN_KEEPALIVE)
+    {
+        mqttsnSendRequest(ping, sizeof(ping), MQTTSN_PINGRESP, 0);
+    }
+}
+
+// the gateway stopped answering, a new session is started right away
+void mqttsnGatewayLost()
+{
+    uint8_t gatewayIP[IP_ADD_LENGTH];
+    uint8_t gatewayMac[HW_ADD_LENGTH];
+    snRequest.active = false;
+    memcpy(gatewayIP, snState.gatewayIP, IP_ADD_LENGTH);
+    memcpy(gatewayMac, snState.gatewayMac, HW_ADD_LENGTH);
+    mqttsnConnect(gatewayIP, gatewayMac);
+}
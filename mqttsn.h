@@ -0,0 +1,73 @@
+#ifndef MQTTSN_H
+#define MQTTSN_H
+#include "common.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "mqtt.h"
+
+// mqtt-sn 1.2 over udp, every message is one datagram to the gateway
+#define MQTTSN_GATEWAY_PORT 10000 // the paho gateway's default
+#define MQTTSN_LOCAL_PORT 10000
+#define MQTTSN_MAX_MSGSIZE 128
+#define MQTTSN_MAX_TOPICS 8       // registered and predefined topic names
+#define MQTTSN_KEEPALIVE 60       // seconds, a PINGREQ goes out when nothing else has
+#define MQTTSN_RETRY_TIME 5       // seconds to wait for an answer before sending again
+#define MQTTSN_MAX_RETRIES 3      // the gateway is lost after this many resends
+
+// message types
+#define MQTTSN_CONNECT     0x04
+#define MQTTSN_CONNACK     0x05
+#define MQTTSN_REGISTER    0x0A
+#define MQTTSN_REGACK      0x0B
+#define MQTTSN_PUBLISH     0x0C
+#define MQTTSN_PUBACK      0x0D
+#define MQTTSN_PINGREQ     0x16
+#define MQTTSN_PINGRESP    0x17
+#define MQTTSN_DISCONNECT  0x18
+
+// flags
+#define MQTTSN_FLAG_DUP 0x80
+#define MQTTSN_FLAG_QOS_S 5
+#define MQTTSN_FLAG_CLEAN_SESSION 0x04
+#define MQTTSN_QOS_MINUS_ONE 3    // qos -1, publish without a connection
+
+// topic id types
+#define MQTTSN_TOPIC_NORMAL 0
+#define MQTTSN_TOPIC_PREDEFINED 1
+#define MQTTSN_TOPIC_SHORT 2
+
+// return codes
+#define MQTTSN_ACCEPTED 0
+#define MQTTSN_INVALID_TOPIC_ID 2
+
+#define MQTTSN_NO_TOPIC_ID 0
+
+typedef struct _mqttsnTopic
+{
+    uint16_t topicId;   // MQTTSN_NO_TOPIC_ID while a REGISTER is outstanding
+    uint8_t type;       // MQTTSN_TOPIC_NORMAL or MQTTSN_TOPIC_PREDEFINED
+    uint8_t nameLen;    // 0 for a free entry
+    char name[MAX_TOPIC_NAME_SIZE];
+} mqttsnTopic;
+
+void mqttsnConnect(uint8_t* gatewayIP, uint8_t* gatewayMacAddress);
+void mqttsnDisconnect();
+bool mqttsnIsConnected();
+void mqttsnSetGateway(uint8_t* gatewayIP, uint8_t* gatewayMacAddress);
+bool mqttsnSetPredefinedTopic(char* topicName, uint16_t topicId);
+bool mqttsnRegister(char* topicName, uint16_t topicNameLen);
+bool mqttsnPublish(char* topicName, uint16_t topicNameLen, uint8_t* data,
+                   uint16_t dataLen, int8_t qos);
+bool mqttsnPublishId(uint16_t topicId, uint8_t topicIdType, uint8_t* data,
+                     uint16_t dataLen, int8_t qos);
+bool mqttsnIsMessage(uint8_t packet[]);
+void processMqttsnMessage(uint8_t packet[], uint16_t frameSize);
+
+mqttsnTopic* mqttsnFindTopic(char* topicName, uint16_t topicNameLen);
+uint16_t mqttsnNextMsgId();
+void mqttsnSend(uint8_t* message, uint8_t len);
+bool mqttsnSendRequest(uint8_t* message, uint8_t len, uint8_t answerType, uint16_t msgId);
+void mqttsnTick();
+void mqttsnGatewayLost();
+
+#endif
@@ -1,349 +1,1988 @@
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include "tm4c123gh6pm.h"
-#include "gpio.h"
-#include "spi0.h"
-#include "wait.h"
-#include "timer.h"
-#include "tcp.h"
-
-tcpServerState tcpState = { .state = LISTEN, .runningSeqn = 0, .myPort = 5771,
-                            .serverPort = 0, .ackToSend = 0, };
-
-void resetTcpStateTimer()
-{
-    tcpState.runningSeqn = 0;
-    tcpState.myPort = random32();
-    tcpState.serverPort = 1883;
-    tcpState.ackToSend = 0;
-    tcpState.state = LISTEN;
-}
-
-bool etherIsTcp(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    bool ok = false;
-    uint16_t tmp16;
-
-    if ((ip->protocol == 0x06)
-            && (ntohs(tcp->destPort) == HTTP_PORT
-                    || ntohs(tcp->destPort) == TELNET_PORT) || ntohs(tcp->sourcePort) == 1883)
-    {
-        ok = true;
-    }
-
-    return ok;
-}
-
-void processTcpMessage(uint8_t packet[])
-{
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    bool bEtherIsMqtt = false;
-
-    switch (tcpState.state)
-    {
-    case LISTEN:
-        resetTcpStateTimer();
-        if ((tcp->flags & SYN) > 0)
-        {
-            etherSendTcpResponse(packet, 0, 0, (SYN | ACK));
-            tcpState.state = ESTABLISHED;
-            //startOneshotTimer(resetTcpStateTimer, 120);
-        }
-        if ((tcp->flags & SYN) > 0 && (tcp->flags & ACK) > 0)
-        {
-            etherSendTcpResponse(packet, 0, 0, (ACK));
-            tcpState.state = ESTABLISHED;
-           // startOneshotTimer(resetTcpStateTimer, 120);
-        }
-        break;
-    case SYN_SENT:
-        if ((tcp->flags & SYN) > 0 && (tcp->flags & ACK) > 0)
-        {
-            etherSendTcpResponse(packet, 0, 0, (ACK));
-            tcpState.state = ESTABLISHED;
-           // startOneshotTimer(resetTcpStateTimer, 120);
-        }
-        break;
-    case ESTABLISHED:
-        if ((tcp->flags & ACK) > 0)
-        {
-            //    etherSendTcpPacket(packet, 0, 0, ACK|FIN);
-            //    tcpState.state = FIN_WAIT_1;
-            //    startOneshotTimer(resetTcpStateTimer, 15);
-        }
-        if ((tcp->flags & FIN) > 0 && (tcp->flags & ACK) > 0)
-        {
-            tcpState.state = LISTEN;
-            etherSendTcpResponse(packet, 0, 0,  ACK);
-        }
-        if ((tcp->flags & FIN) > 0)
-        {
-            tcpState.state = LISTEN;
-            etherSendTcpResponse(packet, 0, 0, FIN | ACK);
-        }
-        if ((tcp->flags & PUSH) > 0)
-        {
-            //see if the packet contains mqtt payload, if it does, process the reply
-            if(etherIsMqtt(packet))
-            {
-                uint32_t receivedTcpSize = ntohs(ip->length) - 20; //deduct the ipframe size
-                uint32_t mqttPayloadSize = receivedTcpSize - tcp->off * 4;
-                if(mqttPayloadSize > 0)
-                {
-                    bEtherIsMqtt= true;
-                }
-            }
-            etherSendTcpResponse(packet, 0, 0, ACK);
-        }
-        break;
-    default:
-        break;
-    }
-
-    if(bEtherIsMqtt == true)
-    {
-        processMqttMessage(packet);
-    }
-
-    return;
-}
-
-void etherSendTcpResponse(uint8_t packet[], uint8_t* tcpData,
-                          uint8_t tcpDataSize, uint8_t flags)
-{
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    uint8_t *copyData;
-    uint8_t i, tmp8;
-    uint16_t tmp16;
-    uint32_t receivedTcpSize = ntohs(ip->length) - 20; //deduct the ipframe size
-    uint32_t receivedPayloadSize = receivedTcpSize - tcp->off * 4;
-
-    // swap source and destination fields
-    for (i = 0; i < HW_ADD_LENGTH; i++)
-    {
-        tmp8 = ether->destAddress[i];
-        ether->destAddress[i] = ether->sourceAddress[i];
-        ether->sourceAddress[i] = tmp8;
-    }
-    for (i = 0; i < IP_ADD_LENGTH; i++)
-    {
-        tmp8 = ip->destIp[i];
-        ip->destIp[i] = ip->sourceIp[i];
-        ip->sourceIp[i] = tmp8;
-    }
-
-    tmp16 = tcp->sourcePort;
-    tcp->sourcePort = tcp->destPort;
-    tcp->destPort = tmp16;
-    tcp->reservedNS = 0;
-    if ((tcp->flags & PUSH) > 0)
-    {
-        tcpState.ackToSend = ntohl(tcp->sequenceNumber) + receivedPayloadSize;
-    }
-    else if ((tcp->flags & SYN) > 0)
-    {
-        tcpState.ackToSend = ntohl(tcp->sequenceNumber) + 1;
-    }
-    else if ((tcp->flags & FIN) > 0)
-    {
-        tcpState.ackToSend = ntohl(tcp->sequenceNumber) + 1;
-    }
-
-    if ((flags & PUSH) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn);
-        tcpState.runningSeqn =  tcpState.runningSeqn + tcpDataSize;
-    }
-    else if ((flags & SYN) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn++);
-    }
-    else if ((flags & FIN) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn++);
-    }
-    else
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn);
-    }
-
-     if((flags & ACK) > 0)
-     {
-         tcp->ackNumber = htonl(tcpState.ackToSend);
-     }
-     else
-     {
-         tcp->ackNumber = htonl(tcpState.ackToSend);
-     }
-
-    tcp->off = 0x5;
-    tcp->flags = flags;
-    tcp->win = htons(1280); // 1 MSS
-    tcp->sum = 0;
-    tcp->urp = 0;
-
-    uint8_t tcpHederSize = 20;
-    // adjust lengths
-    ip->length = htons(((ip->revSize & 0xF) * 4) + tcpHederSize + tcpDataSize);
-    // 32-bit sum over ip header
-    sum = 0;
-    etherSumWords(&ip->revSize, 10);
-    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
-    ip->headerChecksum = getEtherChecksum();
-
-    // copy data
-    if (tcpDataSize > 0)
-    {
-        copyData = &tcp->data;
-        for (i = 0; i < tcpDataSize; i++)
-            copyData[i] = tcpData[i];
-    }
-    // 32-bit sum over pseudo-header
-    sum = 0;
-    etherSumWords(ip->sourceIp, 8);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    uint16_t tcpLength = htons(tcpHederSize + tcpDataSize);
-    etherSumWords(&tcpLength, 2);
-    // add tcp header except checksum
-    etherSumWords(tcp, tcpHederSize);
-    if (tcpDataSize > 0)
-    {
-        etherSumWords(&tcp->data, tcpDataSize);
-    }
-    tcp->sum = getEtherChecksum();
-
-    etherPutPacket(ether,
-                   14 + ((ip->revSize & 0xF) * 4) + tcpHederSize + tcpDataSize);
-}
-
-void sendTcpPacket(uint8_t* tcpData, uint8_t tcpDataSize, uint8_t flags,
-                   uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort)
-{
-    uint8_t packet[MAX_PACKET_SIZE];
-    etherFrame* ether = (etherFrame*) packet;
-    ipFrame* ip = (ipFrame*) &ether->data;
-    ip->revSize = 0x45;
-    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
-    uint8_t *copyData;
-    uint16_t tmp16;
-
-
-    tcp->off = 0x5;
-    tcp->sourcePort = htons(tcpState.myPort);
-    tcp->destPort = htons(destPort);
-    tcp->reservedNS = 0;
-
-    if ((flags & PUSH) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn);
-        tcpState.runningSeqn =  tcpState.runningSeqn + tcpDataSize;
-    }
-    else if ((flags & SYN) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn++);
-    }
-    else if ((flags & FIN) > 0)
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn++);
-    }
-    else
-    {
-        tcp->sequenceNumber = htonl(tcpState.runningSeqn);
-    }
-
-
-
-     if((flags & ACK) > 0)
-     {
-         tcp->ackNumber = htonl(tcpState.ackToSend);
-     }
-     else
-     {
-         tcp->ackNumber = htonl(tcpState.ackToSend);
-     }
-
-    tcp->flags = flags;
-    tcp->win = htons(1280); // 1 MSS
-    tcp->sum = 0;
-    tcp->urp = 0;
-
-    //populate ipframe and ether frame
-    ip->flagsAndOffset = htons(0);
-    ip->length = htons(20);
-    ip->protocol = 6; //for tcp
-    ip->typeOfService = 0x00;
-    ip->ttl = 128;
-    // swap source and destination fields
-    uint8_t i = 0;
-     for (i = 0; i < HW_ADD_LENGTH; i++)
-     {
-         ether->destAddress[i] = serverMac[i];
-         ether->sourceAddress[i] = macAddress[i];
-     }
-     for (i = 0; i < IP_ADD_LENGTH; i++)
-     {
-         ip->destIp[i] = serverIP[i];
-         ip->sourceIp[i] = ipAddress[i];
-     }
-
-    uint8_t tcpHederSize = 20;
-    ether->frameType = htons(0x0800);
-
-    // adjust lengths
-    ip->length = htons(((ip->revSize & 0xF) * 4) + tcpHederSize + tcpDataSize);
-    // 32-bit sum over ip header
-    sum = 0;
-    etherSumWords(&ip->revSize, 10);
-    etherSumWords(ip->sourceIp, ((ip->revSize & 0xF) * 4) - 12);
-    ip->headerChecksum = getEtherChecksum();
-
-    // copy data
-    if (tcpDataSize > 0)
-    {
-        copyData = &tcp->data;
-        for (i = 0; i < tcpDataSize; i++)
-            copyData[i] = tcpData[i];
-    }
-    // 32-bit sum over pseudo-header
-    sum = 0;
-    etherSumWords(ip->sourceIp, 8);
-    tmp16 = ip->protocol;
-    sum += (tmp16 & 0xff) << 8;
-    uint16_t tcpLength = htons(tcpHederSize + tcpDataSize);
-    etherSumWords(&tcpLength, 2);
-    // add tcp header except checksum
-    etherSumWords(tcp, tcpHederSize);
-    if (tcpDataSize > 0)
-    {
-        etherSumWords(&tcp->data, tcpDataSize);
-    }
-    tcp->sum = getEtherChecksum();
-
-    etherPutPacket(ether,
-                   14 + ((ip->revSize & 0xF) * 4) + tcpHederSize + tcpDataSize);
-
-}
-
-uint8_t getTcpConnectionState()
-{
-    return tcpState.state;
-}
-
-
-void establishConnection(uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort)
-{
-    resetTcpStateTimer();
-    tcpState.state = SYN_SENT;
-    tcpState.serverPort = destPort;
-    sendTcpPacket(0, 0, SYN, serverMac, serverIP, destPort);
-
-}
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "tm4c123gh6pm.h"
+#include "eth0.h"
+#include "gpio.h"
+#include "spi0.h"
+#include "wait.h"
+#include "timer.h"
+#include "tcp.h"
+
+// sequence number comparisons modulo 2^32
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
+tcpControlBlock tcpConnections[TCP_MAX_CONNECTIONS];
+uint32_t tcpTicks = 0;
+uint32_t tcpRejectedSegments = 0;
+bool tcpHardwareChecksum = false; // the mac verified the tcp checksum already
+uint16_t tcpIpId = 0;
+tcpTimeWait tcpTimeWaits[TCP_TIME_WAIT_ENTRIES];
+uint16_t tcpNextPort = 0;
+uint32_t tcpEntropy = 0;      // arrival times of frames and keystrokes, see tcpAddEntropy
+uint32_t tcpCookieSecret = 0; // drawn from tcpEntropy when the first cookie needs it
+tcpSynSource tcpSynSources[TCP_SYN_SOURCES];
+tcpListener tcpListeners[TCP_MAX_LISTENERS];
+uint8_t tcpSynCount = 0;   // SYNs answered this second
+
+// mss values a cookie can carry in its 3 bit index, ascending
+const uint16_t tcpCookieMss[8] = { 256, 536, 1024, 1200, 1300, 1400, 1440, 1460 };
+
+void initTcp()
+{
+    uint8_t i;
+    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    {
+        tcpReleaseConnection(&tcpConnections[i]);
+    }
+    for (i = 0; i < TCP_TIME_WAIT_ENTRIES; i++)
+    {
+        tcpTimeWaits[i].timer = 0;
+    }
+    for (i = 0; i < TCP_SYN_SOURCES; i++)
+    {
+        tcpSynSources[i].count = 0;
+    }
+    for (i = 0; i < TCP_MAX_LISTENERS; i++)
+    {
+        tcpListeners[i].port = 0;
+    }
+    // the first port is drawn from tcpEntropy once it is needed, see tcpAllocatePort
+    tcpNextPort = 0;
+    // the timer has barely run this early in every boot, the secret waits for
+    // tcpEntropy to collect some real timing
+    tcpCookieSecret = 0;
+    startPeriodicTimerTicks(tcpTimerTick, 1);
+}
+
+// direct-mapped slot for a connection, collisions probe forward from here
+uint8_t tcpHashTuple(uint8_t remoteIp[], uint16_t remotePort, uint16_t localPort)
+{
+    return (remoteIp[3] ^ remotePort ^ (remotePort >> 8) ^ localPort
+            ^ (localPort >> 8)) % TCP_MAX_CONNECTIONS;
+}
+
+tcpControlBlock* tcpFindConnection(uint8_t remoteIp[], uint16_t remotePort,
+                                   uint16_t localPort)
+{
+    uint8_t i, slot;
+    tcpControlBlock* tcb;
+    slot = tcpHashTuple(remoteIp, remotePort, localPort);
+    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    {
+        tcb = &tcpConnections[(slot + i) % TCP_MAX_CONNECTIONS];
+        if (tcb->state != CLOSED && tcb->remotePort == remotePort
+                && tcb->localPort == localPort
+                && memcmp(tcb->remoteIp, remoteIp, IP_ADD_LENGTH) == 0)
+        {
+            return tcb;
+        }
+    }
+    return NULL;
+}
+
+tcpControlBlock* tcpAllocateConnection(uint8_t remoteMac[], uint8_t remoteIp[],
+                                       uint16_t remotePort, uint16_t localPort)
+{
+    uint8_t i, slot;
+    tcpControlBlock* tcb;
+    slot = tcpHashTuple(remoteIp, remotePort, localPort);
+    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    {
+        tcb = &tcpConnections[(slot + i) % TCP_MAX_CONNECTIONS];
+        if (tcb->state == CLOSED)
+        {
+            memcpy(tcb->remoteMac, remoteMac, HW_ADD_LENGTH);
+            memcpy(tcb->remoteIp, remoteIp, IP_ADD_LENGTH);
+            tcb->remotePort = remotePort;
+            tcb->localPort = localPort;
+            tcpBuildHeaderTemplate(tcb);
+            tcb->sndNxt = tcpInitialSequence(remoteIp, remotePort, localPort);
+            tcb->rcvNxt = 0;
+            tcb->stateTimer = TCP_SYN_TIMEOUT;
+            tcb->idleTime = 0;
+            tcb->idleTimeout = 0;
+            tcpSetKeepalive(tcb, TCP_KEEPALIVE_IDLE, TCP_KEEPALIVE_INTERVAL,
+                            TCP_KEEPALIVE_COUNT);
+            tcb->sndUna = tcb->sndNxt;
+            tcb->sndWnd = 0;
+            tcpSetMss(tcb, TCP_DEFAULT_MSS);
+            tcb->ssthresh = TCP_MAX_CWND;
+            tcb->recover = 0;
+            tcb->sackPermitted = true;
+            tcb->nagle = TCP_NAGLE_DEFAULT;
+            tcb->txSeq = tcb->sndNxt + 1; // first data byte follows the SYN
+            tcb->srtt = 0;
+            tcb->rttvar = 0;
+            tcb->rto = TCP_INITIAL_RTO;
+            return tcb;
+        }
+    }
+    return NULL;
+}
+
+void tcpReleaseConnection(tcpControlBlock* tcb)
+{
+    tcpSegment* segment;
+    while (tcb->rtxCount > 0)
+    {
+        segment = &tcb->rtxQueue[tcb->rtxHead];
+        if (segment->stored != ETHER_NOT_STORED)
+            etherFreeStoredPacket(segment->stored);
+        tcb->rtxHead = (tcb->rtxHead + 1) % TCP_RTX_QUEUE_SIZE;
+        tcb->rtxCount--;
+    }
+    tcb->state = CLOSED;
+    tcb->sndNxt = 0;
+    tcb->rcvNxt = 0;
+    tcb->localPort = 0;
+    tcb->remotePort = 0;
+    tcb->stateTimer = 0;
+    tcb->txStart = 0;
+    tcb->txLength = 0;
+    tcb->rtxHead = 0;
+    tcb->rtxCount = 0;
+    tcb->rtoTimer = 0;
+    tcb->retries = 0;
+    tcb->finPending = false;
+    tcb->dupAcks = 0;
+    tcb->inRecovery = false;
+    tcb->sackCount = 0;
+    tcb->corked = false;
+    tcb->pushPending = false;
+    tcb->flushTimer = 0;
+    tcb->persistTimer = 0;
+    tcb->persistBackoff = 0;
+    tcb->rxStart = 0;
+    tcb->rxLength = 0;
+    tcb->oooCount = 0;
+    tcb->ackPending = 0;
+    tcb->delayedAckTimer = 0;
+    tcb->callback = NULL;
+    tcb->writeBlocked = false;
+}
+
+// first option of a kind in a segment's header, NULL when absent
+uint8_t* tcpFindOption(tcpFrame* tcp, uint8_t kind)
+{
+    uint8_t* option = &tcp->data;
+    uint8_t* end = (uint8_t*) tcp + tcp->off * 4;
+
+    while (option < end)
+    {
+        if (option[0] == TCP_OPTION_END)
+            break;
+        if (option[0] == TCP_OPTION_NOP)
+        {
+            option++;
+            continue;
+        }
+        // a malformed length ends parsing rather than reading past the header
+        if (option + 1 >= end || option[1] < 2 || option + option[1] > end)
+            break;
+        if (option[0] == kind)
+            return option;
+        option += option[1];
+    }
+    return NULL;
+}
+
+// peer's maximum segment size from the options of a SYN, rfc 879 default when absent
+uint16_t tcpGetPeerMss(tcpFrame* tcp)
+{
+    uint8_t* option = tcpFindOption(tcp, TCP_OPTION_MSS);
+    if (option != NULL && option[1] == 4)
+        return (option[2] << 8) | option[3];
+    return TCP_DEFAULT_MSS;
+}
+
+// we never send more than the peer accepts, nor more than fits our own frame
+// the initial congestion window follows the mss, rfc 3390
+void tcpSetMss(tcpControlBlock* tcb, uint16_t peerMss)
+{
+    uint32_t window;
+    if (peerMss == 0)
+        peerMss = TCP_DEFAULT_MSS;
+    tcb->mss = (peerMss < TCP_LOCAL_MSS) ? peerMss : TCP_LOCAL_MSS;
+    window = (2 * tcb->mss > 4380) ? 2 * tcb->mss : 4380;
+    tcb->cwnd = (4 * tcb->mss < window) ? 4 * tcb->mss : window;
+}
+
+// fills in every header field that stays the same for the life of a connection
+// and sums them once: length, id and checksum are left 0 for tcpSendFrame, the
+// tcp ports are summed into the pseudo-header part of the checksum
+void tcpBuildHeaders(uint8_t header[], uint8_t remoteMac[], uint8_t remoteIp[],
+                     uint16_t localPort, uint16_t remotePort,
+                     uint32_t* ipHeaderSum, uint32_t* pseudoHeaderSum)
+{
+    etherFrame* ether = (etherFrame*) header;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + 20);
+    uint16_t tmp16;
+
+    memset(header, 0, TCP_HEADER_TEMPLATE_SIZE);
+    memcpy(ether->destAddress, remoteMac, HW_ADD_LENGTH);
+    memcpy(ether->sourceAddress, macAddress, HW_ADD_LENGTH);
+    ether->frameType = htons(0x0800);
+    ip->revSize = 0x45;
+    ip->typeOfService = 0x00;
+    ip->flagsAndOffset = htons(0);
+    ip->ttl = 128;
+    ip->protocol = 6; //for tcp
+    memcpy(ip->sourceIp, ipAddress, IP_ADD_LENGTH);
+    memcpy(ip->destIp, remoteIp, IP_ADD_LENGTH);
+    tcp->sourcePort = htons(localPort);
+    tcp->destPort = htons(remotePort);
+    tcp->off = 0x5;
+
+    sum = 0;
+    etherSumWords(&ip->revSize, 20);
+    *ipHeaderSum = sum;
+
+    sum = 0;
+    etherSumWords(ip->sourceIp, 8);
+    tmp16 = ip->protocol;
+    sum += (tmp16 & 0xff) << 8;
+    etherSumWords(tcp, 4);
+    *pseudoHeaderSum = sum;
+}
+
+void tcpBuildHeaderTemplate(tcpControlBlock* tcb)
+{
+    tcpBuildHeaders(tcb->headerTemplate, tcb->remoteMac, tcb->remoteIp,
+                    tcb->localPort, tcb->remotePort, &tcb->ipHeaderSum,
+                    &tcb->pseudoHeaderSum);
+}
+
+// resets the peer, tells the application and frees the slot, for a peer that has
+// stopped answering
+void tcpAbortConnection(tcpControlBlock* tcb)
+{
+    tcpTransmitSegment(tcb, tcb->sndNxt, 0, RST | ACK);
+    tcpNotify(tcb, TCP_EVENT_LOST);
+    tcpReleaseConnection(tcb);
+}
+
+// closes our half of the connection, the FIN follows any data still buffered
+void tcpClose(tcpControlBlock* tcb)
+{
+    switch (tcb->state)
+    {
+    case SYN_SENT:
+        tcpReleaseConnection(tcb);
+        break;
+    case SYN_RECEIVED:
+        tcpTransmitSegment(tcb, tcb->sndNxt, 0, RST | ACK);
+        tcpReleaseConnection(tcb);
+        break;
+    case ESTABLISHED:
+    case CLOSE_WAIT:
+        tcb->state = (tcb->state == ESTABLISHED) ? FIN_WAIT_1 : LAST_ACK;
+        tcb->finPending = true;
+        tcb->pushPending = true;
+        tcpOutput(tcb);
+        break;
+    default:
+        break;
+    }
+}
+
+// our FIN has gone out and everything up to and including it is acknowledged
+bool tcpIsFinAcked(tcpControlBlock* tcb)
+{
+    return (tcb->state == FIN_WAIT_1 || tcb->state == CLOSING
+            || tcb->state == LAST_ACK)
+            && !tcb->finPending && tcb->sndUna == tcb->sndNxt;
+}
+
+// the peer has nothing more to send, its FIN is already counted in rcvNxt
+void tcpReceiveFin(tcpControlBlock* tcb)
+{
+    switch (tcb->state)
+    {
+    case ESTABLISHED:
+        tcb->state = CLOSE_WAIT;
+        // the application closes its half when it is done sending, without one
+        // nothing here sends anymore, so our FIN goes with the ACK
+        tcb->ackPending++;
+        if (tcb->callback != NULL)
+            tcpNotify(tcb, TCP_EVENT_CLOSED);
+        else
+            tcpClose(tcb);
+        if (tcb->ackPending > 0)
+            tcpTransmitSegment(tcb, tcb->sndNxt, 0, ACK);
+        break;
+    case FIN_WAIT_1:
+        // simultaneous close, our FIN is still unacknowledged
+        tcpTransmitSegment(tcb, tcb->sndNxt, 0, ACK);
+        tcb->state = CLOSING;
+        break;
+    case FIN_WAIT_2:
+        tcpTransmitSegment(tcb, tcb->sndNxt, 0, ACK);
+        tcpEnterTimeWait(tcb);
+        break;
+    default:
+        break;
+    }
+}
+
+// keeps what is needed to answer a retransmitted FIN and frees the connection slot,
+// the oldest entry makes room when the table is full
+void tcpEnterTimeWait(tcpControlBlock* tcb)
+{
+    uint8_t i;
+    tcpTimeWait* timeWait = &tcpTimeWaits[0];
+    for (i = 0; i < TCP_TIME_WAIT_ENTRIES; i++)
+    {
+        if (tcpTimeWaits[i].timer < timeWait->timer)
+            timeWait = &tcpTimeWaits[i];
+    }
+    memcpy(timeWait->remoteMac, tcb->remoteMac, HW_ADD_LENGTH);
+    memcpy(timeWait->remoteIp, tcb->remoteIp, IP_ADD_LENGTH);
+    timeWait->localPort = tcb->localPort;
+    timeWait->remotePort = tcb->remotePort;
+    timeWait->sndNxt = tcb->sndNxt;
+    timeWait->rcvNxt = tcb->rcvNxt;
+    timeWait->timer = TCP_TIME_WAIT;
+    tcpReleaseConnection(tcb);
+}
+
+tcpTimeWait* tcpFindTimeWait(uint8_t remoteIp[], uint16_t remotePort,
+                             uint16_t localPort)
+{
+    uint8_t i;
+    for (i = 0; i < TCP_TIME_WAIT_ENTRIES; i++)
+    {
+        if (tcpTimeWaits[i].timer > 0 && tcpTimeWaits[i].remotePort == remotePort
+                && tcpTimeWaits[i].localPort == localPort
+                && memcmp(tcpTimeWaits[i].remoteIp, remoteIp, IP_ADD_LENGTH) == 0)
+        {
+            return &tcpTimeWaits[i];
+        }
+    }
+    return NULL;
+}
+
+void tcpSendTimeWaitAck(tcpTimeWait* timeWait)
+{
+    uint8_t packet[TCP_HEADER_TEMPLATE_SIZE];
+    uint32_t ipHeaderSum, pseudoHeaderSum;
+    tcpBuildHeaders(packet, timeWait->remoteMac, timeWait->remoteIp,
+                    timeWait->localPort, timeWait->remotePort, &ipHeaderSum,
+                    &pseudoHeaderSum);
+    tcpSendFrame(packet, ipHeaderSum, pseudoHeaderSum, timeWait->sndNxt,
+                 timeWait->rcvNxt, ACK, 0, 20, 0);
+}
+
+// next ephemeral port not used by a connection or a TIME_WAIT entry
+uint16_t tcpAllocatePort()
+{
+    uint8_t i;
+    uint16_t range = TCP_EPHEMERAL_LAST - TCP_EPHEMERAL_FIRST + 1;
+    bool used = true;
+    // start somewhere different after every reset
+    if (tcpNextPort == 0)
+    {
+        tcpAddEntropy(random32());
+        tcpNextPort = TCP_EPHEMERAL_FIRST + tcpEntropy % range;
+    }
+    while (used)
+    {
+        tcpAddEntropy(random32());
+        tcpNextPort = TCP_EPHEMERAL_FIRST + (tcpNextPort - TCP_EPHEMERAL_FIRST
+                + 1 + tcpEntropy % TCP_EPHEMERAL_STRIDE) % range;
+        used = false;
+        for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+        {
+            if (tcpConnections[i].state != CLOSED
+                    && tcpConnections[i].localPort == tcpNextPort)
+                used = true;
+        }
+        for (i = 0; i < TCP_TIME_WAIT_ENTRIES; i++)
+        {
+            if (tcpTimeWaits[i].timer > 0
+                    && tcpTimeWaits[i].localPort == tcpNextPort)
+                used = true;
+        }
+    }
+    return tcpNextPort;
+}
+
+// per source and overall budget of SYNs answered in the current second, a source
+// that finds every entry busy with others waits for the next second
+bool tcpIsSynAllowed(uint8_t ip[])
+{
+    uint8_t i;
+    tcpSynSource* source = NULL;
+    if (tcpSynCount >= TCP_SYN_LIMIT)
+    {
+        return false;
+    }
+    for (i = 0; i < TCP_SYN_SOURCES; i++)
+    {
+        if (tcpSynSources[i].count > 0
+                && memcmp(tcpSynSources[i].ip, ip, IP_ADD_LENGTH) == 0)
+        {
+            source = &tcpSynSources[i];
+            break;
+        }
+        if (tcpSynSources[i].count == 0 && source == NULL)
+            source = &tcpSynSources[i];
+    }
+    if (source == NULL || source->count >= TCP_SYN_SOURCE_LIMIT)
+    {
+        return false;
+    }
+    memcpy(source->ip, ip, IP_ADD_LENGTH);
+    source->count++;
+    tcpSynCount++;
+    return true;
+}
+
+// mixes an unpredictable value, such as random32 read when a frame arrives,
+// into the pool the secrets are drawn from
+void tcpAddEntropy(uint32_t value)
+{
+    tcpEntropy ^= value;
+    tcpEntropy *= 0x9E3779B1;
+    tcpEntropy ^= tcpEntropy >> 15;
+}
+
+// keyed hash of the connection's 4-tuple, the peer's isn and the time slot
+uint32_t tcpCookieHash(uint8_t ip[], uint16_t remotePort, uint16_t localPort,
+                       uint32_t peerIsn, uint8_t slot)
+{
+    uint32_t value[4];
+    uint32_t hash;
+    uint8_t i;
+    if (tcpCookieSecret == 0)
+    {
+        tcpAddEntropy(random32());
+        tcpCookieSecret = tcpEntropy | 1;
+    }
+    hash = tcpCookieSecret;
+    value[0] = ((uint32_t) ip[0] << 24) | ((uint32_t) ip[1] << 16)
+            | ((uint32_t) ip[2] << 8) | ip[3];
+    value[1] = ((uint32_t) remotePort << 16) | localPort;
+    value[2] = peerIsn;
+    value[3] = slot;
+    for (i = 0; i < 4; i++)
+    {
+        hash ^= value[i];
+        hash *= 0x9E3779B1;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+// rfc 6528, a 4 us clock plus a keyed hash of the 4-tuple, so a new connection
+// on a reused pair starts past the old one's sequence space and the isn of one
+// pair says nothing about another
+uint32_t tcpInitialSequence(uint8_t remoteIp[], uint16_t remotePort, uint16_t localPort)
+{
+    // slot 0xFF is never a cookie's, cookies use 5 bits
+    return getFineTicks() + tcpCookieHash(remoteIp, remotePort, localPort, 0, 0xFF);
+}
+
+// answers a SYN without keeping anything: our isn encodes the time slot (5 bits),
+// the peer's mss (3 bits), whether it offered sack (1 bit) and a 23 bit hash that
+// the final ACK must echo
+void tcpSendSynCookie(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    uint8_t reply[TCP_HEADER_TEMPLATE_SIZE + 8];
+    tcpFrame* replyTcp = (tcpFrame*) (reply + 14 + 20);
+    uint32_t ipHeaderSum, pseudoHeaderSum, cookie;
+    uint32_t peerIsn = ntohl(tcp->sequenceNumber);
+    uint16_t peerMss = tcpGetPeerMss(tcp);
+    uint8_t slot = (tcpTicks / (TCP_COOKIE_PERIOD * TIMER_TICKS_PER_SECOND)) & 0x1F;
+    bool sackPermitted = tcpFindOption(tcp, TCP_OPTION_SACK_PERMITTED) != NULL;
+    uint8_t mssIndex = 0;
+    uint8_t tcpHederSize = 20;
+
+    while (mssIndex < 7 && tcpCookieMss[mssIndex + 1] <= peerMss)
+        mssIndex++;
+    cookie = ((uint32_t) slot << 27) | ((uint32_t) mssIndex << 24)
+            | ((uint32_t) sackPermitted << 23)
+            | (tcpCookieHash(ip->sourceIp, ntohs(tcp->sourcePort),
+                             ntohs(tcp->destPort), peerIsn, slot) & 0x7FFFFF);
+
+    tcpBuildHeaders(reply, ether->sourceAddress, ip->sourceIp,
+                    ntohs(tcp->destPort), ntohs(tcp->sourcePort), &ipHeaderSum,
+                    &pseudoHeaderSum);
+    tcpHederSize += tcpWriteSynOptions(&replyTcp->data, sackPermitted);
+    tcpSendFrame(reply, ipHeaderSum, pseudoHeaderSum, cookie, peerIsn + 1,
+                 SYN | ACK, TCP_RX_BUFFER_SIZE, tcpHederSize, 0);
+}
+
+// the ACK completing a handshake we answered with a cookie: a cookie from this or
+// the previous time slot that matches the segment opens the connection established
+// returns NULL for anything else
+tcpControlBlock* tcpAcceptSynCookie(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    tcpControlBlock* tcb;
+    uint32_t seq = ntohl(tcp->sequenceNumber);
+    uint32_t ack = ntohl(tcp->ackNumber);
+    uint32_t cookie = ack - 1;
+    uint8_t slot = cookie >> 27;
+    uint8_t now = (tcpTicks / (TCP_COOKIE_PERIOD * TIMER_TICKS_PER_SECOND)) & 0x1F;
+
+    if (((now - slot) & 0x1F) > 1
+            || (cookie & 0x7FFFFF) != (tcpCookieHash(ip->sourceIp,
+                                                     ntohs(tcp->sourcePort),
+                                                     ntohs(tcp->destPort),
+                                                     seq - 1, slot) & 0x7FFFFF))
+    {
+        return NULL;
+    }
+    tcb = tcpAllocateConnection(ether->sourceAddress, ip->sourceIp,
+                                ntohs(tcp->sourcePort), ntohs(tcp->destPort));
+    if (tcb == NULL)
+    {
+        return NULL;
+    }
+    tcb->state = ESTABLISHED;
+    tcpSetIdleTimeout(tcb, TCP_IDLE_TIMEOUT);
+    tcpSetMss(tcb, tcpCookieMss[(cookie >> 24) & 0x7]);
+    tcb->sackPermitted = (cookie >> 23) & 1;
+    tcb->sndUna = ack;
+    tcb->sndNxt = ack;
+    tcb->txSeq = ack;
+    tcb->rcvNxt = seq;
+    tcb->rcvAdv = seq + TCP_RX_BUFFER_SIZE;
+    tcb->sndWnd = ntohs(tcp->win);
+    tcb->sndWl1 = seq;
+    tcb->sndWl2 = ack;
+    return tcb;
+}
+
+// probes a quiet peer after idle seconds, every interval seconds, and gives up after
+// count probes go unanswered, idle 0 turns probing off
+void tcpSetKeepalive(tcpControlBlock* tcb, uint16_t idle, uint16_t interval,
+                     uint8_t count)
+{
+    tcb->keepaliveIdle = idle;
+    tcb->keepaliveInterval = (interval > 0) ? interval : 1;
+    tcb->keepaliveCount = count;
+}
+
+void tcpSetIdleTimeout(tcpControlBlock* tcb, uint16_t seconds)
+{
+    tcb->idleTimeout = seconds;
+}
+
+// once per second for an established connection
+void tcpIdleTick(tcpControlBlock* tcb)
+{
+    uint16_t elapsed;
+
+    if (tcb->idleTime < 0xFFFF)
+        tcb->idleTime++;
+    if (tcb->idleTimeout > 0 && tcb->idleTime >= tcb->idleTimeout)
+    {
+        tcpAbortConnection(tcb);
+        return;
+    }
+    // unacknowledged data is already watched by the retransmission timer
+    if (tcb->keepaliveIdle == 0 || tcb->rtxCount > 0
+            || tcb->idleTime < tcb->keepaliveIdle)
+    {
+        return;
+    }
+    elapsed = tcb->idleTime - tcb->keepaliveIdle;
+    if (elapsed % tcb->keepaliveInterval == 0)
+    {
+        if (elapsed / tcb->keepaliveInterval >= tcb->keepaliveCount)
+        {
+            tcpAbortConnection(tcb);
+        }
+        else
+        {
+            // an old sequence number makes the peer answer with an ACK
+            tcpTransmitSegment(tcb, tcb->sndNxt - 1, 0, ACK);
+        }
+    }
+}
+
+bool tcpIsListeningPort(uint16_t port)
+{
+    return tcpFindListener(port) != NULL;
+}
+
+// copies data to the end of the retransmission buffer
+void tcpTxBufferWrite(tcpControlBlock* tcb, uint8_t* data, uint16_t size)
+{
+    uint16_t i;
+    uint16_t index = (tcb->txStart + tcb->txLength) % TCP_TX_BUFFER_SIZE;
+    for (i = 0; i < size; i++)
+    {
+        tcb->txBuffer[index] = data[i];
+        index = (index + 1) % TCP_TX_BUFFER_SIZE;
+    }
+    tcb->txLength += size;
+}
+
+// copies size bytes starting offset bytes into the retransmission buffer
+void tcpTxBufferRead(tcpControlBlock* tcb, uint16_t offset, uint8_t* data,
+                     uint16_t size)
+{
+    uint16_t i;
+    uint16_t index = (tcb->txStart + offset) % TCP_TX_BUFFER_SIZE;
+    for (i = 0; i < size; i++)
+    {
+        data[i] = tcb->txBuffer[index];
+        index = (index + 1) % TCP_TX_BUFFER_SIZE;
+    }
+}
+
+// sequence space taken by a segment, SYN and FIN count as one byte each
+uint32_t tcpSegmentEnd(tcpSegment* segment)
+{
+    uint32_t end = segment->seq + segment->length;
+    if ((segment->flags & SYN) > 0)
+        end++;
+    if ((segment->flags & FIN) > 0)
+        end++;
+    return end;
+}
+
+// jacobson/karels, rfc 6298 section 2
+void tcpUpdateRto(tcpControlBlock* tcb, uint32_t rtt)
+{
+    int32_t delta;
+    uint32_t rto;
+    if (rtt == 0)
+        rtt = 1; // below tick resolution, and srtt == 0 means no sample yet
+    if (tcb->srtt == 0)
+    {
+        tcb->srtt = rtt << 3;
+        tcb->rttvar = rtt << 1;
+    }
+    else
+    {
+        delta = (int32_t) rtt - (tcb->srtt >> 3);
+        tcb->srtt += delta;
+        if (delta < 0)
+            delta = -delta;
+        tcb->rttvar += delta - (tcb->rttvar >> 2);
+    }
+    rto = (tcb->srtt >> 3) + tcb->rttvar;
+    if (rto < TCP_MIN_RTO)
+        rto = TCP_MIN_RTO;
+    if (rto > TCP_MAX_RTO)
+        rto = TCP_MAX_RTO;
+    tcb->rto = rto;
+}
+
+// drops everything the peer has acknowledged from the retransmission queue
+// and opens the congestion window
+void tcpProcessAck(tcpControlBlock* tcb, uint32_t ack)
+{
+    tcpSegment* segment;
+    uint32_t released, acked;
+    uint8_t i;
+    bool sampled = false;
+
+    if (SEQ_LEQ(ack, tcb->sndUna) || SEQ_GT(ack, tcb->sndNxt))
+    {
+        return;
+    }
+    acked = ack - tcb->sndUna;
+    tcb->sndUna = ack;
+
+    // blocks the cumulative ack has passed
+    while (tcb->sackCount > 0
+            && SEQ_LEQ(tcb->sackList[0].seq + tcb->sackList[0].length, ack))
+    {
+        for (i = 0; i + 1 < tcb->sackCount; i++)
+            tcb->sackList[i] = tcb->sackList[i + 1];
+        tcb->sackCount--;
+    }
+
+    while (tcb->rtxCount > 0)
+    {
+        segment = &tcb->rtxQueue[tcb->rtxHead];
+        if (SEQ_GT(tcpSegmentEnd(segment), ack))
+            break;
+        if (!segment->retransmitted && !sampled)
+        {
+            tcpUpdateRto(tcb, tcpTicks - segment->sentTick);
+            sampled = true;
+        }
+        if (segment->stored != ETHER_NOT_STORED)
+            etherFreeStoredPacket(segment->stored);
+        tcb->rtxHead = (tcb->rtxHead + 1) % TCP_RTX_QUEUE_SIZE;
+        tcb->rtxCount--;
+    }
+
+    if (SEQ_GT(ack, tcb->txSeq))
+    {
+        released = ack - tcb->txSeq;
+        if (released > tcb->txLength)
+            released = tcb->txLength;
+        tcb->txStart = (tcb->txStart + released) % TCP_TX_BUFFER_SIZE;
+        tcb->txLength -= released;
+        tcb->txSeq += released;
+    }
+
+    tcb->dupAcks = 0;
+    if (tcb->inRecovery)
+    {
+        if (SEQ_LT(ack, tcb->recover) && tcb->rtxCount > 0)
+        {
+            // partial ack, the next hole is lost too: resend it at once and
+            // deflate the window by what left the network, rfc 6582. With sack
+            // the hole may have been resent already, see tcpResendHole
+            if (tcb->sackCount > 0)
+                tcpResendHole(tcb);
+            else
+                tcpResendSegment(tcb);
+            tcb->cwnd = (tcb->cwnd > acked + tcb->mss) ? tcb->cwnd - acked : tcb->mss;
+            if (acked >= tcb->mss)
+                tcb->cwnd += tcb->mss;
+        }
+        else
+        {
+            tcb->inRecovery = false;
+            tcb->cwnd = tcb->ssthresh;
+        }
+    }
+    else if (tcb->cwnd < tcb->ssthresh)
+    {
+        // slow start, at most one mss per ack (rfc 3465 with L = 1)
+        tcb->cwnd += (acked < tcb->mss) ? acked : tcb->mss;
+    }
+    else
+    {
+        // congestion avoidance, about one mss per round trip
+        tcb->cwnd += ((uint32_t) tcb->mss * tcb->mss) / tcb->cwnd + 1;
+    }
+    if (tcb->cwnd > TCP_MAX_CWND)
+        tcb->cwnd = TCP_MAX_CWND;
+
+    // new data acknowledged, restart the timer for whatever is still in flight
+    tcb->retries = 0;
+    if (tcb->rtxCount > 0)
+        tcb->rtoTimer = tcb->rto;
+    else
+        tcb->rtoTimer = 0;
+}
+
+// half the data in flight, but never less than two segments, rfc 5681 equation 4
+uint32_t tcpLossThreshold(tcpControlBlock* tcb)
+{
+    uint32_t flight = (tcb->sndNxt - tcb->sndUna) / 2;
+    return (flight > 2 * (uint32_t) tcb->mss) ? flight : 2 * (uint32_t) tcb->mss;
+}
+
+// an ACK that repeats sndUna while data is outstanding means a segment after
+// it arrived out of order, the third in a row starts fast retransmit
+void tcpDuplicateAck(tcpControlBlock* tcb)
+{
+    if (tcb->rtxCount == 0)
+    {
+        return;
+    }
+    tcb->dupAcks++;
+    if (tcb->inRecovery)
+    {
+        // each duplicate means a segment left the network, let another one in,
+        // a resent hole first
+        tcb->cwnd += tcb->mss;
+        if (tcb->cwnd > TCP_MAX_CWND)
+            tcb->cwnd = TCP_MAX_CWND;
+        tcpResendHole(tcb);
+    }
+    else if (tcb->dupAcks == TCP_DUPACK_THRESHOLD
+            && SEQ_LEQ(tcb->recover, tcb->sndUna))
+    {
+        tcb->ssthresh = tcpLossThreshold(tcb);
+        tcb->cwnd = tcb->ssthresh + TCP_DUPACK_THRESHOLD * tcb->mss;
+        tcb->recover = tcb->sndNxt;
+        tcb->inRecovery = true;
+        tcb->rtxHigh = tcb->sndUna;
+        tcpResendSegment(tcb);
+    }
+}
+
+// takes the peer's window from a segment unless an older segment is being replayed, rfc 793
+void tcpUpdateSendWindow(tcpControlBlock* tcb, uint32_t seq, uint32_t ack,
+                         uint16_t window)
+{
+    if (tcb->state == SYN_SENT || tcb->state == SYN_RECEIVED
+            || SEQ_LT(tcb->sndWl1, seq)
+            || (tcb->sndWl1 == seq && SEQ_LEQ(tcb->sndWl2, ack)))
+    {
+        tcb->sndWnd = window;
+        tcb->sndWl1 = seq;
+        tcb->sndWl2 = ack;
+        if (window > 0)
+        {
+            tcb->persistTimer = 0;
+            tcb->persistBackoff = 0;
+        }
+    }
+}
+
+// resends the oldest unacknowledged segment
+void tcpResendSegment(tcpControlBlock* tcb)
+{
+    tcpSegment* segment = &tcb->rtxQueue[tcb->rtxHead];
+    if (SEQ_GT(tcpSegmentEnd(segment), tcb->rtxHigh))
+        tcb->rtxHigh = tcpSegmentEnd(segment);
+    tcpRetransmitSegment(tcb, segment);
+}
+
+// records [seq, end) in a sorted list of ranges, merging it with ranges it touches
+// returns false if the list had no room, the range is then left out
+bool tcpAddRange(tcpRange list[], uint8_t* count, uint8_t size, uint32_t seq,
+                 uint32_t end)
+{
+    uint32_t rangeEnd;
+    uint8_t i = 0, j;
+
+    while (i < *count)
+    {
+        rangeEnd = list[i].seq + list[i].length;
+        if (SEQ_LEQ(list[i].seq, end) && SEQ_LEQ(seq, rangeEnd))
+        {
+            if (SEQ_LT(list[i].seq, seq))
+                seq = list[i].seq;
+            if (SEQ_GT(rangeEnd, end))
+                end = rangeEnd;
+            for (j = i; j + 1 < *count; j++)
+                list[j] = list[j + 1];
+            (*count)--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    if (*count == size)
+    {
+        return false;
+    }
+    i = 0;
+    while (i < *count && SEQ_LT(list[i].seq, seq))
+        i++;
+    for (j = *count; j > i; j--)
+        list[j] = list[j - 1];
+    list[i].seq = seq;
+    list[i].length = end - seq;
+    (*count)++;
+    return true;
+}
+
+// adds the blocks of a SACK option to the scoreboard, blocks outside the data in
+// flight are stale or bogus and ignored
+void tcpUpdateScoreboard(tcpControlBlock* tcb, tcpFrame* tcp)
+{
+    uint8_t* option = tcpFindOption(tcp, TCP_OPTION_SACK);
+    uint8_t* block;
+    uint32_t left, right;
+
+    if (option == NULL || !tcb->sackPermitted)
+    {
+        return;
+    }
+    for (block = option + 2; block + 8 <= option + option[1]; block += 8)
+    {
+        left = ((uint32_t) block[0] << 24) | ((uint32_t) block[1] << 16)
+                | ((uint32_t) block[2] << 8) | block[3];
+        right = ((uint32_t) block[4] << 24) | ((uint32_t) block[5] << 16)
+                | ((uint32_t) block[6] << 8) | block[7];
+        if (SEQ_LEQ(right, left) || SEQ_LEQ(left, tcb->sndUna)
+                || SEQ_GT(right, tcb->sndNxt))
+            continue;
+        tcpAddRange(tcb->sackList, &tcb->sackCount, TCP_MAX_SACK_BLOCKS, left, right);
+    }
+}
+
+// true if the peer reported all of [seq, end) received
+bool tcpIsSacked(tcpControlBlock* tcb, uint32_t seq, uint32_t end)
+{
+    uint8_t i;
+    for (i = 0; i < tcb->sackCount; i++)
+    {
+        if (SEQ_LEQ(tcb->sackList[i].seq, seq)
+                && SEQ_GEQ(tcb->sackList[i].seq + tcb->sackList[i].length, end))
+            return true;
+    }
+    return false;
+}
+
+// during fast recovery, resends the next segment the peer is missing: below its
+// highest sacked byte, not covered by a block and not resent in this recovery yet,
+// rfc 6675 with one segment per incoming ACK instead of a pipe estimate
+void tcpResendHole(tcpControlBlock* tcb)
+{
+    tcpSegment* segment;
+    tcpRange* highest;
+    uint32_t end;
+    uint8_t i;
+
+    if (tcb->sackCount == 0)
+    {
+        return;
+    }
+    highest = &tcb->sackList[tcb->sackCount - 1];
+    for (i = 0; i < tcb->rtxCount; i++)
+    {
+        segment = &tcb->rtxQueue[(tcb->rtxHead + i) % TCP_RTX_QUEUE_SIZE];
+        end = tcpSegmentEnd(segment);
+        if (SEQ_GT(end, highest->seq + highest->length))
+            break;
+        if (SEQ_LT(segment->seq, tcb->rtxHigh) || tcpIsSacked(tcb, segment->seq, end))
+            continue;
+        tcb->rtxHigh = end;
+        tcpRetransmitSegment(tcb, segment);
+        return;
+    }
+}
+
+// retransmission timeout: backs the timer off and restarts from one segment,
+// duplicate ACKs from before the timeout must not start a fast recovery
+void tcpRetransmit(tcpControlBlock* tcb)
+{
+    if (tcb->retries >= TCP_MAX_RETRIES)
+    {
+        tcpAbortConnection(tcb);
+        return;
+    }
+    if (tcb->retries == 0)
+        tcb->ssthresh = tcpLossThreshold(tcb);
+    tcb->cwnd = tcb->mss;
+    tcb->dupAcks = 0;
+    tcb->inRecovery = false;
+    tcb->recover = tcb->sndNxt;
+    // the peer may discard data it sacked, rfc 2018 section 8
+    tcb->sackCount = 0;
+    tcb->retries++;
+    tcb->rto = (tcb->rto * 2 > TCP_MAX_RTO) ? TCP_MAX_RTO : tcb->rto * 2;
+    tcb->rtoTimer = tcb->rto;
+    tcpResendSegment(tcb);
+}
+
+// zero window probe: an old sequence number makes the peer answer with its current window
+void tcpSendWindowProbe(tcpControlBlock* tcb)
+{
+    if (tcb->sndWnd > 0 || tcpUnsentLength(tcb) == 0)
+    {
+        tcb->persistBackoff = 0;
+        return;
+    }
+    tcpTransmitSegment(tcb, tcb->sndUna - 1, 0, ACK);
+    tcb->persistBackoff = (tcb->persistBackoff * 2 > TCP_MAX_PERSIST) ?
+            TCP_MAX_PERSIST : tcb->persistBackoff * 2;
+    tcb->persistTimer = tcb->persistBackoff;
+}
+
+// called every timer tick: retransmission timers, and once per second keepalive
+// and idle timeouts, TIME_WAIT expiry, and drops half-open and half-closed
+// connections so a lost handshake or FIN does not hold a slot forever
+void tcpTimerTick()
+{
+    uint8_t i;
+    tcpControlBlock* tcb;
+    bool slowTick;
+
+    tcpTicks++;
+    slowTick = (tcpTicks % TIMER_TICKS_PER_SECOND) == 0;
+    for (i = 0; slowTick && i < TCP_TIME_WAIT_ENTRIES; i++)
+    {
+        if (tcpTimeWaits[i].timer > 0)
+            tcpTimeWaits[i].timer--;
+    }
+    for (i = 0; slowTick && i < TCP_SYN_SOURCES; i++)
+    {
+        tcpSynSources[i].count = 0;
+    }
+    if (slowTick)
+        tcpSynCount = 0;
+    for (i = 0; i < TCP_MAX_CONNECTIONS; i++)
+    {
+        tcb = &tcpConnections[i];
+        if (tcb->state == CLOSED)
+            continue;
+        if (tcb->rtoTimer > 0)
+        {
+            tcb->rtoTimer--;
+            if (tcb->rtoTimer == 0 && tcb->rtxCount > 0)
+                tcpRetransmit(tcb);
+        }
+        if (tcb->persistTimer > 0)
+        {
+            tcb->persistTimer--;
+            if (tcb->persistTimer == 0)
+                tcpSendWindowProbe(tcb);
+        }
+        if (tcb->flushTimer > 0)
+        {
+            tcb->flushTimer--;
+            if (tcb->flushTimer == 0)
+                tcpFlush(tcb);
+        }
+        if (tcb->delayedAckTimer > 0)
+        {
+            tcb->delayedAckTimer--;
+            if (tcb->delayedAckTimer == 0 && tcb->ackPending > 0)
+                sendTcpPacket(tcb, 0, 0, ACK);
+        }
+        if (slowTick && tcb->state == ESTABLISHED)
+        {
+            tcpIdleTick(tcb);
+        }
+        else if (slowTick && (tcb->state == SYN_SENT || tcb->state == SYN_RECEIVED))
+        {
+            if (tcb->stateTimer > 0)
+                tcb->stateTimer--;
+            if (tcb->stateTimer == 0)
+                tcpAbortConnection(tcb);
+        }
+        else if (slowTick && tcb->state == FIN_WAIT_2)
+        {
+            // the peer may never close its half
+            if (tcb->stateTimer > 0)
+                tcb->stateTimer--;
+            if (tcb->stateTimer == 0)
+                tcpReleaseConnection(tcb);
+        }
+    }
+}
+
+bool etherIsTcp(uint8_t packet[])
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    bool ok = false;
+
+    if ((ip->protocol == 0x06)
+            && (tcpIsListeningPort(ntohs(tcp->destPort))
+                    || tcpFindConnection(ip->sourceIp, ntohs(tcp->sourcePort),
+                                         ntohs(tcp->destPort)) != NULL
+                    || tcpFindTimeWait(ip->sourceIp, ntohs(tcp->sourcePort),
+                                       ntohs(tcp->destPort)) != NULL))
+    {
+        ok = true;
+    }
+
+    return ok;
+}
+
+// verifies the tcp checksum over pseudo-header, header and payload, rfc 793,
+// size is the frame as received, an ip length that claims more is dropped
+bool tcpIsChecksumValid(uint8_t packet[], uint16_t size)
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    uint16_t ipHeaderSize = (ip->revSize & 0xF) * 4;
+    uint16_t tcpLength;
+    uint16_t tmp16;
+
+    if (size < 14 + 20 || ntohs(ip->length) > size - 14
+            || ntohs(ip->length) < ipHeaderSize + 20
+            || ntohs(ip->length) - ipHeaderSize < tcp->off * 4 || tcp->off < 5)
+    {
+        return false;
+    }
+    if (tcpHardwareChecksum)
+    {
+        return true;
+    }
+    tcpLength = ntohs(ip->length) - ipHeaderSize;
+    sum = 0;
+    etherSumWords(ip->sourceIp, 8);
+    tmp16 = ip->protocol;
+    sum += (tmp16 & 0xff) << 8;
+    tmp16 = htons(tcpLength);
+    etherSumWords(&tmp16, 2);
+    etherSumWords(tcp, tcpLength);
+    return getEtherChecksum() == 0;
+}
+
+// for a mac that checks tcp checksums itself, the enc28j60 does not
+void tcpSetHardwareChecksum(bool verified)
+{
+    tcpHardwareChecksum = verified;
+}
+
+uint32_t tcpGetRejectedSegments()
+{
+    return tcpRejectedSegments;
+}
+
+void processTcpMessage(uint8_t packet[], uint16_t size)
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + ((ip->revSize & 0xF) * 4));
+    uint32_t receivedTcpSize = ntohs(ip->length) - ((ip->revSize & 0xF) * 4);
+    uint32_t receivedPayloadSize = receivedTcpSize - tcp->off * 4;
+    uint32_t seq = ntohl(tcp->sequenceNumber);
+    uint8_t* payload = (uint8_t*) tcp + tcp->off * 4;
+    uint32_t ack = ntohl(tcp->ackNumber);
+    uint16_t readable = 0;
+    tcpControlBlock* tcb;
+    tcpTimeWait* timeWait;
+
+    // a corrupted segment is dropped before it can touch connection state, the
+    // peer retransmits it
+    if (!tcpIsChecksumValid(packet, size))
+    {
+        tcpRejectedSegments++;
+        return;
+    }
+
+    tcb = tcpFindConnection(ip->sourceIp, ntohs(tcp->sourcePort),
+                            ntohs(tcp->destPort));
+    if (tcb == NULL)
+    {
+        timeWait = tcpFindTimeWait(ip->sourceIp, ntohs(tcp->sourcePort),
+                                   ntohs(tcp->destPort));
+        if (timeWait != NULL)
+        {
+            // a new SYN past the old sequence space may reuse the pair at once,
+            // rfc 1122 4.2.2.13, a RST is ignored (rfc 1337), a retransmitted FIN
+            // means our last ACK was lost
+            if ((tcp->flags & SYN) > 0 && (tcp->flags & ACK) == 0
+                    && SEQ_GT(seq, timeWait->rcvNxt))
+            {
+                timeWait->timer = 0;
+            }
+            else
+            {
+                if ((tcp->flags & FIN) > 0)
+                {
+                    tcpSendTimeWaitAck(timeWait);
+                    timeWait->timer = TCP_TIME_WAIT;
+                }
+                return;
+            }
+        }
+        // a listening port keeps no state before the handshake completes: a SYN
+        // is answered with a cookie, an ACK carrying a valid one opens the connection
+        if (!tcpIsListeningPort(ntohs(tcp->destPort)))
+        {
+            return;
+        }
+        if ((tcp->flags & SYN) > 0 && (tcp->flags & ACK) == 0)
+        {
+            if (tcpIsSynAllowed(ip->sourceIp))
+            {
+                tcpSendSynCookie(packet);
+            }
+            return;
+        }
+        if ((tcp->flags & (SYN | RST | ACK)) != ACK)
+        {
+            return;
+        }
+        tcb = tcpAcceptSynCookie(packet);
+        if (tcb == NULL)
+        {
+            return;
+        }
+        tcb->callback = tcpFindListener(ntohs(tcp->destPort))->callback;
+        tcpNotify(tcb, TCP_EVENT_CONNECTED);
+        if (tcb->state == CLOSED)
+        {
+            return;
+        }
+    }
+
+    tcb->idleTime = 0;
+
+    if ((tcp->flags & RST) > 0)
+    {
+        tcpNotify(tcb, TCP_EVENT_LOST);
+        tcpReleaseConnection(tcb);
+        return;
+    }
+
+    if ((tcp->flags & ACK) > 0)
+    {
+        tcpUpdateScoreboard(tcb, tcp);
+        // a pure ACK that moves neither sndUna nor the window, rfc 5681 section 2
+        if (ack == tcb->sndUna && receivedPayloadSize == 0
+                && (tcp->flags & (SYN | FIN)) == 0 && ntohs(tcp->win) == tcb->sndWnd)
+        {
+            tcpDuplicateAck(tcb);
+        }
+        else
+        {
+            tcpProcessAck(tcb, ack);
+        }
+        tcpUpdateSendWindow(tcb, seq, ack, ntohs(tcp->win));
+    }
+
+    // our FIN acknowledged
+    if (tcpIsFinAcked(tcb))
+    {
+        if (tcb->state == FIN_WAIT_1)
+        {
+            tcb->state = FIN_WAIT_2;
+            tcb->stateTimer = TCP_FIN_WAIT_2_TIMEOUT;
+        }
+        else if (tcb->state == CLOSING)
+        {
+            tcpEnterTimeWait(tcb);
+            return;
+        }
+        else
+        {
+            tcpReleaseConnection(tcb);
+            return;
+        }
+    }
+
+    switch (tcb->state)
+    {
+    case SYN_RECEIVED:
+        if ((tcp->flags & ACK) > 0 && tcb->sndUna == tcb->sndNxt)
+        {
+            tcb->state = ESTABLISHED;
+        }
+        break;
+    case SYN_SENT:
+        if ((tcp->flags & SYN) > 0 && (tcp->flags & ACK) > 0
+                && tcb->sndUna == tcb->sndNxt)
+        {
+            tcb->rcvNxt = seq + 1;
+            tcpSetMss(tcb, tcpGetPeerMss(tcp));
+            tcb->sackPermitted = tcpFindOption(tcp, TCP_OPTION_SACK_PERMITTED) != NULL;
+            tcb->state = ESTABLISHED;
+            sendTcpPacket(tcb, 0, 0, ACK);
+            tcpNotify(tcb, TCP_EVENT_CONNECTED);
+        }
+        break;
+    case ESTABLISHED:
+    case FIN_WAIT_1:
+    case FIN_WAIT_2:
+        if (receivedPayloadSize > 0)
+        {
+            readable = tcpReceiveSegment(tcb, seq, payload,
+                                         receivedPayloadSize);
+        }
+        if (readable > 0)
+        {
+            tcb->ackPending++;
+            if (tcb->callback != NULL)
+            {
+                tcpNotify(tcb, TCP_EVENT_READABLE);
+            }
+            else
+            {
+                // no application behind this connection, keep the window open
+                tcpReleaseReceived(tcb, tcpReceivedLength(tcb));
+            }
+            if (tcb->state == CLOSED)
+            {
+                return;
+            }
+        }
+        // a FIN only counts once everything before it has arrived
+        if ((tcp->flags & FIN) > 0 && seq + receivedPayloadSize == tcb->rcvNxt)
+        {
+            tcb->rcvNxt++;
+            tcpReceiveFin(tcb);
+        }
+        else if (receivedPayloadSize > 0 || (tcp->flags & FIN) > 0)
+        {
+            // duplicate, out of order or gap filling data is acknowledged at once so the
+            // peer learns rcvNxt, in order data every second segment (rfc 1122), unless a
+            // reply sent meanwhile already carried the ACK
+            if (readable != receivedPayloadSize || (tcp->flags & FIN) > 0
+                    || tcb->ackPending >= 2)
+            {
+                sendTcpPacket(tcb, 0, 0, ACK);
+            }
+            else if (tcb->ackPending > 0 && tcb->delayedAckTimer == 0)
+            {
+                tcb->delayedAckTimer = TCP_DELAYED_ACK;
+            }
+        }
+        break;
+    case CLOSE_WAIT:
+    case CLOSING:
+    case LAST_ACK:
+        // the peer's FIN is in, a retransmission of it lost our ACK
+        if ((tcp->flags & FIN) > 0)
+        {
+            sendTcpPacket(tcb, 0, 0, ACK);
+        }
+        break;
+    default:
+        break;
+    }
+
+    // acknowledgements and window updates may let queued data go out
+    tcpOutput(tcb);
+
+    if (tcb->writeBlocked && tcpWriteSpace(tcb) > 0)
+    {
+        tcb->writeBlocked = false;
+        tcpNotify(tcb, TCP_EVENT_WRITABLE);
+    }
+    return;
+}
+
+// copies data into rxBuffer, offset bytes past rcvNxt
+void tcpRxBufferWrite(tcpControlBlock* tcb, uint16_t offset, uint8_t* data,
+                      uint16_t size)
+{
+    uint16_t i;
+    uint16_t index = (tcb->rxStart + tcb->rxLength + offset) % TCP_RX_BUFFER_SIZE;
+    for (i = 0; i < size; i++)
+    {
+        tcb->rxBuffer[index] = data[i];
+        index = (index + 1) % TCP_RX_BUFFER_SIZE;
+    }
+}
+
+// records [seq, seq + length) as held out of order, merging it with ranges it touches
+// if there is no room the data stays unrecorded and the peer sends it again
+void tcpAddOutOfOrder(tcpControlBlock* tcb, uint32_t seq, uint16_t length)
+{
+    tcb->oooRecent = seq;
+    tcpAddRange(tcb->oooList, &tcb->oooCount, TCP_MAX_OOO_SEGMENTS, seq, seq + length);
+}
+
+// stores a segment's payload in rxBuffer, trimmed to the window, and advances rcvNxt
+// over it and any out of order data it connects to
+// returns the number of bytes that became readable
+uint16_t tcpReceiveSegment(tcpControlBlock* tcb, uint32_t seq, uint8_t* data,
+                           uint16_t length)
+{
+    uint32_t offset, window, end;
+    uint16_t readable = tcb->rxLength;
+    uint8_t i;
+
+    if (SEQ_LT(seq, tcb->rcvNxt))
+    {
+        offset = tcb->rcvNxt - seq;
+        if (offset >= length)
+            return 0;
+        seq += offset;
+        data += offset;
+        length -= offset;
+    }
+    window = TCP_RX_BUFFER_SIZE - tcb->rxLength;
+    offset = seq - tcb->rcvNxt;
+    if (offset >= window)
+        return 0;
+    if (length > window - offset)
+        length = window - offset;
+
+    tcpRxBufferWrite(tcb, offset, data, length);
+    if (offset > 0)
+    {
+        tcpAddOutOfOrder(tcb, seq, length);
+        return 0;
+    }
+
+    tcb->rcvNxt += length;
+    tcb->rxLength += length;
+    while (tcb->oooCount > 0 && SEQ_LEQ(tcb->oooList[0].seq, tcb->rcvNxt))
+    {
+        end = tcb->oooList[0].seq + tcb->oooList[0].length;
+        if (SEQ_GT(end, tcb->rcvNxt))
+        {
+            tcb->rxLength += end - tcb->rcvNxt;
+            tcb->rcvNxt = end;
+        }
+        for (i = 0; i + 1 < tcb->oooCount; i++)
+            tcb->oooList[i] = tcb->oooList[i + 1];
+        tcb->oooCount--;
+    }
+    return tcb->rxLength - readable;
+}
+
+uint16_t tcpReceivedLength(tcpControlBlock* tcb)
+{
+    return tcb->rxLength;
+}
+
+// copies received data without consuming it
+void tcpPeekReceived(tcpControlBlock* tcb, uint16_t offset, uint8_t* data,
+                     uint16_t size)
+{
+    uint16_t i;
+    uint16_t index = (tcb->rxStart + offset) % TCP_RX_BUFFER_SIZE;
+    for (i = 0; i < size; i++)
+    {
+        data[i] = tcb->rxBuffer[index];
+        index = (index + 1) % TCP_RX_BUFFER_SIZE;
+    }
+}
+
+// frees read data and announces the larger window once it is worth a segment (rfc 1122 sws avoidance)
+void tcpReleaseReceived(tcpControlBlock* tcb, uint16_t size)
+{
+    uint32_t window, threshold;
+    if (size > tcb->rxLength)
+        size = tcb->rxLength;
+    tcb->rxStart = (tcb->rxStart + size) % TCP_RX_BUFFER_SIZE;
+    tcb->rxLength -= size;
+
+    window = TCP_RX_BUFFER_SIZE - tcb->rxLength;
+    threshold = (TCP_RX_BUFFER_SIZE / 2 < TCP_LOCAL_MSS) ? TCP_RX_BUFFER_SIZE / 2 : TCP_LOCAL_MSS;
+    if ((tcb->state == ESTABLISHED || tcb->state == FIN_WAIT_1
+            || tcb->state == FIN_WAIT_2)
+            && window - (tcb->rcvAdv - tcb->rcvNxt) >= threshold)
+    {
+        sendTcpPacket(tcb, 0, 0, ACK);
+    }
+}
+
+// bytes in txBuffer that have not been sent yet
+uint32_t tcpUnsentLength(tcpControlBlock* tcb)
+{
+    uint32_t end = tcb->txSeq + tcb->txLength;
+    if (SEQ_LT(tcb->sndNxt, end))
+        return end - tcb->sndNxt;
+    return 0;
+}
+
+// sends sequence space starting at sndNxt and keeps it for retransmission
+void tcpQueueSegment(tcpControlBlock* tcb, uint16_t length, uint8_t flags)
+{
+    tcpSegment* segment;
+    segment = &tcb->rtxQueue[(tcb->rtxHead + tcb->rtxCount) % TCP_RTX_QUEUE_SIZE];
+    tcb->rtxCount++;
+    segment->seq = tcb->sndNxt;
+    segment->length = length;
+    segment->flags = flags;
+    segment->retransmitted = false;
+    segment->sentTick = tcpTicks;
+    tcb->sndNxt = tcpSegmentEnd(segment);
+    if (tcb->rtoTimer == 0)
+    {
+        tcb->rtoTimer = tcb->rto;
+    }
+    tcpStoreSegment(tcb, segment);
+}
+
+// sends as much buffered data as the peer's and the congestion window allow, in segments
+// of up to the negotiated mss
+void tcpOutput(tcpControlBlock* tcb)
+{
+    uint32_t unsent, inFlight, window, usable, length;
+    uint8_t flags;
+
+    // data and our FIN go out until the FIN is sent
+    if (tcb->state != ESTABLISHED && tcb->state != CLOSE_WAIT
+            && tcb->state != FIN_WAIT_1 && tcb->state != LAST_ACK)
+    {
+        return;
+    }
+
+    while (tcb->rtxCount < TCP_RTX_QUEUE_SIZE)
+    {
+        unsent = tcpUnsentLength(tcb);
+        if (unsent == 0)
+        {
+            if (tcb->finPending)
+            {
+                tcb->finPending = false;
+                tcpQueueSegment(tcb, 0, FIN | ACK);
+            }
+            break;
+        }
+        inFlight = tcb->sndNxt - tcb->sndUna;
+        window = (tcb->cwnd < tcb->sndWnd) ? tcb->cwnd : tcb->sndWnd;
+        usable = (window > inFlight) ? window - inFlight : 0;
+        if (usable == 0)
+        {
+            break;
+        }
+        length = unsent;
+        if (length > usable)
+            length = usable;
+        if (length > tcb->mss)
+            length = tcb->mss;
+        // sender sws avoidance: a window too small for a full segment is left to
+        // grow while acknowledgements are still due, rfc 1122 4.2.3.4
+        if (length < tcb->mss && length < unsent && inFlight > 0)
+        {
+            break;
+        }
+        // a short tail waits for more data: behind unacknowledged data with nagle,
+        // or while corked, but never past the flush timeout or a push
+        if (length < tcb->mss && length == unsent && !tcb->pushPending
+                && (tcb->corked || (tcb->nagle && tcb->sndNxt != tcb->sndUna)))
+        {
+            if (tcb->flushTimer == 0)
+                tcb->flushTimer = TCP_FLUSH_TIMEOUT;
+            break;
+        }
+        flags = ACK;
+        if (length == unsent)
+            flags |= PUSH;
+        tcpQueueSegment(tcb, length, flags);
+    }
+
+    if (tcpUnsentLength(tcb) == 0)
+    {
+        tcb->pushPending = false;
+        tcb->flushTimer = 0;
+    }
+
+    // peer closed its window with nothing in flight to bring an update, start probing
+    if (tcb->sndWnd == 0 && tcb->rtxCount == 0 && tcpUnsentLength(tcb) > 0
+            && tcb->persistTimer == 0)
+    {
+        if (tcb->persistBackoff == 0)
+            tcb->persistBackoff = tcb->rto;
+        tcb->persistTimer = tcb->persistBackoff;
+    }
+}
+
+// buffers data for the connection and sends what the window allows, SYN goes out
+// immediately, FIN closes our half after the buffered data (see tcpClose). Small
+// writes without PUSH may be held back and coalesced, see tcpOutput
+// returns false if txBuffer has no room left or our half is already closed
+bool sendTcpPacket(tcpControlBlock* tcb, uint8_t* tcpData, uint16_t tcpDataSize,
+                   uint8_t flags)
+{
+    if (tcb == NULL || tcb->state == CLOSED)
+    {
+        return false;
+    }
+
+    if ((flags & SYN) > 0)
+    {
+        tcpQueueSegment(tcb, 0, flags);
+        return true;
+    }
+
+    if (tcpDataSize == 0 && (flags & FIN) == 0)
+    {
+        tcpTransmitSegment(tcb, tcb->sndNxt, 0, flags);
+        return true;
+    }
+
+    if (tcb->state == FIN_WAIT_1 || tcb->state == FIN_WAIT_2
+            || tcb->state == CLOSING || tcb->state == LAST_ACK)
+    {
+        return false;
+    }
+
+    if (tcpDataSize > TCP_TX_BUFFER_SIZE - tcb->txLength)
+    {
+        return false;
+    }
+
+    if (tcpDataSize > 0)
+    {
+        tcpTxBufferWrite(tcb, tcpData, tcpDataSize);
+    }
+    if ((flags & PUSH) > 0)
+    {
+        tcb->pushPending = true;
+    }
+    if ((flags & FIN) > 0)
+    {
+        tcpClose(tcb);
+        return true;
+    }
+    tcpOutput(tcb);
+    return true;
+}
+
+void tcpSetNagle(tcpControlBlock* tcb, bool enabled)
+{
+    tcb->nagle = enabled;
+}
+
+// while corked only full segments go out, so a burst of small writes shares segments
+void tcpCork(tcpControlBlock* tcb)
+{
+    tcb->corked = true;
+}
+
+void tcpUncork(tcpControlBlock* tcb)
+{
+    tcb->corked = false;
+    tcpFlush(tcb);
+}
+
+// sends everything buffered as far as the window allows
+void tcpFlush(tcpControlBlock* tcb)
+{
+    tcb->pushPending = true;
+    tcpOutput(tcb);
+}
+
+// options of a SYN or SYN-ACK, returns their length
+uint8_t tcpWriteSynOptions(uint8_t* option, bool sackPermitted)
+{
+    // announce the largest segment we accept, rfc 879
+    option[0] = TCP_OPTION_MSS;
+    option[1] = 4;
+    option[2] = TCP_LOCAL_MSS >> 8;
+    option[3] = TCP_LOCAL_MSS & 0xFF;
+    if (!sackPermitted)
+    {
+        return 4;
+    }
+    option[4] = TCP_OPTION_NOP;
+    option[5] = TCP_OPTION_NOP;
+    option[6] = TCP_OPTION_SACK_PERMITTED;
+    option[7] = 2;
+    return 8;
+}
+
+// SACK option listing the out of order ranges we hold, the one with the latest
+// arrival first (rfc 2018 section 4), returns its length
+uint8_t tcpWriteSackOption(tcpControlBlock* tcb, uint8_t* option)
+{
+    uint8_t i, index, first = 0, count = 0;
+    uint32_t edge;
+
+    for (i = 0; i < tcb->oooCount; i++)
+    {
+        if (SEQ_LEQ(tcb->oooList[i].seq, tcb->oooRecent)
+                && SEQ_LT(tcb->oooRecent, tcb->oooList[i].seq + tcb->oooList[i].length))
+            first = i;
+    }
+    for (i = 0; i < tcb->oooCount && count < TCP_MAX_SACK_BLOCKS; i++)
+    {
+        // first, then the others in sequence order
+        if (i == 0)
+            index = first;
+        else
+            index = (i <= first) ? i - 1 : i;
+        edge = htonl(tcb->oooList[index].seq);
+        memcpy(option + 4 + count * 8, &edge, 4);
+        edge = htonl(tcb->oooList[index].seq + tcb->oooList[index].length);
+        memcpy(option + 8 + count * 8, &edge, 4);
+        count++;
+    }
+    option[0] = TCP_OPTION_NOP;
+    option[1] = TCP_OPTION_NOP;
+    option[2] = TCP_OPTION_SACK;
+    option[3] = 2 + count * 8;
+    return 4 + count * 8;
+}
+
+// builds one segment in packet, the payload is read from the retransmission buffer
+// returns the frame size
+uint16_t tcpBuildSegment(tcpControlBlock* tcb, uint8_t packet[], uint32_t seq,
+                         uint16_t tcpDataSize, uint8_t flags)
+{
+    tcpFrame* tcp = (tcpFrame*) (packet + 14 + 20);
+    uint8_t tcpHederSize = 20;
+    uint16_t window;
+
+    memcpy(packet, tcb->headerTemplate, TCP_HEADER_TEMPLATE_SIZE);
+    if ((flags & SYN) > 0)
+    {
+        tcpHederSize += tcpWriteSynOptions(&tcp->data, tcb->sackPermitted);
+    }
+    else if (tcpDataSize == 0 && (flags & FIN) == 0 && tcb->sackPermitted
+            && tcb->oooCount > 0)
+    {
+        // only on pure ACKs, so a full segment never has to make room for the
+        // blocks and a kept segment never carries stale ones
+        tcpHederSize += tcpWriteSackOption(tcb, &tcp->data);
+    }
+    window = tcpAdvertiseWindow(tcb, flags);
+
+    // copy data
+    if (tcpDataSize > 0)
+    {
+        tcpTxBufferRead(tcb, seq - tcb->txSeq, (uint8_t*) tcp + tcpHederSize,
+                        tcpDataSize);
+    }
+    return tcpFinishFrame(packet, tcb->ipHeaderSum, tcb->pseudoHeaderSum, seq,
+                          tcb->rcvNxt, flags, window, tcpHederSize, tcpDataSize);
+}
+
+// the window we advertise on a segment about to go out, which also carries any
+// pending acknowledgement when it has ACK set
+uint16_t tcpAdvertiseWindow(tcpControlBlock* tcb, uint8_t flags)
+{
+    uint16_t window = TCP_RX_BUFFER_SIZE - tcb->rxLength;
+    if ((flags & ACK) > 0)
+    {
+        tcb->ackPending = 0;
+        tcb->delayedAckTimer = 0;
+    }
+    tcb->rcvAdv = tcb->rcvNxt + window;
+    return window;
+}
+
+// builds and sends one segment that is not kept for retransmission
+void tcpTransmitSegment(tcpControlBlock* tcb, uint32_t seq, uint16_t tcpDataSize,
+                        uint8_t flags)
+{
+    uint8_t packet[MAX_PACKET_SIZE];
+    etherPutPacket(packet, tcpBuildSegment(tcb, packet, seq, tcpDataSize, flags));
+}
+
+// sends a segment of the retransmission queue and leaves a copy in the ethernet
+// controller's memory if it has room, the payload then no longer needs txBuffer
+void tcpStoreSegment(tcpControlBlock* tcb, tcpSegment* segment)
+{
+    uint8_t packet[MAX_PACKET_SIZE];
+    tcpFrame* tcp = (tcpFrame*) (packet + 14 + 20);
+    uint16_t size = tcpBuildSegment(tcb, packet, segment->seq, segment->length,
+                                    segment->flags);
+
+    segment->stored = etherPutStoredPacket(packet, size);
+    if (segment->stored != ETHER_NOT_STORED)
+    {
+        memcpy(segment->header, &tcp->ackNumber, TCP_RESEND_PATCH_SIZE);
+        tcpReleaseStoredData(tcb);
+    }
+}
+
+// resends a segment, from the controller's copy when there is one: only ack, window
+// and checksum cross spi, the checksum updated for the two fields, rfc 1624
+void tcpRetransmitSegment(tcpControlBlock* tcb, tcpSegment* segment)
+{
+    uint8_t* header = segment->header;
+    uint32_t ack;
+    uint16_t window, word;
+    uint8_t i;
+
+    segment->retransmitted = true;
+    if (segment->stored == ETHER_NOT_STORED)
+    {
+        tcpStoreSegment(tcb, segment);
+        return;
+    }
+    window = htons(tcpAdvertiseWindow(tcb, segment->flags));
+    ack = htonl(tcb->rcvNxt);
+
+    // ~old checksum + ~old words + new words, header holds ack (bytes 0-3),
+    // offset and flags, window (6-7) and checksum (8-9) as last sent
+    memcpy(&word, header + 8, 2);
+    sum = (uint16_t) ~word;
+    for (i = 0; i < 8; i += 2)
+    {
+        if (i == 4)
+            continue;
+        memcpy(&word, header + i, 2);
+        sum += (uint16_t) ~word;
+    }
+    memcpy(header, &ack, 4);
+    memcpy(header + 6, &window, 2);
+    etherSumWords(header, 4);
+    etherSumWords(header + 6, 2);
+    word = getEtherChecksum();
+    memcpy(header + 8, &word, 2);
+    etherResendStoredPacket(segment->stored, TCP_RESEND_PATCH_OFFSET, header,
+                            TCP_RESEND_PATCH_SIZE);
+}
+
+// sent data leaves txBuffer once every segment holding it from txSeq on is kept by
+// the controller, a segment that found no room keeps it and everything after it
+void tcpReleaseStoredData(tcpControlBlock* tcb)
+{
+    tcpSegment* segment;
+    uint32_t end;
+    uint8_t i;
+
+    for (i = 0; i < tcb->rtxCount; i++)
+    {
+        segment = &tcb->rtxQueue[(tcb->rtxHead + i) % TCP_RTX_QUEUE_SIZE];
+        end = segment->seq + segment->length;
+        if (segment->length == 0 || SEQ_LEQ(end, tcb->txSeq))
+            continue;
+        if (segment->stored == ETHER_NOT_STORED || SEQ_GT(segment->seq, tcb->txSeq))
+            break;
+        tcb->txStart = (tcb->txStart + (end - tcb->txSeq)) % TCP_TX_BUFFER_SIZE;
+        tcb->txLength -= end - tcb->txSeq;
+        tcb->txSeq = end;
+    }
+}
+
+// fills in the fields of a frame whose headers came from tcpBuildHeaders, options
+// and payload already in place: only the fields that change per segment are
+// written, and summed on top of the template's checksums
+// returns the frame size
+uint16_t tcpFinishFrame(uint8_t packet[], uint32_t ipHeaderSum,
+                        uint32_t pseudoHeaderSum, uint32_t seq, uint32_t ack,
+                        uint8_t flags, uint16_t window, uint8_t tcpHederSize,
+                        uint16_t tcpDataSize)
+{
+    etherFrame* ether = (etherFrame*) packet;
+    ipFrame* ip = (ipFrame*) &ether->data;
+    tcpFrame* tcp = (tcpFrame*) ((uint8_t*) ip + 20);
+    uint16_t tcpLength = tcpHederSize + tcpDataSize;
+    uint16_t tmp16;
+
+    tcp->off = tcpHederSize / 4;
+    tcp->sequenceNumber = htonl(seq);
+    tcp->ackNumber = htonl(ack);
+    tcp->flags = flags;
+    tcp->win = htons(window);
+
+    // ip length and id, the rest of the ip header is in the template sum
+    ip->length = htons(20 + tcpLength);
+    ip->id = htons(tcpIpId++);
+    sum = ipHeaderSum;
+    etherSumWords(&ip->length, 4);
+    ip->headerChecksum = getEtherChecksum();
+
+    // pseudo-header and ports are in the template sum, add the tcp length and
+    // everything from the sequence number on, checksum field is still 0
+    sum = pseudoHeaderSum;
+    tmp16 = htons(tcpLength);
+    etherSumWords(&tmp16, 2);
+    etherSumWords(&tcp->sequenceNumber, tcpLength - 4);
+    tcp->sum = getEtherChecksum();
+
+    return 14 + 20 + tcpLength;
+}
+
+// sends a frame prepared like for tcpFinishFrame
+void tcpSendFrame(uint8_t packet[], uint32_t ipHeaderSum, uint32_t pseudoHeaderSum,
+                  uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                  uint8_t tcpHederSize, uint16_t tcpDataSize)
+{
+    etherPutPacket(packet, tcpFinishFrame(packet, ipHeaderSum, pseudoHeaderSum, seq,
+                                          ack, flags, window, tcpHederSize,
+                                          tcpDataSize));
+}
+
+uint8_t getTcpConnectionState(tcpControlBlock* tcb)
+{
+    if (tcb == NULL)
+    {
+        return CLOSED;
+    }
+    return tcb->state;
+}
+
+
+tcpControlBlock* establishConnection(uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort)
+{
+    tcpControlBlock* tcb = tcpAllocateConnection(serverMac, serverIP, destPort,
+                                                 tcpAllocatePort());
+    if (tcb != NULL)
+    {
+        tcb->state = SYN_SENT;
+        sendTcpPacket(tcb, 0, 0, SYN);
+    }
+    return tcb;
+}
+
+// opens a connection that reports to callback, TCP_EVENT_CONNECTED once the
+// handshake completes, writes before that are sent then
+// returns NULL if no connection slot is free
+tcpControlBlock* tcpConnect(uint8_t remoteMac[], uint8_t remoteIp[], uint16_t remotePort,
+                            tcpCallback callback)
+{
+    tcpControlBlock* tcb = establishConnection(remoteMac, remoteIp, remotePort);
+    if (tcb != NULL)
+    {
+        tcb->callback = callback;
+    }
+    return tcb;
+}
+
+// accepts connections on port, each reports to callback starting with
+// TCP_EVENT_CONNECTED, a NULL callback accepts and discards whatever arrives
+// returns false if every listener entry is taken
+bool tcpListen(uint16_t port, tcpCallback callback)
+{
+    uint8_t i;
+    tcpListener* listener = tcpFindListener(port);
+    for (i = 0; i < TCP_MAX_LISTENERS && listener == NULL; i++)
+    {
+        if (tcpListeners[i].port == 0)
+            listener = &tcpListeners[i];
+    }
+    if (listener == NULL)
+    {
+        return false;
+    }
+    listener->port = port;
+    listener->callback = callback;
+    return true;
+}
+
+tcpListener* tcpFindListener(uint16_t port)
+{
+    uint8_t i;
+    for (i = 0; i < TCP_MAX_LISTENERS; i++)
+    {
+        if (tcpListeners[i].port == port && port != 0)
+            return &tcpListeners[i];
+    }
+    return NULL;
+}
+
+// copies as much of data into txBuffer as fits and sends what the windows allow,
+// small writes may be held back and coalesced (see tcpOutput) until tcpFlush
+// segments handed to the ENC28J60 store leave txBuffer, so room can open up as we go
+// returns the number of bytes taken, after a short count TCP_EVENT_WRITABLE says
+// when to continue
+uint16_t tcpWrite(tcpControlBlock* tcb, uint8_t* data, uint16_t size)
+{
+    uint16_t taken = 0;
+    uint16_t room;
+    if (tcb == NULL)
+    {
+        return 0;
+    }
+    while (taken < size && (room = tcpWriteSpace(tcb)) > 0)
+    {
+        if (room > size - taken)
+            room = size - taken;
+        tcpTxBufferWrite(tcb, &data[taken], room);
+        tcpOutput(tcb);
+        taken += room;
+    }
+    if (taken < size)
+    {
+        tcb->writeBlocked = true;
+    }
+    return taken;
+}
+
+// bytes tcpWrite would take now, 0 once our half is closed
+uint16_t tcpWriteSpace(tcpControlBlock* tcb)
+{
+    if (tcb == NULL || tcb->state == CLOSED || tcb->state == FIN_WAIT_1
+            || tcb->state == FIN_WAIT_2 || tcb->state == CLOSING
+            || tcb->state == LAST_ACK || tcb->finPending)
+    {
+        return 0;
+    }
+    return TCP_TX_BUFFER_SIZE - tcb->txLength;
+}
+
+// moves up to size received bytes to data, the window reopens as they are read
+// returns the number of bytes copied
+uint16_t tcpRead(tcpControlBlock* tcb, uint8_t* data, uint16_t size)
+{
+    if (size > tcb->rxLength)
+        size = tcb->rxLength;
+    tcpPeekReceived(tcb, 0, data, size);
+    tcpReleaseReceived(tcb, size);
+    return size;
+}
+
+void tcpNotify(tcpControlBlock* tcb, uint8_t event)
+{
+    if (tcb->callback != NULL)
+    {
+        tcb->callback(tcb, event);
+    }
+}
@@ -1,58 +1,316 @@
-#ifndef TCP_H
-#define TCP_H
-
-#include "common.h"
-
-#define FIN 0x01
-#define SYN 0x02
-#define RST 0x04
-#define PUSH 0x08
-#define ACK 0x10
-#define URG 0x20
-#define ECE 0x40
-#define CWR 0x80
-
-//TCP states. ignoring CLOSED state as our server will always be in passive open state.
-#define LISTEN 0
-#define SYN_RECEIVED 1
-#define ESTABLISHED 2
-#define FIN_WAIT_1 3
-#define FIN_WAIT_2 4
-#define CLOSING 5
-#define TIME_WAIT 6
-#define SYN_SENT 7
-
-typedef struct _tcpFrame // 8 bytes
-{
-  uint16_t sourcePort;
-  uint16_t destPort;
-  uint32_t sequenceNumber;
-  uint32_t ackNumber;
-  unsigned reservedNS:4; // reserved 3 bits and NS bit which is always 0
-  unsigned off:4;
-  uint8_t flags;
-  uint16_t win;
-  uint16_t sum;
-  uint16_t urp;
-  uint8_t data;
-} tcpFrame;
-
-typedef struct _tcpServerState
-{
-    uint8_t state;
-    uint32_t runningSeqn;
-    uint16_t myPort;
-    uint16_t serverPort;
-    uint32_t ackToSend;
-} tcpServerState;
-
-
-
-bool etherIsTcp(uint8_t packet[]);
-void processTcpMessage(uint8_t packet[]);
-void resetTcpStateTimer();
-void sendTcpPacket(uint8_t* tcpData, uint8_t tcpDataSize, uint8_t flags, uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort);
-uint8_t getTcpConnectionState();
-void establishConnection(uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort);
-
-#endif
+#ifndef TCP_H
+#define TCP_H
+
+#include "common.h"
+
+#define FIN 0x01
+#define SYN 0x02
+#define RST 0x04
+#define PUSH 0x08
+#define ACK 0x10
+#define URG 0x20
+#define ECE 0x40
+#define CWR 0x80
+
+//TCP states. LISTEN is kept per port (see etherIsTcp), a free connection slot is CLOSED.
+//A connection in TIME_WAIT gives its slot up for an entry in tcpTimeWaits.
+#define LISTEN 0
+#define SYN_RECEIVED 1
+#define ESTABLISHED 2
+#define FIN_WAIT_1 3
+#define FIN_WAIT_2 4
+#define CLOSING 5
+#define TIME_WAIT 6
+#define SYN_SENT 7
+#define CLOSED 8
+#define CLOSE_WAIT 9
+#define LAST_ACK 10
+
+#define TCP_MAX_CONNECTIONS 4
+#define TCP_MAX_LISTENERS 4
+#define TCP_SYN_TIMEOUT 10 // seconds a half-open connection may hold its slot
+#define TCP_FIN_WAIT_2_TIMEOUT 60 // seconds we wait for the peer's FIN after ours was acked
+#define TCP_TIME_WAIT 60          // seconds, 2 * msl with an msl of 30 s
+#define TCP_TIME_WAIT_ENTRIES 8
+
+// listening ports answer a SYN with a cookie instead of a connection slot, rfc 4987
+#define TCP_COOKIE_PERIOD 64     // seconds per cookie time slot, a cookie lives one or two
+#define TCP_SYN_SOURCES 8        // sources tracked for the SYN rate limit
+#define TCP_SYN_SOURCE_LIMIT 4   // SYNs answered per source and second
+#define TCP_SYN_LIMIT 16         // SYNs answered per second in total
+
+// ephemeral ports, rfc 6335, handed out in random strides so a quick reconnect
+// never lands on a port the broker still remembers
+#define TCP_EPHEMERAL_FIRST 49152
+#define TCP_EPHEMERAL_LAST 65535
+#define TCP_EPHEMERAL_STRIDE 64
+
+// retransmission, all times in timer ticks (see TIMER_TICKS_PER_SECOND)
+#define TCP_TX_BUFFER_SIZE 2048 // unacknowledged bytes kept for retransmission
+#define TCP_RTX_QUEUE_SIZE 8    // unacknowledged segments per connection
+#define TCP_INITIAL_RTO 100     // 1 s, rfc 6298
+#define TCP_MIN_RTO 20
+#define TCP_MAX_RTO 6000
+#define TCP_MAX_RETRIES 8
+#define TCP_MAX_PERSIST 6000    // longest interval between zero window probes
+#define TCP_DELAYED_ACK 20      // 200 ms, rfc 1122 allows up to 500 ms
+#define TCP_FLUSH_TIMEOUT 20    // longest a small write is held back by nagle or cork
+#define TCP_DUPACK_THRESHOLD 3  // duplicate ACKs that trigger a fast retransmit, rfc 5681
+#define TCP_MAX_CWND 65535      // the peer's window field cannot offer more
+
+// keepalive and idle timeouts, in seconds, rfc 1122 4.2.3.6
+#define TCP_KEEPALIVE_IDLE 0       // quiet time before the first probe, 0 disables probing
+#define TCP_KEEPALIVE_INTERVAL 75
+#define TCP_KEEPALIVE_COUNT 9      // unanswered probes before the peer is declared dead
+#define TCP_IDLE_TIMEOUT 300       // passive connections, nothing reads them yet
+
+#define TCP_DEFAULT_MSS 536 // segment size when the peer sends no MSS option, rfc 879
+#define TCP_LOCAL_MSS 1460  // largest segment we accept, a full ethernet frame
+#define TCP_NAGLE_DEFAULT true // coalesce small writes while data is in flight
+
+#define TCP_HEADER_TEMPLATE_SIZE 54 // ethernet, ip and tcp headers without options
+#define TCP_RESEND_PATCH_OFFSET 42  // ack number in the frame, up to the checksum
+#define TCP_RESEND_PATCH_SIZE 10    // rewritten when a kept segment is resent
+
+#define TCP_RX_BUFFER_SIZE 1024 // received data not yet read, bounds the advertised window
+#define TCP_MAX_OOO_SEGMENTS 4  // out of order ranges held per connection
+#define TCP_MAX_SACK_BLOCKS 4   // ranges the peer reported received, fits the 40 option bytes
+
+// events passed to a connection's callback
+#define TCP_EVENT_CONNECTED 0 // handshake complete, active or passive
+#define TCP_EVENT_READABLE 1  // received data waiting, see tcpRead
+#define TCP_EVENT_WRITABLE 2  // txBuffer has room again after a short tcpWrite
+#define TCP_EVENT_CLOSED 3    // the peer finished sending, tcpClose ends our half
+#define TCP_EVENT_LOST 4      // reset, refused or timed out, the connection is gone
+
+// tcp option kinds
+#define TCP_OPTION_END 0
+#define TCP_OPTION_NOP 1
+#define TCP_OPTION_MSS 2
+#define TCP_OPTION_SACK_PERMITTED 4
+#define TCP_OPTION_SACK 5
+
+typedef struct _tcpFrame // 8 bytes
+{
+  uint16_t sourcePort;
+  uint16_t destPort;
+  uint32_t sequenceNumber;
+  uint32_t ackNumber;
+  unsigned reservedNS:4; // reserved 3 bits and NS bit which is always 0
+  unsigned off:4;
+  uint8_t flags;
+  uint16_t win;
+  uint16_t sum;
+  uint16_t urp;
+  uint8_t data;
+} tcpFrame;
+
+// a sent, unacknowledged segment, its payload stays in the connection's txBuffer
+// unless the ethernet controller kept a copy of the whole frame
+typedef struct _tcpSegment
+{
+    uint32_t seq;
+    uint16_t length;      // payload bytes, SYN and FIN not included
+    uint8_t flags;
+    bool retransmitted;   // karn: no rtt sample from a segment sent twice
+    uint32_t sentTick;
+    uint8_t stored;       // copy kept by the ethernet controller, or ETHER_NOT_STORED
+    uint8_t header[TCP_RESEND_PATCH_SIZE]; // the stored copy's ack to checksum bytes
+} tcpSegment;
+
+// a block of sequence space, used for out of order data
+typedef struct _tcpRange
+{
+    uint32_t seq;
+    uint16_t length;
+} tcpRange;
+
+// a closed connection whose sequence space must not be reused yet, rfc 793 TIME-WAIT
+typedef struct _tcpTimeWait
+{
+    uint8_t remoteMac[HW_ADD_LENGTH];
+    uint8_t remoteIp[IP_ADD_LENGTH];
+    uint16_t localPort;
+    uint16_t remotePort;
+    uint32_t sndNxt;
+    uint32_t rcvNxt;
+    uint8_t timer;       // seconds left, 0 when the entry is free
+} tcpTimeWait;
+
+// SYNs seen from one source in the current second
+typedef struct _tcpSynSource
+{
+    uint8_t ip[IP_ADD_LENGTH];
+    uint8_t count;
+} tcpSynSource;
+
+// one entry per connection, looked up by remote ip, remote port and local port
+typedef struct _tcpControlBlock
+{
+    uint8_t state;
+    uint8_t remoteMac[HW_ADD_LENGTH];
+    uint8_t remoteIp[IP_ADD_LENGTH];
+    uint16_t localPort;
+    uint16_t remotePort;
+    uint16_t stateTimer; // seconds left before a half-open connection is dropped
+    uint16_t idleTime;   // seconds since the peer last sent anything
+    uint16_t idleTimeout;        // drop after this many quiet seconds, 0 never
+    uint16_t keepaliveIdle;      // probe after this many quiet seconds, 0 never
+    uint16_t keepaliveInterval;
+    uint8_t keepaliveCount;
+    // headers of every segment we send, with the ones complement sums of the fields
+    // that never change, see tcpBuildHeaderTemplate
+    uint8_t headerTemplate[TCP_HEADER_TEMPLATE_SIZE];
+    uint32_t ipHeaderSum;
+    uint32_t pseudoHeaderSum;
+    // send window, txBuffer holds everything from sndUna on that the controller
+    // did not keep a copy of (see tcpStoreSegment)
+    uint32_t sndUna;     // oldest unacknowledged sequence number
+    uint32_t sndNxt;     // next sequence number to send
+    uint32_t sndWl1;     // peer sequence and ack numbers of the last window update
+    uint32_t sndWl2;
+    uint16_t sndWnd;     // window advertised by the peer
+    uint16_t mss;        // largest segment we send, negotiated on the SYN
+    // congestion control, rfc 5681 with newreno fast recovery (rfc 6582)
+    uint32_t cwnd;       // bytes we may have in flight, besides the peer's window
+    uint32_t ssthresh;   // slow start below, congestion avoidance above
+    uint32_t recover;    // sndNxt when fast recovery began
+    uint8_t dupAcks;
+    bool inRecovery;
+    // selective acknowledgement, rfc 2018: the scoreboard holds what the peer
+    // reported above sndUna, so recovery resends only the holes
+    bool sackPermitted;  // offered on our SYN, kept if the peer's SYN offered it too
+    tcpRange sackList[TCP_MAX_SACK_BLOCKS]; // sorted by seq, never touching
+    uint8_t sackCount;
+    uint32_t rtxHigh;    // end of the highest segment resent in this recovery
+    bool finPending;     // FIN goes out once all buffered data is sent
+    bool nagle;          // hold a small segment while earlier data is unacknowledged
+    bool corked;         // hold small segments until uncorked
+    bool pushPending;    // send everything buffered now, nagle and cork aside
+    uint8_t flushTimer;  // ticks until held data is pushed anyway, 0 when idle
+    uint16_t persistTimer;   // ticks until the next zero window probe, 0 when idle
+    uint16_t persistBackoff;
+    uint32_t txSeq;      // sequence number of txBuffer[txStart]
+    uint16_t txStart;
+    uint16_t txLength;
+    uint8_t txBuffer[TCP_TX_BUFFER_SIZE];
+    tcpSegment rtxQueue[TCP_RTX_QUEUE_SIZE];
+    uint8_t rtxHead;
+    uint8_t rtxCount;
+    // jacobson/karels estimator
+    uint16_t srtt;       // smoothed rtt, scaled by 8
+    uint16_t rttvar;     // rtt variance, scaled by 4
+    uint16_t rto;
+    uint16_t rtoTimer;   // ticks until the oldest segment is resent, 0 when idle
+    uint8_t retries;
+    // receive side, rxBuffer holds data not read yet from rcvNxt back, and
+    // out of order data at its offset past rcvNxt
+    uint32_t rcvNxt;     // next sequence number expected from the peer
+    uint32_t rcvAdv;     // right edge of the last window we advertised
+    uint8_t ackPending;  // in order segments received since our last ACK
+    uint8_t delayedAckTimer;
+    uint16_t rxStart;
+    uint16_t rxLength;
+    uint8_t rxBuffer[TCP_RX_BUFFER_SIZE];
+    tcpRange oooList[TCP_MAX_OOO_SEGMENTS]; // sorted by seq, never touching
+    uint8_t oooCount;
+    uint32_t oooRecent;  // seq of the latest out of order arrival, its block is sacked first
+    // the application, see tcpConnect and tcpListen
+    void (*callback)(struct _tcpControlBlock* tcb, uint8_t event);
+    bool writeBlocked;   // a tcpWrite came up short, TCP_EVENT_WRITABLE is due
+} tcpControlBlock;
+
+typedef void (*tcpCallback)(tcpControlBlock* tcb, uint8_t event);
+
+// a local port accepting connections, they report to its callback
+typedef struct _tcpListener
+{
+    uint16_t port;       // 0 when the entry is free
+    tcpCallback callback;
+} tcpListener;
+
+
+
+void initTcp();
+bool etherIsTcp(uint8_t packet[]);
+void processTcpMessage(uint8_t packet[], uint16_t size);
+bool tcpIsChecksumValid(uint8_t packet[], uint16_t size);
+void tcpSetHardwareChecksum(bool verified);
+uint32_t tcpGetRejectedSegments();
+void tcpTimerTick();
+tcpControlBlock* tcpFindConnection(uint8_t remoteIp[], uint16_t remotePort, uint16_t localPort);
+void tcpReleaseConnection(tcpControlBlock* tcb);
+void tcpAbortConnection(tcpControlBlock* tcb);
+void tcpClose(tcpControlBlock* tcb);
+bool tcpIsFinAcked(tcpControlBlock* tcb);
+void tcpReceiveFin(tcpControlBlock* tcb);
+void tcpEnterTimeWait(tcpControlBlock* tcb);
+tcpTimeWait* tcpFindTimeWait(uint8_t remoteIp[], uint16_t remotePort, uint16_t localPort);
+void tcpSendTimeWaitAck(tcpTimeWait* timeWait);
+uint16_t tcpAllocatePort();
+bool tcpIsSynAllowed(uint8_t ip[]);
+void tcpAddEntropy(uint32_t value);
+uint32_t tcpInitialSequence(uint8_t remoteIp[], uint16_t remotePort, uint16_t localPort);
+uint32_t tcpCookieHash(uint8_t ip[], uint16_t remotePort, uint16_t localPort,
+                       uint32_t peerIsn, uint8_t slot);
+void tcpSendSynCookie(uint8_t packet[]);
+tcpControlBlock* tcpAcceptSynCookie(uint8_t packet[]);
+void tcpSetKeepalive(tcpControlBlock* tcb, uint16_t idle, uint16_t interval, uint8_t count);
+void tcpSetIdleTimeout(tcpControlBlock* tcb, uint16_t seconds);
+void tcpIdleTick(tcpControlBlock* tcb);
+void tcpBuildHeaders(uint8_t header[], uint8_t remoteMac[], uint8_t remoteIp[],
+                     uint16_t localPort, uint16_t remotePort,
+                     uint32_t* ipHeaderSum, uint32_t* pseudoHeaderSum);
+void tcpBuildHeaderTemplate(tcpControlBlock* tcb);
+uint8_t* tcpFindOption(tcpFrame* tcp, uint8_t kind);
+uint16_t tcpGetPeerMss(tcpFrame* tcp);
+void tcpSetMss(tcpControlBlock* tcb, uint16_t peerMss);
+bool sendTcpPacket(tcpControlBlock* tcb, uint8_t* tcpData, uint16_t tcpDataSize, uint8_t flags);
+uint32_t tcpUnsentLength(tcpControlBlock* tcb);
+void tcpSendWindowProbe(tcpControlBlock* tcb);
+void tcpOutput(tcpControlBlock* tcb);
+void tcpDuplicateAck(tcpControlBlock* tcb);
+void tcpResendSegment(tcpControlBlock* tcb);
+bool tcpAddRange(tcpRange list[], uint8_t* count, uint8_t size, uint32_t seq,
+                 uint32_t end);
+void tcpUpdateScoreboard(tcpControlBlock* tcb, tcpFrame* tcp);
+bool tcpIsSacked(tcpControlBlock* tcb, uint32_t seq, uint32_t end);
+void tcpResendHole(tcpControlBlock* tcb);
+uint16_t tcpBuildSegment(tcpControlBlock* tcb, uint8_t packet[], uint32_t seq,
+                         uint16_t tcpDataSize, uint8_t flags);
+uint16_t tcpAdvertiseWindow(tcpControlBlock* tcb, uint8_t flags);
+void tcpTransmitSegment(tcpControlBlock* tcb, uint32_t seq, uint16_t tcpDataSize, uint8_t flags);
+void tcpStoreSegment(tcpControlBlock* tcb, tcpSegment* segment);
+void tcpRetransmitSegment(tcpControlBlock* tcb, tcpSegment* segment);
+void tcpReleaseStoredData(tcpControlBlock* tcb);
+uint16_t tcpFinishFrame(uint8_t packet[], uint32_t ipHeaderSum,
+                        uint32_t pseudoHeaderSum, uint32_t seq, uint32_t ack,
+                        uint8_t flags, uint16_t window, uint8_t tcpHederSize,
+                        uint16_t tcpDataSize);
+uint8_t tcpWriteSynOptions(uint8_t* option, bool sackPermitted);
+uint8_t tcpWriteSackOption(tcpControlBlock* tcb, uint8_t* option);
+void tcpSendFrame(uint8_t packet[], uint32_t ipHeaderSum, uint32_t pseudoHeaderSum,
+                  uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                  uint8_t tcpHederSize, uint16_t tcpDataSize);
+void tcpSetNagle(tcpControlBlock* tcb, bool enabled);
+void tcpCork(tcpControlBlock* tcb);
+void tcpUncork(tcpControlBlock* tcb);
+void tcpFlush(tcpControlBlock* tcb);
+uint16_t tcpReceiveSegment(tcpControlBlock* tcb, uint32_t seq, uint8_t* data, uint16_t length);
+uint16_t tcpReceivedLength(tcpControlBlock* tcb);
+void tcpPeekReceived(tcpControlBlock* tcb, uint16_t offset, uint8_t* data, uint16_t size);
+void tcpReleaseReceived(tcpControlBlock* tcb, uint16_t size);
+uint8_t getTcpConnectionState(tcpControlBlock* tcb);
+tcpControlBlock* establishConnection(uint8_t* serverMac, uint8_t* serverIP, uint16_t destPort);
+
+// socket layer
+tcpControlBlock* tcpConnect(uint8_t remoteMac[], uint8_t remoteIp[], uint16_t remotePort,
+                            tcpCallback callback);
+bool tcpListen(uint16_t port, tcpCallback callback);
+tcpListener* tcpFindListener(uint16_t port);
+uint16_t tcpWrite(tcpControlBlock* tcb, uint8_t* data, uint16_t size);
+uint16_t tcpWriteSpace(tcpControlBlock* tcb);
+uint16_t tcpRead(tcpControlBlock* tcb, uint8_t* data, uint16_t size);
+void tcpNotify(tcpControlBlock* tcb, uint8_t event);
+
+#endif
@@ -1,186 +1,241 @@
-// Timer Service Library
-// Jason Losh
-
-//-----------------------------------------------------------------------------
-// Hardware Target
-//-----------------------------------------------------------------------------
-
-// Target Platform: EK-TM4C123GXL
-// Target uC:       TM4C123GH6PM
-// System Clock:    40 MHz
-
-// Hardware configuration:
-// Timer 4
-
-//-----------------------------------------------------------------------------
-// Device includes, defines, and assembler directives
-//-----------------------------------------------------------------------------
-
-#include <stdlib.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include "tm4c123gh6pm.h"
-#include "timer.h"
-#include "gpio.h"
-
-//-----------------------------------------------------------------------------
-// Global variables
-//-----------------------------------------------------------------------------
-
-#define NUM_TIMERS 10
-
-_callback fn[NUM_TIMERS];
-uint32_t period[NUM_TIMERS];
-uint32_t ticks[NUM_TIMERS];
-bool reload[NUM_TIMERS];
-
-//-----------------------------------------------------------------------------
-// Subroutines
-//-----------------------------------------------------------------------------
-
-void initTimer()
-{
-    uint8_t i;
-
-    // Enable clocks
-    SYSCTL_RCGCTIMER_R |= SYSCTL_RCGCTIMER_R4;
-    _delay_cycles(3);
-    // Configure Timer 4 for 1 sec tick
-    TIMER4_CTL_R &= ~TIMER_CTL_TAEN;                 // turn-off timer before reconfiguring
-    TIMER4_CFG_R = TIMER_CFG_32_BIT_TIMER;           // configure as 32-bit timer (A+B)
-    TIMER4_TAMR_R = TIMER_TAMR_TAMR_PERIOD;          // configure for periodic mode (count down)
-    TIMER4_TAILR_R = 40000000;                       // set load value (1 Hz rate)
-    TIMER4_CTL_R |= TIMER_CTL_TAEN;                  // turn-on timer
-    TIMER4_IMR_R |= TIMER_IMR_TATOIM;                // turn-on interrupt
-    NVIC_EN2_R |= 1 << (INT_TIMER4A-80);             // turn-on interrupt 86 (TIMER4A)
-
-    for (i = 0; i < NUM_TIMERS; i++)
-    {
-        period[i] = 0;
-        ticks[i] = 0;
-        fn[i] = NULL;
-        reload[i] = false;
-    }
-}
-
-bool startOneshotTimer(_callback callback, uint32_t seconds)
-{
-    uint8_t i = 0;
-    bool found = false;
-    while (i < NUM_TIMERS && !found)
-    {
-        found = fn[i] == NULL;
-        if (found)
-        {
-            period[i] = seconds;
-            ticks[i] = seconds;
-            fn[i] = callback;
-            reload[i] = false;
-        }
-        i++;
-    }
-    return found;
-}
-
-bool startPeriodicTimer(_callback callback, uint32_t seconds)
-{
-    uint8_t i = 0;
-    bool found = false;
-    while (i < NUM_TIMERS && !found)
-    {
-        found = fn[i] == NULL;
-        if (found)
-        {
-            period[i] = seconds;
-            ticks[i] = seconds;
-            fn[i] = callback;
-            reload[i] = true;
-        }
-        i++;
-    }
-    return found;
-}
-
-bool stopTimer(_callback callback)
-{
-     uint8_t i = 0;
-     bool found = false;
-     while (i < NUM_TIMERS && !found)
-     {
-         found = (fn[i] == callback);
-         if (found)
-             ticks[i] = 0;
-         i++;
-     }
-     return found;
-}
-
-bool restartTimer(_callback callback)
-{
-     uint8_t i = 0;
-     bool found = false;
-     while (i < NUM_TIMERS && !found)
-     {
-         found = (fn[i] == callback);
-         if (found)
-             ticks[i] = period[i];
-         i++;
-     }
-     return found;
-}
-
-void tickIsr()
-{
-    uint8_t i;
-    for (i = 0; i < NUM_TIMERS; i++)
-    {
-        if (ticks[i] != 0)
-        {
-            ticks[i]--;
-            if (ticks[i] == 0)
-            {
-                if (reload[i])
-                    ticks[i] = period[i];
-                (*fn[i])();
-            }
-        }
-    }
-    TIMER4_ICR_R = TIMER_ICR_TATOCINT;
-}
-
-// Placeholder random number function
-uint32_t random32()
-{
-    return TIMER4_TAV_R;
-}
-
-
-#define RED_LED PORTF,1
-#define BLUE_LED PORTF,2
-#define GREEN_LED PORTF,3
-#define PUSH_BUTTON PORTF,4
-
-void flashBlue()
-{
-    setPinValue(BLUE_LED, 1);
-    waitMicrosecond(100000);
-    setPinValue(BLUE_LED, 0);
-    waitMicrosecond(100000);
-}
-void flashRed()
-{
-    return;
-    setPinValue(RED_LED, 1);
-    waitMicrosecond(100000);
-    setPinValue(RED_LED, 0);
-    waitMicrosecond(100000);
-}
-void flashGreen()
-{
-    return;
-    setPinValue(GREEN_LED, 1);
-    waitMicrosecond(100000);
-    setPinValue(GREEN_LED, 0);
-    waitMicrosecond(100000);
-}
-
+// Timer Service Library
+// Jason Losh
+
+//-----------------------------------------------------------------------------
+// Hardware Target
+//-----------------------------------------------------------------------------
+
+// Target Platform: EK-TM4C123GXL
+// Target uC:       TM4C123GH6PM
+// System Clock:    40 MHz
+
+// Hardware configuration:
+// Timer 4
+
+//-----------------------------------------------------------------------------
+// Device includes, defines, and assembler directives
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "tm4c123gh6pm.h"
+#include "timer.h"
+#include "gpio.h"
+
+//-----------------------------------------------------------------------------
+// Global variables
+//-----------------------------------------------------------------------------
+
+// tcp, mqtt, mqtt-sn and dhcp register 13 callbacks between them, a stopped
+// timer gives its slot back
+#define NUM_TIMERS 16
+
+_callback fn[NUM_TIMERS];
+uint32_t period[NUM_TIMERS];
+uint32_t ticks[NUM_TIMERS];
+bool reload[NUM_TIMERS];
+uint32_t uptimeTicks = 0;
+volatile uint32_t pendingTicks = 0; // ticks counted by the isr and not yet run
+
+//-----------------------------------------------------------------------------
+// Subroutines
+//-----------------------------------------------------------------------------
+
+void initTimer()
+{
+    uint8_t i;
+
+    // Enable clocks
+    SYSCTL_RCGCTIMER_R |= SYSCTL_RCGCTIMER_R4;
+    _delay_cycles(3);
+    // Configure Timer 4 for 10 ms tick
+    TIMER4_CTL_R &= ~TIMER_CTL_TAEN;                 // turn-off timer before reconfiguring
+    TIMER4_CFG_R = TIMER_CFG_32_BIT_TIMER;           // configure as 32-bit timer (A+B)
+    TIMER4_TAMR_R = TIMER_TAMR_TAMR_PERIOD;          // configure for periodic mode (count down)
+    TIMER4_TAILR_R = 40000000 / TIMER_TICKS_PER_SECOND; // set load value (100 Hz rate)
+    TIMER4_CTL_R |= TIMER_CTL_TAEN;                  // turn-on timer
+    TIMER4_IMR_R |= TIMER_IMR_TATOIM;                // turn-on interrupt
+    NVIC_EN2_R |= 1 << (INT_TIMER4A-80);             // turn-on interrupt 86 (TIMER4A)
+
+    for (i = 0; i < NUM_TIMERS; i++)
+    {
+        period[i] = 0;
+        ticks[i] = 0;
+        fn[i] = NULL;
+        reload[i] = false;
+    }
+}
+
+// Slot already holding callback, so that starting a running timer again
+// restarts it instead of taking another slot; else the first free slot
+uint8_t findTimerSlot(_callback callback)
+{
+    uint8_t i;
+    uint8_t slot = NUM_TIMERS;
+    for (i = 0; i < NUM_TIMERS; i++)
+    {
+        if (fn[i] == callback)
+            return i;
+        if (fn[i] == NULL && slot == NUM_TIMERS)
+            slot = i;
+    }
+    return slot;
+}
+
+bool startOneshotTimer(_callback callback, uint32_t seconds)
+{
+    uint8_t i = findTimerSlot(callback);
+    bool found = i < NUM_TIMERS;
+    if (found)
+    {
+        period[i] = seconds * TIMER_TICKS_PER_SECOND;
+        fn[i] = callback;
+        reload[i] = false;
+        ticks[i] = seconds * TIMER_TICKS_PER_SECOND;
+    }
+    return found;
+}
+
+bool startPeriodicTimer(_callback callback, uint32_t seconds)
+{
+    return startPeriodicTimerTicks(callback, seconds * TIMER_TICKS_PER_SECOND);
+}
+
+// Same as startPeriodicTimer, with the period given in timer ticks
+bool startPeriodicTimerTicks(_callback callback, uint32_t timerTicks)
+{
+    uint8_t i = findTimerSlot(callback);
+    bool found = i < NUM_TIMERS;
+    if (found)
+    {
+        period[i] = timerTicks;
+        fn[i] = callback;
+        reload[i] = true;
+        ticks[i] = timerTicks;
+    }
+    return found;
+}
+
+bool stopTimer(_callback callback)
+{
+     uint8_t i = 0;
+     bool found = false;
+     while (i < NUM_TIMERS && !found)
+     {
+         found = (fn[i] == callback);
+         if (found)
+         {
+             ticks[i] = 0;
+             fn[i] = NULL;
+         }
+         i++;
+     }
+     return found;
+}
+
+bool restartTimer(_callback callback)
+{
+     uint8_t i = 0;
+     bool found = false;
+     while (i < NUM_TIMERS && !found)
+     {
+         found = (fn[i] == callback);
+         if (found)
+             ticks[i] = period[i];
+         i++;
+     }
+     return found;
+}
+
+// Only counts the tick, the callbacks drive spi and the tcp state and so are
+// run from the main loop by processTimers
+void tickIsr()
+{
+    uptimeTicks++;
+    pendingTicks++;
+    TIMER4_ICR_R = TIMER_ICR_TATOCINT;
+}
+
+// Runs the callbacks of the timers that expired since the last call, a tick
+// missed while the main loop was busy is caught up here
+void processTimers()
+{
+    uint8_t i;
+    while (pendingTicks > 0)
+    {
+        TIMER4_IMR_R &= ~TIMER_IMR_TATOIM;
+        pendingTicks--;
+        TIMER4_IMR_R |= TIMER_IMR_TATOIM;
+        for (i = 0; i < NUM_TIMERS; i++)
+        {
+            if (ticks[i] != 0)
+            {
+                ticks[i]--;
+                if (ticks[i] == 0)
+                {
+                    if (reload[i])
+                        ticks[i] = period[i];
+                    (*fn[i])();
+                }
+            }
+        }
+    }
+}
+
+// seconds since initTimer, wraps after 497 days
+uint32_t getUptime()
+{
+    return uptimeTicks / TIMER_TICKS_PER_SECOND;
+}
+
+// 4 us ticks since initTimer for tcp initial sequence numbers (rfc 6528), wraps
+// after about 4.8 hours
+uint32_t getFineTicks()
+{
+    uint32_t ticks;
+    uint32_t elapsed;
+    do
+    {
+        ticks = uptimeTicks;
+        elapsed = TIMER4_TAILR_R - TIMER4_TAV_R; // the timer counts down
+    } while (ticks != uptimeTicks);
+    return ticks * (250000 / TIMER_TICKS_PER_SECOND) + elapsed / 160;
+}
+
+// Placeholder random number function
+uint32_t random32()
+{
+    return TIMER4_TAV_R;
+}
+
+
+#define RED_LED PORTF,1
+#define BLUE_LED PORTF,2
+#define GREEN_LED PORTF,3
+#define PUSH_BUTTON PORTF,4
+
+void flashBlue()
+{
+    setPinValue(BLUE_LED, 1);
+    waitMicrosecond(100000);
+    setPinValue(BLUE_LED, 0);
+    waitMicrosecond(100000);
+}
+void flashRed()
+{
+    return;
+    setPinValue(RED_LED, 1);
+    waitMicrosecond(100000);
+    setPinValue(RED_LED, 0);
+    waitMicrosecond(100000);
+}
+void flashGreen()
+{
+    return;
+    setPinValue(GREEN_LED, 1);
+    waitMicrosecond(100000);
+    setPinValue(GREEN_LED, 0);
+    waitMicrosecond(100000);
+}
+
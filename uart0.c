@@ -20,6 +20,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include "tm4c123gh6pm.h"
 #include "uart0.h"
@@ -27,6 +28,7 @@
 #include "dhcp.h"
 #include "eeprom.h"
 #include "mqtt.h"
+#include "mqttsn.h"
 #include "ifttt.h"
 
 // PortA masks
@@ -166,13 +168,14 @@ void parseFields(USER_DATA* data)
         {
             break;
         }
-        if((strcmp(data->command, "publish") == 0 || strcmp(data->command, "subscribe") == 0 || strcmp(data->command, "unsubscribe") == 0))
+        if((strcmp(data->command, "publish") == 0 || strcmp(data->command, "subscribe") == 0 || strcmp(data->command, "unsubscribe") == 0
+                || strcmp(data->command, "snpublish") == 0))
         {
             if(i == 0)
             {
                 strcpy(data->topic, token);
             }
-            else if(i == 1 && strcmp(data->command, "publish") == 0)
+            else if(i == 1 && (strcmp(data->command, "publish") == 0 || strcmp(data->command, "snpublish") == 0))
             {
                 strcpy(data->topicvalue, token);
             }
@@ -354,6 +357,10 @@ void executeUrtCommand(USER_DATA* data)
         {
             printSubscribedTopics();
         }
+        else if(strcmp(data->strParam, "backlog") == 0)
+        {
+            printMqttBacklog();
+        }
         else{
             printInputList("supported inputs: ");
             printOutputList("supported outputs: ");
@@ -372,21 +379,63 @@ void executeUrtCommand(USER_DATA* data)
     {
         mqttPublish(data->topic, strlen(data->topic), data->topicvalue, strlen(data->topicvalue));
     }
+    // the mqtt-sn gateway runs on the broker's host
+    else if(strcmp(data->command, "snconnect") == 0)
+    {
+        uint8_t gatewayIP[IP_ADD_LENGTH];
+        uint8_t gatewayMac[] = {0x60, 0x45,0xbd,0xfa, 0xf6, 0x2b};
+        mqttGetIpAddress(gatewayIP);
+        if(gatewayIP[0] == 0 && gatewayIP[1] == 0 && gatewayIP[2] == 0 && gatewayIP[3] == 0)
+        {
+            gatewayIP[0] = 192; gatewayIP[1] = 168; gatewayIP[2] = 1; gatewayIP[3] = 199;
+        }
+        mqttsnConnect(gatewayIP, gatewayMac);
+    }
+    else if(strcmp(data->command, "sndisconnect") == 0)
+    {
+        mqttsnDisconnect();
+    }
+    else if(strcmp(data->command, "snpublish") == 0)
+    {
+        // a new topic name is registered first, publish again once it is
+        if(!mqttsnPublish(data->topic, strlen(data->topic), (uint8_t*) data->topicvalue,
+                          strlen(data->topicvalue), 0))
+        {
+            putsUart0("Not sent, try again\n");
+        }
+    }
+}
+
+// publishes logged to flash while the broker was away
+void printMqttBacklog()
+{
+    char str[12];
+    putsUart0("Unsent publishes: ");
+    sprintf(str, "%lu", (unsigned long) mqttBacklogDepth());
+    putsUart0(str);
+    if (mqttBacklogDepth() > 0)
+    {
+        putsUart0(", oldest logged at ");
+        sprintf(str, "%lu", (unsigned long) mqttBacklogOldest());
+        putsUart0(str);
+        putsUart0(" s");
+    }
+    putcUart0('\n');
 }
 
 void printSubscribedTopics()
 {
-    mqttSubscribedTopic topics[] = getMqttSubscribedTopics();
-    uint8_t i = 0;
+    char name[MAX_TOPIC_NAME_SIZE];
+    uint8_t node = mqttNextSubscription(MQTT_NO_NODE);
     putsUart0("Subscribed Topics: ");
     putcUart0('\n');
-    for(i =0; i < MAX_SUBSCRIBED_TOPIC;i++)
+    while (node != MQTT_NO_NODE)
     {
-        if(topics[i].topicId == 0xff)
-        {
-            putsUart0(topics[i].topicName);
-            putcUart0(', ');
-        }
+        mqttGetTopicName(node, name, sizeof(name));
+        putsUart0(name);
+        node = mqttNextSubscription(node);
+        if (node != MQTT_NO_NODE)
+            putsUart0(", ");
     }
     putcUart0('\n');
 }